@@ -11,13 +11,87 @@
 
 #include "app.h"
 
-// VEM SEE SN-3002-TR-ECTHNPKKPH-N01
-#define VEMSEE
-// GEMHO 7in1 Soil Sensor with RS485
-// #define GEMHO
-
-/** Data array for modbus 9 registers */
-union coils_n_regs_u coils_n_regs = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+/** Maximum number of transactions in one bus session */
+#define MB_MAX_TRANSACTIONS 4
+
+/** Number of repetitions of a request without (valid) answer */
+#define MB_RETRIES 3
+/** Wait time before the first repetition in ms, doubled for each further repetition */
+#define MB_RETRY_BACKOFF 100
+/** Upper limit for the response time-out in ms, the learned time-outs are usually much shorter */
+#define MB_MAX_TIMEOUT 2000
+
+/** Decoded sensor values of each probe */
+soil_data_s soil_data[MB_MAX_PROBES];
+/** Spread of the oversampled sensor values of each probe */
+soil_data_s soil_spread[MB_MAX_PROBES];
+
+/** Value checked for convergence during the sensor warm-up */
+struct warmup_check_s
+{
+	/** Field in the decoded sensor values */
+	int32_t soil_data_s::*field;
+	/** Change that is always accepted as stable, in the LPP unit of the value */
+	float min_delta;
+};
+
+/** Values that must be stable before the sensor is read */
+const warmup_check_s warmup_checks[] = {
+	{&soil_data_s::moisture, 0.5},
+	{&soil_data_s::temperature, 0.2},
+	{&soil_data_s::conductivity, 5.0},
+};
+/** Number of values checked during warm-up */
+#define WARMUP_CHECKS (sizeof(warmup_checks) / sizeof(warmup_checks[0]))
+/** Number of consecutive warm-up reads within the tolerance before the values are sent */
+#define WARMUP_STABLE_READS 2
+/** Previous value before the first warm-up read, never within the tolerance */
+#define WARMUP_NO_VALUE 1.0e9
+
+/** millis() when the sensor was powered up */
+uint32_t sensor_power_up = 0;
+/** Number of consecutive warm-up reads within the tolerance */
+uint8_t warmup_stable = 0;
+/** Values of the previous warm-up read of each probe */
+float warmup_last[MB_MAX_PROBES][WARMUP_CHECKS];
+/** Warm-up statistics */
+warmup_stats_s warmup_stats;
+
+/** Time the sensor is powered up before a test read in ms */
+#define SENSOR_TEST_TIME 5000
+/** Time for the RS485 line to settle after the UART is initialized in ms */
+#define MB_SETTLE_TIME 500
+/** Wait time if the bus is used by the sensor reading or a downlink write in ms */
+#define CYCLE_BUSY_RETRY 100
+
+/** Current state of the acquisition cycle, one of cycle_state_e */
+uint8_t cycle_state = CYC_IDLE;
+/** millis() when the current state was entered */
+uint32_t cycle_state_start = 0;
+/** Flag if the cycle is a sensor test */
+bool cycle_test = false;
+/** LED that is on while the sensor is powered */
+uint32_t cycle_led = LED_BLUE;
+/** Baud rate UART and Modbus master are initialized for, 0 = UART is off */
+uint32_t uart_baud = 0;
+/** Probe that is read */
+uint8_t cycle_probe = 0;
+/** Number of finished reads of the current probe with oversampling */
+uint8_t cycle_sample = 0;
+/** Flag if the payload of the cycle is a batch of readings */
+bool cycle_batch = false;
+/** Flag if a downlink write to the Modbus slave is active */
+bool write_active = false;
+/** First write of the running batch */
+uint8_t write_next = 0;
+/** Number of writes in the running batch */
+uint8_t write_count = 0;
+/** Timing trace of the running cycle */
+cycle_trace_s cycle_trace;
+/** Timing trace of the last finished cycle */
+cycle_trace_s last_cycle_trace;
+/** State names for the timing trace */
+const char *cycle_state_names[CYC_NUM_STATES] = {"idle", "power-up", "uart-init", "settle", "query", "response", "power-down", "encode", "send"};
 
 /**
  *  Modbus object declaration
@@ -28,17 +102,23 @@ union coils_n_regs_u coils_n_regs = {0, 0, 0, 0, 0, 0, 0, 0, 0};
  */
 Modbus master(0, Serial1, 0); // this is master and RS-232 or USB-FTDI
 
-/** This is an structure which contains a query to an slave device */
-modbus_t telegram;
+/** Transaction queue to run several queries back-to-back */
+ModbusQueue mb_queue(master);
+
+/** Read planner to combine the sensor registers into as few requests as possible */
+ModbusPlanner planner;
 
-/** Coils structure */
-coil_s coil_data;
+/** Transactions for sensor reading */
+modbus_transaction_t transactions[MB_MAX_TRANSACTIONS];
 
-/** Register structure */
-register_s register_data;
+/** Flag if all sensor values were received */
+bool data_ready = false;
 
-/** Flag if write is for coils or for registers */
-bool is_registers = false;
+/** Register addresses to read, generated from the register map */
+uint16_t sensor_registers[MB_PLAN_MAX_WANTED];
+
+/** Number of register addresses to read */
+uint8_t sensor_registers_num = 0;
 
 /** Packet is confirmed/unconfirmed (Set with AT commands) */
 bool g_confirmed_mode = false;
@@ -53,6 +133,9 @@ uint8_t set_fPort = 2;
 /** Payload buffer */
 WisCayenne g_solution_data(255);
 
+/** Payload buffer for the compact payload format */
+CompactPayload g_compact_data;
+
 /** Flag if sensor reading is active */
 bool sensor_active = false;
 
@@ -121,24 +204,104 @@ void setup()
 		MYLOG("SETUP", "Add custom AT command sensor test failed");
 	}
 
+	// Register the Modbus statistics command
+	if (!init_mbstat_at())
+	{
+		MYLOG("SETUP", "Add custom AT command Modbus statistics failed");
+	}
+
+	// Register the sensor warm-up command
+	if (!init_warmup_at())
+	{
+		MYLOG("SETUP", "Add custom AT command sensor warm-up failed");
+	}
+
+	// Register the sensor probes command
+	if (!init_probes_at())
+	{
+		MYLOG("SETUP", "Add custom AT command sensor probes failed");
+	}
+
+	// Register the sensor profile commands
+	if (!init_profile_at())
+	{
+		MYLOG("SETUP", "Add custom AT command sensor profiles failed");
+	}
+
+	// Register the oversampling command
+	if (!init_oversample_at())
+	{
+		MYLOG("SETUP", "Add custom AT command oversampling failed");
+	}
+
+	// Register the battery monitor command
+	if (!init_batt_at())
+	{
+		MYLOG("SETUP", "Add custom AT command battery monitor failed");
+	}
+
+	// Register the payload format commands
+	if (!init_payload_at())
+	{
+		MYLOG("SETUP", "Add custom AT command payload format failed");
+	}
+
+	// Register the batching command
+	if (!init_batch_at())
+	{
+		MYLOG("SETUP", "Add custom AT command batching failed");
+	}
+
+	// Register the backlog command
+	if (!init_backlog_at())
+	{
+		MYLOG("SETUP", "Add custom AT command backlog failed");
+	}
+
+	// Register the report-by-exception commands
+	if (!init_rbe_at())
+	{
+		MYLOG("SETUP", "Add custom AT command report-by-exception failed");
+	}
+
+	// Register the datarate margin command
+	if (!init_dr_margin_at())
+	{
+		MYLOG("SETUP", "Add custom AT command datarate margin failed");
+	}
+
+	// Register the airtime budget command
+	if (!init_airtime_at())
+	{
+		MYLOG("SETUP", "Add custom AT command airtime budget failed");
+	}
+
 	// Get saved sending interval from flash
 	get_at_setting();
 
+	// Get the sensor profiles from flash
+	load_profiles();
+
+	// Sample the battery before the sensor is powered, then on RAK_TIMER_3 while the device is idle
+	battery_init();
+
+	// Get the index of the unsent readings from flash, they are sent on RAK_TIMER_4 after the next uplink or join
+	backlog_init();
+
 	digitalWrite(LED_GREEN, LOW);
 
 	// Initialize the Modbus interface on Serial1 (connected to RAK5802 RS485 module)
 	pinMode(WB_IO2, OUTPUT);
 	digitalWrite(WB_IO2, HIGH);
 	Serial1.end();
-#ifdef VEMSEE
-	Serial1.begin(4800, RAK_CUSTOM_MODE);
-#endif
-#ifdef GEMHO
-	Serial1.begin(9600, RAK_CUSTOM_MODE);
-#endif
+	Serial1.begin(probe_profile(0)->baud, RAK_CUSTOM_MODE);
 	// master.start();
 	// master.setTimeOut(2000); // if there is no answer in 2000 ms, roll over
 
+	// Learn the response time of the sensor and retry failed requests within the same power-up
+	master.setAdaptiveTimeOut(true);
+	mb_queue.setRetries(MB_RETRIES, MB_RETRY_BACKOFF);
+
 	// Create a timer for interval reading of sensor from Modbus slave.
 	api.system.timer.create(RAK_TIMER_0, modbus_start_sensor, RAK_TIMER_PERIODIC);
 	if (custom_parameters.send_interval != 0)
@@ -150,8 +313,8 @@ void setup()
 	// Create a timer for handling downlink write request to Modbus slave.
 	api.system.timer.create(RAK_TIMER_1, modbus_write_coil, RAK_TIMER_ONESHOT);
 
-	// Create a timer to read the sensor after 30 seconds power up.
-	api.system.timer.create(RAK_TIMER_2, modbus_read_register, RAK_TIMER_ONESHOT);
+	// Create a timer for the steps of the sensor acquisition cycle.
+	api.system.timer.create(RAK_TIMER_2, sensor_cycle_step, RAK_TIMER_ONESHOT);
 
 	// Check if it is LoRa P2P
 	if (api.lorawan.nwm.get() == 0)
@@ -197,416 +360,790 @@ void setup()
 }
 
 /**
- * @brief Power up sensor for data collection
- * 		Power up time is defined by SENSOR_POWER_TIME
- * 		Sensor reading and data transmission is done after SENSOR_POWER_TIME
+ * @brief Timer callback to start a sensor acquisition cycle
  *
  */
 void modbus_start_sensor(void *)
 {
+	// With low battery only every n-th reading is done
+	if (battery_skip_reading())
+	{
+		return;
+	}
+	if (!sensor_cycle_start(false))
+	{
+		MYLOG("MODR", "Sensor cycle still active, skip this reading");
+	}
+}
+
+/**
+ * @brief Power up sensor for data collection
+ * 		Maximum power up time is defined by SENSOR_POWER_TIME
+ * 		With warm-up enabled, the sensor is read every warmup_interval seconds
+ * 		and the data is sent as soon as the values are stable,
+ * 		otherwise sensor reading and data transmission is done after SENSOR_POWER_TIME.
+ * 		All further steps of the cycle are done by sensor_cycle_step() on RAK_TIMER_2.
+ *
+ * @param test true = read the sensor once after SENSOR_TEST_TIME and print the values instead of sending them
+ * @return true cycle started
+ * @return false a cycle is already active
+ */
+bool sensor_cycle_start(bool test)
+{
+	if (cycle_state != CYC_IDLE)
+	{
+		return false;
+	}
+
+	memset(&cycle_trace, 0, sizeof(cycle_trace_s));
+	cycle_test = test;
+	if (!test)
+	{
+		// Payload format and batching of this cycle depend on the used airtime
+		airtime_update();
+	}
+	cycle_led = test ? LED_GREEN : LED_BLUE;
 	digitalWrite(WB_IO2, HIGH);
-	digitalWrite(LED_BLUE, HIGH);
+	digitalWrite(cycle_led, HIGH);
 	sensor_active = true;
+	sensor_power_up = millis();
+	warmup_reset();
+	cycle_state_start = sensor_power_up;
+	cycle_state = CYC_POWER_UP;
 	MYLOG("MODR", "Power-up sensor");
-	api.system.timer.start(RAK_TIMER_2, SENSOR_POWER_TIME, NULL); // 600000 ms = 600 seconds = 10 minutes power on
+
+	uint32_t first_read = SENSOR_POWER_TIME; // 300000 ms = 300 seconds = 5 minutes power on
+	uint32_t warmup_interval = custom_parameters.warmup_interval * 1000;
+	if (test)
+	{
+		first_read = SENSOR_TEST_TIME;
+	}
+	else if ((warmup_interval != 0) && (warmup_interval < SENSOR_POWER_TIME))
+	{
+		first_read = warmup_interval;
+	}
+	api.system.timer.start(RAK_TIMER_2, first_read, NULL);
+	return true;
 }
 
 /**
- * @brief Read ModBus registers
- * 		Reads first 9 registers with the sensor data
- * 		If sensor data could be retrieved, the sensor data is sent over LoRa/LoRaWAN
+ * @brief Switch the acquisition cycle to a new state and record the time spent in the old one
  *
+ * @param new_state next state, one of cycle_state_e
  */
-void modbus_read_register(void *test)
+void cycle_enter(uint8_t new_state)
 {
-	if (test != NULL)
+	uint32_t now = millis();
+	cycle_trace.state_time[cycle_state] += now - cycle_state_start;
+	cycle_state_start = now;
+	cycle_state = new_state;
+
+	if (new_state == CYC_IDLE)
 	{
-		MYLOG("MODR", "Test sensor reading");
+		sensor_active = false;
+		last_cycle_trace = cycle_trace;
+		MYLOG("CYCLE", "Cycle finished after %ld ms, %d reads, %d steps, CPU busy %ld us",
+			  now - sensor_power_up, cycle_trace.reads, cycle_trace.steps, cycle_awake_time(cycle_trace));
 	}
-	else
+}
+
+/**
+ * @brief Get the total time the CPU was busy in the state machine
+ *
+ * @param trace timing trace of a cycle
+ * @return uint32_t busy time in us
+ */
+uint32_t cycle_awake_time(const cycle_trace_s &trace)
+{
+	uint32_t awake_time = 0;
+	for (uint8_t state = 0; state < CYC_NUM_STATES; state++)
 	{
-		MYLOG("MODR", "Scheduled sensor reading");
+		awake_time += trace.awake_time[state];
 	}
-	time_t start_poll;
-	bool data_ready;
-#ifdef VEMSEE
-	Serial1.begin(4800, RAK_CUSTOM_MODE);
-#endif
-#ifdef GEMHO
-	Serial1.begin(9600, RAK_CUSTOM_MODE);
-#endif
-	MYLOG("MODR", "Serial initialized");
-	delay(500);
-	master.start();
-	master.setTimeOut(2000); // if there is no answer in 2000 ms, roll over
-	MYLOG("MODR", "Modbus master initialized");
-	delay(500);
+	return awake_time;
+}
 
-	// Clear payload
-	g_solution_data.reset();
+/**
+ * @brief Timer callback of the acquisition cycle
+ * 		Runs the state handlers until one of them has to wait,
+ * 		then restarts RAK_TIMER_2 with the wait time. Nothing in here blocks,
+ * 		the MCU sleeps in loop() between the steps.
+ *
+ */
+void sensor_cycle_step(void *)
+{
+	uint32_t next_step = 0;
+	cycle_trace.steps++;
 
-#ifdef VEMSEE
-	MYLOG("MODR", "Send read request over ModBus");
-	// Clear data structure
-	coils_n_regs.data[0] = coils_n_regs.data[1] = coils_n_regs.data[2] = coils_n_regs.data[3] = coils_n_regs.data[4] = 0xFFFF;
-	coils_n_regs.data[5] = coils_n_regs.data[6] = coils_n_regs.data[7] = coils_n_regs.data[8] = 0xFFFF;
-	// Setup read command
-	telegram.u8id = 1;					   // slave address
-	telegram.u8fct = MB_FC_READ_REGISTERS; // function code (this one is registers read)
-	telegram.u16RegAdd = 0;				   // start address in slave
-	telegram.u16CoilsNo = 9;			   // number of elements (coils or registers) to read
-	telegram.au16reg = coils_n_regs.data;  // pointer to a memory array in the Arduino
-
-	// Send query (only once)
-	master.query(telegram);
-
-	start_poll = millis();
-	data_ready = false;
-	// Wait for slave response for 5 seconds
-	while ((millis() - start_poll) < 10000)
+	while ((next_step == 0) && (cycle_state != CYC_IDLE))
 	{
-		// Check incoming messages
-		if (master.poll() != 0)
+		uint8_t state = cycle_state;
+		uint32_t step_start = micros();
+		switch (state)
 		{
-			// Status idle, either data was received or the slave response timed out
-			if (master.getState() == COM_IDLE)
-			{
-				// Check if register structure has changed
-				// if (coils_n_regs.data[0] == 0xFFFF)
-				if ((uint16_t)(coils_n_regs.sensor_data.reg_1) == 0xFFFF)
-				{
-					MYLOG("MODR", "No data received");
-					MYLOG("MODR", "%04X %04X %04X %04X %04X %04X %04X %04X %04X ",
-						  coils_n_regs.data[0], coils_n_regs.data[1], coils_n_regs.data[2], coils_n_regs.data[3],
-						  coils_n_regs.data[4], coils_n_regs.data[5], coils_n_regs.data[6], coils_n_regs.data[7], coils_n_regs.data[8]);
-					break;
-				}
-				else
-				{
-					MYLOG("MODR", "Moisture = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_1) / 10.0);
-					MYLOG("MODR", "Temperature = %.2f", coils_n_regs.sensor_data.reg_2 / 10.0);
-					MYLOG("MODR", "Conductivity = %.1f", (uint16_t)coils_n_regs.sensor_data.reg_3 * 1.0);
-					MYLOG("MODR", "pH = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_4) / 10.0);
-					MYLOG("MODR", "Nitrogen = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_5) * 1.0);
-					MYLOG("MODR", "Phosphorus = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_6) * 1.0);
-					MYLOG("MODR", "Potassium = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_7) * 1.0);
-					MYLOG("MODR", "Salinity = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_8) * 1.0);
-					MYLOG("MODR", "TDS = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_9) * 1.0);
-
-					data_ready = true;
-
-					// Add temperature level to payload
-					g_solution_data.addTemperature(LPP_CHANNEL_TEMP, coils_n_regs.sensor_data.reg_2 / 10.0);
+		case CYC_POWER_UP:
+			next_step = cycle_power_up();
+			break;
+		case CYC_UART_INIT:
+			next_step = cycle_uart_init();
+			break;
+		case CYC_SETTLE:
+			next_step = cycle_settle();
+			break;
+		case CYC_QUERY:
+			next_step = cycle_query();
+			break;
+		case CYC_RESPONSE:
+			next_step = cycle_response();
+			break;
+		case CYC_POWER_DOWN:
+			next_step = cycle_power_down();
+			break;
+		case CYC_ENCODE:
+			next_step = cycle_encode();
+			break;
+		case CYC_SEND:
+			next_step = cycle_send();
+			break;
+		default:
+			cycle_enter(CYC_IDLE);
+			break;
+		}
+		cycle_trace.awake_time[state] += micros() - step_start;
+	}
 
-					// Add moisture level to payload
-					g_solution_data.addRelativeHumidity(LPP_CHANNEL_MOIST, (uint16_t)(coils_n_regs.sensor_data.reg_1) / 10.0);
+	if (cycle_state != CYC_IDLE)
+	{
+		api.system.timer.start(RAK_TIMER_2, next_step, NULL);
+	}
+}
 
-					// Add conductivity value to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_COND, (uint16_t)(coils_n_regs.sensor_data.reg_3));
+/**
+ * @brief Print the timing trace of the last finished acquisition cycle
+ *
+ */
+void print_cycle_trace(void)
+{
+	if (last_cycle_trace.steps == 0)
+	{
+		AT_PRINTF("No sensor cycle finished yet");
+		return;
+	}
+	AT_PRINTF("Last cycle: %d reads, %d steps, CPU busy %ld us", last_cycle_trace.reads, last_cycle_trace.steps, cycle_awake_time(last_cycle_trace));
+	for (uint8_t state = CYC_POWER_UP; state < CYC_NUM_STATES; state++)
+	{
+		AT_PRINTF("  %-10s %7ld ms, busy %6ld us", cycle_state_names[state], last_cycle_trace.state_time[state], last_cycle_trace.awake_time[state]);
+	}
+}
 
-					// Add pH value to payload
-					g_solution_data.addAnalogOutput(LPP_CHANNEL_PH, (uint16_t)(coils_n_regs.sensor_data.reg_4) / 10);
+/**
+ * @brief Restart the convergence detection
+ *
+ */
+void warmup_reset(void)
+{
+	warmup_stable = 0;
+	for (uint8_t probe = 0; probe < MB_MAX_PROBES; probe++)
+	{
+		for (uint8_t idx = 0; idx < WARMUP_CHECKS; idx++)
+		{
+			warmup_last[probe][idx] = WARMUP_NO_VALUE;
+		}
+	}
+}
 
-					// Add nitrogen level to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_NITRO, (uint16_t)(coils_n_regs.sensor_data.reg_5));
+/**
+ * @brief Check if the warm-up values of all probes changed less than the tolerance since the last read
+ * 		Stores the values for the next check
+ *
+ * @return true all checked values are stable
+ * @return false at least one value changed too much or is missing
+ */
+bool warmup_values_stable(void)
+{
+	bool stable = true;
+	for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
+	{
+		const sensor_profile_s *profile = probe_profile(probe);
+		for (uint8_t idx = 0; idx < WARMUP_CHECKS; idx++)
+		{
+			float value = reg_map_value(profile->map, profile->map_size, soil_data[probe], warmup_checks[idx].field);
+			float limit = fabsf(value) * custom_parameters.warmup_tolerance / 100.0;
+			if (limit < warmup_checks[idx].min_delta)
+			{
+				limit = warmup_checks[idx].min_delta;
+			}
+			if (fabsf(value - warmup_last[probe][idx]) > limit)
+			{
+				stable = false;
+			}
+			warmup_last[probe][idx] = value;
+		}
+	}
+	return stable;
+}
 
-					// Add phosphorus level to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_PHOS, (uint16_t)(coils_n_regs.sensor_data.reg_6));
+/**
+ * @brief Get the sensor profile of a probe
+ *
+ * @param probe index of the probe
+ * @return const sensor_profile_s* profile of the probe, the default profile if the profile of the probe was deleted
+ */
+const sensor_profile_s *probe_profile(uint8_t probe)
+{
+	const sensor_profile_s *profile = get_profile(custom_parameters.probes[probe].profile);
+	return (profile != NULL) ? profile : get_profile(PROFILE_VEMSEE);
+}
 
-					// Addf potassium level to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_POTA, (uint16_t)(coils_n_regs.sensor_data.reg_7));
+/**
+ * @brief Get the slave address of a probe
+ *
+ * @param probe index of the probe
+ * @return uint8_t slave address of the probe, or of its profile if the probe has none
+ */
+uint8_t probe_address(uint8_t probe)
+{
+	uint8_t address = custom_parameters.probes[probe].address;
+	return (address != 0) ? address : probe_profile(probe)->address;
+}
 
-					// Add salinity level to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_SALIN, (uint16_t)(coils_n_regs.sensor_data.reg_8));
+/**
+ * @brief Check if all values of a probe were received
+ *
+ * @param probe index of the probe
+ * @return true all values of the register map were received
+ * @return false at least one value is missing
+ */
+bool probe_complete(uint8_t probe)
+{
+	return soil_data[probe].valid == ((1UL << probe_profile(probe)->map_size) - 1);
+}
 
-					// Add TDS value to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_TDS, (uint16_t)(coils_n_regs.sensor_data.reg_9));
+/**
+ * @brief Callback when all sensor read transactions of a probe are finished
+ * 		Decodes the received registers into soil_data of the probe
+ *
+ * @param transactions finished read transactions
+ * @param count number of transactions
+ */
+void modbus_read_done(modbus_transaction_t *transactions, uint8_t count)
+{
+	const sensor_profile_s *profile = probe_profile(cycle_probe);
+	soil_data_s &data = soil_data[cycle_probe];
+	int16_t regs[MB_PLAN_MAX_WANTED];
+	uint32_t received = planner.scatter(transactions, regs);
+	reg_map_decode(profile->map, profile->map_size, regs, received, data);
 
-					break;
-				}
-			}
+	for (uint8_t idx = 0; idx < count; idx++)
+	{
+		if (transactions[idx].u8tries > 1)
+		{
+			MYLOG("MODR", "Request %d needed %d tries, result %d", idx, transactions[idx].u8tries, transactions[idx].u8result);
 		}
 	}
-#endif
-
-#ifdef GEMHO
-	MYLOG("MODR", "Send read request over ModBus");
-	// Clear data structure
-	coils_n_regs.data[0] = coils_n_regs.data[1] = coils_n_regs.data[2] = coils_n_regs.data[3] = coils_n_regs.data[4] = 0xFFFF;
-	coils_n_regs.data[5] = coils_n_regs.data[6] = coils_n_regs.data[7] = coils_n_regs.data[8] = 0xFFFF;
 
-	// Setup read command for T, H, E and pH
-	telegram.u8id = 1;					   // slave address
-	telegram.u8fct = MB_FC_READ_REGISTERS; // function code (this one is registers read)
-	telegram.u16RegAdd = 6;				   // start address in slave
-	telegram.u16CoilsNo = 4;			   // number of elements (coils or registers) to read
-	telegram.au16reg = coils_n_regs.data;  // pointer to a memory array in the Arduino
+	MYLOG("MODR", "Probe %d, address %d, %s", cycle_probe, probe_address(cycle_probe), profile->name);
+	if (!probe_complete(cycle_probe))
+	{
+		MYLOG("MODR", "Not all data received, %d of %d requests ok, values %04lX", mb_queue.getOkCount(), count, data.valid);
+	}
+	MYLOG("MODR", "Moisture = %.2f", reg_map_value(profile->map, profile->map_size, data, &soil_data_s::moisture));
+	MYLOG("MODR", "Temperature = %.2f", reg_map_value(profile->map, profile->map_size, data, &soil_data_s::temperature));
+	MYLOG("MODR", "Conductivity = %.1f", reg_map_value(profile->map, profile->map_size, data, &soil_data_s::conductivity));
+	MYLOG("MODR", "pH = %.2f", reg_map_value(profile->map, profile->map_size, data, &soil_data_s::ph));
+	MYLOG("MODR", "Nitrogen = %ld", data.nitrogen);
+	MYLOG("MODR", "Phosphorus = %ld", data.phosphorus);
+	MYLOG("MODR", "Potassium = %ld", data.potassium);
+	MYLOG("MODR", "Salinity = %ld", data.salinity);
+	MYLOG("MODR", "TDS = %ld", data.tds);
+}
 
-	// Send query (only once)
-	master.query(telegram);
+/**
+ * @brief Add the received values of a probe to the payload, each probe on its own channels
+ * 		With oversampling the spread of the values is added if enabled
+ *
+ * @param probe index of the probe
+ */
+void probe_encode(uint8_t probe)
+{
+	if (airtime_compact())
+	{
+		// The compact payload is built from all probes in cycle_encode()
+		return;
+	}
+	const sensor_profile_s *profile = probe_profile(probe);
+	reg_map_encode(profile->map, profile->map_size, soil_data[probe], g_solution_data, probe * PROBE_CHANNEL_STEP);
+	if ((custom_parameters.oversample_reads > 1) && (custom_parameters.oversample_spread != 0))
+	{
+		reg_map_encode(profile->map, profile->map_size, soil_spread[probe], g_solution_data, probe * PROBE_CHANNEL_STEP + SPREAD_CHANNEL_OFFSET);
+	}
+}
 
-	start_poll = millis();
-	data_ready = false;
-	// Wait for slave response for 10 seconds
-	while ((millis() - start_poll) < 10000)
+/**
+ * @brief Get the probes with missing values
+ *
+ * @return uint8_t bit n is set if not all values of probe n were received
+ */
+uint8_t probe_errors(void)
+{
+	uint8_t errors = 0;
+	for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
 	{
-		// Check incoming messages
-		if (master.poll() != 0)
+		if (!probe_complete(probe))
 		{
-			// Status idle, either data was received or the slave response timed out
-			if (master.getState() == COM_IDLE)
-			{
-				// Check if register structure has changed
-				if ((coils_n_regs.data[0] == 0xFFFF) && (coils_n_regs.data[1] == 0xFFFF) && (coils_n_regs.data[2] == 0xFFFF) && (coils_n_regs.data[3] == 0xFFFF))
-				{
-					MYLOG("MODR", "No data received");
-					MYLOG("MODR", "%04X %04X %04X %04X",
-						  coils_n_regs.data[0], coils_n_regs.data[1], coils_n_regs.data[2], coils_n_regs.data[3]);
-					break;
-				}
-				else
-				{
-					MYLOG("MODR", "Moisture = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_2) / 100.0);
-					MYLOG("MODR", "Temperature = %.2f", coils_n_regs.sensor_data.reg_1 / 100.0);
-					MYLOG("MODR", "Conductivity = %.1f", (uint16_t)coils_n_regs.sensor_data.reg_3);
-					MYLOG("MODR", "pH = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_4) / 100.0);
-					data_ready = true;
+			errors |= (1 << probe);
+		}
+	}
+	return errors;
+}
 
-					// Add temperature level to payload
-					g_solution_data.addTemperature(LPP_CHANNEL_TEMP, coils_n_regs.sensor_data.reg_2 / 100);
+/**
+ * @brief Get the text to identify a probe in the test output
+ *
+ * @param probe index of the probe
+ * @return const char* empty with a single probe, otherwise " <address>"
+ */
+const char *probe_tag(uint8_t probe)
+{
+	static char tag[8];
+	if (custom_parameters.probe_num == 1)
+	{
+		return "";
+	}
+	snprintf(tag, sizeof(tag), " %d", probe_address(probe));
+	return tag;
+}
 
-					// Add moisture level to payload
-					g_solution_data.addRelativeHumidity(LPP_CHANNEL_MOIST, (uint16_t)(coils_n_regs.sensor_data.reg_1) / 100);
+/**
+ * @brief Sensor warm-up time is over, start reading with the first probe
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_power_up(void)
+{
+	MYLOG("MODR", "Sensor read after %ld ms", millis() - sensor_power_up);
+	// Clear payload
+	g_solution_data.reset();
+	data_ready = false;
+	cycle_probe = 0;
+	cycle_sample = 0;
+	oversample_reset();
+	cycle_trace.reads++;
+	cycle_enter(CYC_QUERY);
+	return 0;
+}
 
-					// Add conductivity value to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_COND, (uint16_t)(coils_n_regs.sensor_data.reg_3));
+/**
+ * @brief Initialize the RS485 UART and the Modbus master for the baud rate of the current probe
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_uart_init(void)
+{
+	if (write_active)
+	{
+		// A downlink write is using the UART, try again when it is finished
+		return CYCLE_BUSY_RETRY;
+	}
+	uint32_t baud = probe_profile(cycle_probe)->baud;
+	if (probe_profile(cycle_probe)->parity != PROFILE_PARITY_NONE)
+	{
+		MYLOG("MODR", "Serial port supports only 8N1, parity of the profile is ignored");
+	}
+	Serial1.begin(baud, RAK_CUSTOM_MODE);
+	master.start();
+	master.setBaudRate(baud);
+	master.setTimeOut(MB_MAX_TIMEOUT); // if there is no answer in MB_MAX_TIMEOUT ms, roll over
+	MYLOG("MODR", "Modbus master initialized with %ld baud, time-out %d ms", baud,
+		  master.getAdaptiveTimeOut(probe_address(cycle_probe), MB_FC_READ_REGISTERS));
+	uart_baud = baud;
+	cycle_enter(CYC_SETTLE);
+	return MB_SETTLE_TIME;
+}
 
-					// Add pH value to payload
-					g_solution_data.addAnalogOutput(LPP_CHANNEL_PH, (uint16_t)(coils_n_regs.sensor_data.reg_4) / 100);
+/**
+ * @brief RS485 line is settled
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_settle(void)
+{
+	cycle_enter(CYC_QUERY);
+	return 0;
+}
 
-					break;
-				}
-			}
-		}
+/**
+ * @brief Plan the read requests of the current probe and start them on the transaction queue
+ * 		The UART is (re-)initialized first if it is off or runs with the baud rate of another sensor type
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_query(void)
+{
+	if (mb_queue.isBusy())
+	{
+		// A downlink write is running on the bus, try again when it is finished
+		return CYCLE_BUSY_RETRY;
 	}
 
-	// Clear data structure
-	coils_n_regs.data[0] = coils_n_regs.data[1] = coils_n_regs.data[2] = 0xFFFF;
+	const sensor_profile_s *profile = probe_profile(cycle_probe);
+	if (uart_baud != profile->baud)
+	{
+		cycle_enter(CYC_UART_INIT);
+		return 0;
+	}
 
-	// Setup read command for N, Ph, Po
-	telegram.u8id = 1;					   // slave address
-	telegram.u8fct = MB_FC_READ_REGISTERS; // function code (this one is registers read)
-	telegram.u16RegAdd = 0x1e;			   // start address in slave
-	telegram.u16CoilsNo = 3;			   // number of elements (coils or registers) to read
-	telegram.au16reg = coils_n_regs.data;  // pointer to a memory array in the Arduino
+	MYLOG("MODR", "Send read requests over ModBus");
+	soil_data[cycle_probe].valid = 0;
+	// Plan the read commands
+	sensor_registers_num = reg_map_addresses(profile->map, profile->map_size, sensor_registers, MB_PLAN_MAX_WANTED);
+	uint8_t num_telegrams = planner.plan(probe_address(cycle_probe), profile->fct,
+										 sensor_registers, sensor_registers_num, profile->policy,
+										 transactions, MB_MAX_TRANSACTIONS);
+	MYLOG("MODR", "Reading %d registers with %d requests", planner.getRegCount(), num_telegrams);
+	// modbus_read_done() adds the values to the payload
+	if (!mb_queue.start(transactions, num_telegrams, modbus_read_done))
+	{
+		MYLOG("MODR", "Register map of probe %d does not fit into %d requests", cycle_probe, MB_MAX_TRANSACTIONS);
+	}
+	cycle_enter(CYC_RESPONSE);
+	return 0;
+}
 
-	// Send query (only once)
-	master.query(telegram);
+/**
+ * @brief Advance the transaction queue, when all answers are in continue with the next read or probe.
+ * 		With oversampling the probe is read oversample_reads times back-to-back and the reads are filtered.
+ * 		After the last probe check if the values are stable
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_response(void)
+{
+	if (mb_queue.run())
+	{
+		// Nothing to do until the next end-of-frame, time-out or inter-frame gap is due
+		uint32_t poll_delay = mb_queue.getPollDelay();
+		return poll_delay == 0 ? 1 : poll_delay;
+	}
+	MYLOG("MODR", "Bus time %ld ms", mb_queue.getDuration());
 
-	start_poll = millis();
-	// Wait for slave response for 10 seconds
-	while ((millis() - start_poll) < 10000)
+	if (custom_parameters.oversample_reads > 1)
 	{
-		// Check incoming messages
-		if (master.poll() != 0)
+		oversample_add(soil_data[cycle_probe]);
+		cycle_sample++;
+		// The sensor is powered and settled, the next read costs only the bus time.
+		// A probe that did not answer at all is not asked again.
+		if ((cycle_sample < custom_parameters.oversample_reads) && (soil_data[cycle_probe].valid != 0))
 		{
-			// Status idle, either data was received or the slave response timed out
-			if (master.getState() == COM_IDLE)
-			{
-				// Check if register structure has changed
-				if ((coils_n_regs.data[0] == 0xFFFF) && (coils_n_regs.data[1] == 0xFFFF) && (coils_n_regs.data[2] == 0xFFFF))
-				{
-					MYLOG("MODR", "No data received");
-					MYLOG("MODR", "%04X %04X %04X",
-						  coils_n_regs.data[0], coils_n_regs.data[1], coils_n_regs.data[2]);
-					data_ready = false;
-					break;
-				}
-				else
-				{
-					MYLOG("MODR", "Nitrogen = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_1));
-					MYLOG("MODR", "Phosphorus = %.2f", (uint16_t)(coils_n_regs.sensor_data.reg_2));
-					MYLOG("MODR", "Potatium = %.1f", (uint16_t)(coils_n_regs.sensor_data.reg_3));
-					data_ready = true;
-
-					// Add nitrogen level to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_NITRO, (uint16_t)(coils_n_regs.sensor_data.reg_1));
+			cycle_enter(CYC_QUERY);
+			return 0;
+		}
+		oversample_filter(probe_profile(cycle_probe), soil_data[cycle_probe], soil_spread[cycle_probe]);
+		MYLOG("MODR", "Filtered %d reads, values %04lX", cycle_sample, soil_data[cycle_probe].valid);
+		cycle_sample = 0;
+		oversample_reset();
+	}
+	probe_encode(cycle_probe);
 
-					// Add phosphorus level to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_PHOS, (uint16_t)(coils_n_regs.sensor_data.reg_2));
+	cycle_probe++;
+	if (cycle_probe < custom_parameters.probe_num)
+	{
+		cycle_enter(CYC_QUERY);
+		return 0;
+	}
 
-					// Addf potassium level to payload
-					g_solution_data.addConcentration(LPP_CHANNEL_POTA, (uint16_t)(coils_n_regs.sensor_data.reg_3));
+	data_ready = (probe_errors() == 0);
 
-					break;
+	if (cycle_test)
+	{
+		for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
+		{
+			const sensor_profile_s *profile = probe_profile(probe);
+			if (probe_complete(probe))
+			{
+				AT_PRINTF("+EVT:Sensor Values%s: M:%.2f-T:%.2f-pH:%.2f-C:%.1f\r\n", probe_tag(probe),
+						  reg_map_value(profile->map, profile->map_size, soil_data[probe], &soil_data_s::moisture),
+						  reg_map_value(profile->map, profile->map_size, soil_data[probe], &soil_data_s::temperature),
+						  reg_map_value(profile->map, profile->map_size, soil_data[probe], &soil_data_s::ph),
+						  reg_map_value(profile->map, profile->map_size, soil_data[probe], &soil_data_s::conductivity));
+				if (custom_parameters.oversample_reads > 1)
+				{
+					AT_PRINTF("+EVT:Sensor Spread%s: M:%.2f-T:%.2f-pH:%.2f-C:%.1f\r\n", probe_tag(probe),
+							  reg_map_value(profile->map, profile->map_size, soil_spread[probe], &soil_data_s::moisture),
+							  reg_map_value(profile->map, profile->map_size, soil_spread[probe], &soil_data_s::temperature),
+							  reg_map_value(profile->map, profile->map_size, soil_spread[probe], &soil_data_s::ph),
+							  reg_map_value(profile->map, profile->map_size, soil_spread[probe], &soil_data_s::conductivity));
 				}
 			}
+			else
+			{
+				AT_PRINTF("+EVT:Error reading sensor%s\r\n", probe_tag(probe));
+			}
 		}
+		cycle_enter(CYC_POWER_DOWN);
+		return 0;
 	}
-#endif
 
-	if (test != NULL)
+	uint32_t warmup_interval = custom_parameters.warmup_interval * 1000;
+	if (warmup_interval != 0)
 	{
-		if (data_ready)
+		uint32_t powered_time = millis() - sensor_power_up;
+		if (!data_ready)
 		{
-			AT_PRINTF("+EVT:Sensor Values: M:%.2f-T:%.2f-pH:%.2f-C:%.1f\r\n", (uint16_t)(coils_n_regs.sensor_data.reg_1) / 10.0,
-					  (uint16_t)(coils_n_regs.sensor_data.reg_2) / 10.0,
-					  (uint16_t)(coils_n_regs.sensor_data.reg_4) / 10.0,
-					  (uint16_t)(coils_n_regs.sensor_data.reg_3) * 1.0);
+			// Sensor not ready yet, start over
+			warmup_reset();
+		}
+		else if (warmup_values_stable())
+		{
+			warmup_stable++;
 		}
 		else
 		{
-			AT_PRINTF("+EVT:Error reading sensor\r\n");
+			warmup_stable = 0;
+		}
+
+		if (warmup_stable >= WARMUP_STABLE_READS)
+		{
+			MYLOG("MODR", "Warm-up converged after %ld ms", powered_time);
+			warmup_stats.last_time = powered_time;
+			if ((warmup_stats.converged == 0) || (powered_time < warmup_stats.min_time))
+			{
+				warmup_stats.min_time = powered_time;
+			}
+			if (powered_time > warmup_stats.max_time)
+			{
+				warmup_stats.max_time = powered_time;
+			}
+			warmup_stats.sum_time += powered_time;
+			warmup_stats.converged++;
+		}
+		else if (powered_time + 100 < SENSOR_POWER_TIME)
+		{
+			// Next read after the warm-up interval, but not later than SENSOR_POWER_TIME
+			uint32_t remaining = SENSOR_POWER_TIME - powered_time;
+			cycle_enter(CYC_POWER_UP);
+			return remaining < warmup_interval ? remaining : warmup_interval;
+		}
+		else
+		{
+			MYLOG("MODR", "Warm-up did not converge in %ld ms", powered_time);
+			warmup_stats.last_time = 0;
+			warmup_stats.timed_out++;
 		}
-		return;
 	}
 
-	// Shut down sensors and communication for lowest power consumption
+	// The payload of the last read is complete, send it
+	cycle_enter(CYC_POWER_DOWN);
+	return 0;
+}
+
+/**
+ * @brief Shut down sensor and communication for lowest power consumption
+ * 		Waiting downlink writes are executed first, they share the power up of the sensor
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_power_down(void)
+{
+	if (write_active || write_pending())
+	{
+		// Downlink writes use the powered bus, power down when they are finished
+		return CYCLE_BUSY_RETRY;
+	}
 	digitalWrite(WB_IO2, LOW);
 	Serial1.end();
 	udrv_serial_deinit(SERIAL_UART1);
-	digitalWrite(LED_BLUE, LOW);
-	sensor_active = false;
+	uart_baud = 0;
+	battery_hold_off();
+	digitalWrite(cycle_led, LOW);
+	cycle_enter(cycle_test ? CYC_IDLE : CYC_ENCODE);
+	return 0;
+}
 
-	// Add battery voltage
-	float battery_reading = 0.0;
+/**
+ * @brief Build the compact payload with all probes, it is sent or kept in the backlog,
+ * 		and add battery voltage, bus statistics, write results and error flag to the Cayenne LPP payload if that is sent
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_encode(void)
+{
+	// The compact payload is built in any case, it is the format of the backlog
+	compact_add_header(g_compact_data, battery_mv(), probe_errors());
+	for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
+	{
+		compact_add_probe(g_compact_data, probe_profile(probe), soil_data[probe]);
+	}
+	if (airtime_compact())
+	{
+		cycle_enter(CYC_SEND);
+		return 0;
+	}
 
-	for (int i = 0; i < 10; i++)
+	// Add battery voltage, sampled by the battery monitor while the sensor was off
+	g_solution_data.addFixed(LPP_CHANNEL_BATT, LPP_VOLTAGE, battery_mv(), 1000);
+
+	// Add the bus statistics since the last uplink if enabled
+	if (custom_parameters.mb_stats_uplink != 0)
 	{
-		battery_reading += api.system.bat.get(); // get battery voltage
+		add_bus_stats(custom_parameters.mb_stats_uplink);
 	}
 
-	battery_reading = battery_reading / 10;
+	// Add the results of the last downlink writes
+	add_write_result();
 
-	g_solution_data.addVoltage(LPP_CHANNEL_BATT, battery_reading);
+	// Report error if not all sensor values were received, bit n is set if probe n failed
+	g_solution_data.addDigitalInput(LPP_CHANNEL_ERROR, probe_errors());
 
-	if (data_ready)
-	{
-		// Report no error
-		g_solution_data.addDigitalInput(LPP_CHANNEL_ERROR, 0);
+	cycle_enter(CYC_SEND);
+	return 0;
+}
 
-		// Send the packet if data was received
-		send_packet();
+/**
+ * @brief Send the payload, the values or the error flag are sent in any case
+ * 		With report-by-exception the reading is only sent if a value changed or the heartbeat is due.
+ * 		With batching the compact payload is stored and sent later together with the next readings
+ *
+ * @return uint32_t time until the next step in ms
+ */
+uint32_t cycle_send(void)
+{
+	uint32_t next_reading = custom_parameters.send_interval * battery_interval_factor();
+	bool report = rbe_report(soil_data, probe_errors(), next_reading);
+	cycle_batch = batch_enabled();
+	if (cycle_batch)
+	{
+		if (report && !batch_add(g_compact_data, custom_parameters.probe_num))
+		{
+			MYLOG("BATCH", "Batch is full, reading dropped");
+		}
+		// Also checked if the reading is not sent, the stored readings must not wait beyond the latency
+		if (!batch_due(next_reading))
+		{
+			MYLOG("BATCH", "Reading %s", report ? "stored" : "not stored");
+			cycle_enter(CYC_IDLE);
+			return 0;
+		}
+		batch_build(g_compact_data);
 	}
-	else
+	else if (!report)
 	{
-		// Report error
-		g_solution_data.addDigitalInput(LPP_CHANNEL_ERROR, 1);
-		// Send the packet if data was received
-		send_packet();
+		cycle_enter(CYC_IDLE);
+		return 0;
 	}
+	send_packet();
+	cycle_enter(CYC_IDLE);
+	return 0;
 }
 
 /**
- * @brief Write to ModBus slave
- * 		Modbus register/coil address and data is prepared in
- * 		coil_data structure or registers_data structure
+ * @brief Get the baud rate of a slave
  *
+ * @param dev_addr slave address
+ * @return uint32_t baud rate of the probe with the slave address, or of the first probe
  */
-void modbus_write_coil(void *)
+uint32_t write_baud(uint8_t dev_addr)
 {
-	// Coils are in 16 bit register in form of 7-0, 15-8
-	digitalWrite(WB_IO2, HIGH);
-#ifdef VEMSEE
-	Serial1.begin(4800, RAK_CUSTOM_MODE);
-#endif
-#ifdef GEMHO
-	Serial1.begin(9600, RAK_CUSTOM_MODE);
-#endif
-
-	// Check if we write coils or registers
-	if (is_registers)
+	uint32_t baud = probe_profile(0)->baud;
+	for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
 	{
-		MYLOG("MODW", "Send write register request over ModBus");
-		MYLOG("MODW", "Num of registers %d", register_data.num_registers);
-
-		coils_n_regs.data[0] = coils_n_regs.data[1] = coils_n_regs.data[2] = coils_n_regs.data[3] = 0;
-		coils_n_regs.data[4] = coils_n_regs.data[5] = coils_n_regs.data[6] = coils_n_regs.data[7] = 0;
-
-		// Check number of registers to write
-		if (register_data.num_registers > 8)
+		if (probe_address(probe) == dev_addr)
 		{
-			MYLOG("MODW", "Too many registers requested to write. Only max 8 are allowed");
-			return;
-		}
-		// Save register status
-		for (int idx = 0; idx < register_data.num_registers; idx++)
-		{
-			coils_n_regs.data[idx] = register_data.registers[idx];
+			baud = probe_profile(probe)->baud;
 		}
+	}
+	return baud;
+}
 
-		telegram.u8id = register_data.dev_addr; // slave address
-		if (register_data.num_registers == 1)
+/**
+ * @brief Modbus worker, writes to ModBus slaves
+ * 		The writes are taken from the mailbox, all of them are executed in one power up.
+ * 		Writes received while the session is running are added to it.
+ * 		Consecutive writes to slaves with the same baud rate are sent back-to-back on the transaction queue.
+ * 		Called again on RAK_TIMER_1 until all writes are finished
+ *
+ */
+void modbus_write_coil(void *)
+{
+	if (!write_active)
+	{
+		if (mb_queue.isBusy())
 		{
-			telegram.u8fct = MB_FC_WRITE_REGISTER; // function code (this one is single register write)
+			// The sensor reading is running on the bus, try again when it is finished
+			api.system.timer.start(RAK_TIMER_1, CYCLE_BUSY_RETRY, NULL);
+			return;
 		}
-		else
+		write_clear();
+		if (write_collect() == 0)
 		{
-			telegram.u8fct = MB_FC_WRITE_MULTIPLE_REGISTERS; // function code (this one is multiple registers write write)
+			return;
 		}
-		telegram.u16RegAdd = register_data.register_start_address; // start address in slave
-		telegram.u16CoilsNo = register_data.num_registers;		   // number of registers to write
-		telegram.au16reg = coils_n_regs.data;					   // pointer to a memory array in the Arduino
-	}
-	else
-	{
-		MYLOG("MODW", "Send write coil request over ModBus");
-		MYLOG("MODW", "Num of coils %d", coil_data.num_coils);
 
-		// Reset the register
-		coils_n_regs.data[0] = 0;
+		digitalWrite(WB_IO2, HIGH);
+		// A running sensor cycle has to initialize the UART again
+		uart_baud = 0;
+		write_next = 0;
+		write_count = 0;
+		write_active = true;
+	}
 
-		// Check number of coils to write
-		if (coil_data.num_coils > 16)
-		{
-			MYLOG("MODW", "Too many coils requested to write. Only max 16 are allowed");
-			return;
-		}
-		// Prepare coils STATUS
-		uint8_t coil_shift = 8;
-		for (int idx = 0; idx < coil_data.num_coils; idx++)
+	while (!mb_queue.run())
+	{
+		// The batch is finished, start the next one
+		write_next += write_count;
+		write_count = 0;
+		if (write_next >= write_num)
 		{
-			MYLOG("MODW", "Coil %d %s %d", idx, coil_data.coils[idx] == 0 ? "off" : "on", coil_data.coils[idx] << coil_shift);
-			coils_n_regs.data[0] |= coil_data.coils[idx] << coil_shift;
-			MYLOG("MODW", "Coil data %02X", coils_n_regs.data[0]);
-			coil_shift++;
-			if (coil_shift == 16)
+			if (write_num >= MB_MAX_WRITES)
 			{
-				coil_shift = 0;
+				// The session is full, continue with a new one in the same power up
+				write_finished();
+				write_next = 0;
+			}
+			// Take the writes received in the meantime
+			if (write_collect() == 0)
+			{
+				break;
 			}
 		}
-		MYLOG("MODW", "Coil data %02X", coils_n_regs.data[0]);
-
-		telegram.u8id = coil_data.dev_addr;			 // slave address
-		telegram.u8fct = MB_FC_WRITE_MULTIPLE_COILS; // function code (this one is coil write)
-		telegram.u16RegAdd = 0;						 // start address in slave
-		telegram.u16CoilsNo = coil_data.num_coils;	 // number of coils to write
-		telegram.au16reg = coils_n_regs.data;		 // pointer to a memory array in the Arduino
+		uint32_t baud = write_baud(write_transactions[write_next].telegram.u8id);
+		write_count = write_batch(write_next, baud);
+		Serial1.begin(baud, RAK_CUSTOM_MODE);
+		master.setBaudRate(baud);
+		MYLOG("MODW", "Send %d writes with %ld baud", write_count, baud);
+		mb_queue.start(&write_transactions[write_next], write_count);
 	}
-	// Send query (only once)
-	master.query(telegram);
 
-	time_t start_poll = millis();
+	if (write_next < write_num)
+	{
+		// Nothing to do until the next end-of-frame, time-out or inter-frame gap is due
+		uint32_t poll_delay = mb_queue.getPollDelay();
+		api.system.timer.start(RAK_TIMER_1, poll_delay == 0 ? 1 : poll_delay, NULL);
+		return;
+	}
+	write_finished();
+	write_active = false;
 
-	while ((millis() - start_poll) < 5000)
+	// Keep the sensor powered if a sensor reading is active
+	if (!sensor_active)
 	{
-		master.poll(); // check incoming messages
-		if (master.getState() == COM_IDLE)
-		{
-			MYLOG("MODW", "Write done");
-			break;
-		}
+		// Shut down sensors and communication for lowest power consumption
+		digitalWrite(WB_IO2, LOW);
+		Serial1.end();
+		udrv_serial_deinit(SERIAL_UART1);
+		battery_hold_off();
 	}
 
-	// Shut down sensors and communication for lowest power consumption
-	digitalWrite(WB_IO2, LOW);
-	Serial1.end();
-	udrv_serial_deinit(SERIAL_UART1);
+	// Writes received after the last check are sent in a new session
+	if (write_pending())
+	{
+		api.system.timer.start(RAK_TIMER_1, 100, NULL);
+	}
 }
 
 /**
  * @brief This example is complete timer driven.
- * The loop() does nothing than sleep.
+ * The loop() does nothing than sleep, also between the steps of the sensor acquisition cycle.
  *
  */
 void loop(void)
@@ -617,54 +1154,71 @@ void loop(void)
 /**
  * @brief Send the data packet that was prepared in
  * Cayenne LPP format by the different sensor functions
+ * A reading that can not be sent is kept in the backlog in the compact format
  *
  */
 void send_packet(void)
 {
+	uint8_t *buffer = g_solution_data.getBuffer();
+	uint8_t size = g_solution_data.getSize();
+	uint8_t fport = set_fPort;
+	// The backlog always keeps the compact payload, a Cayenne LPP payload can be too large for a record
+	const uint8_t *stored = g_compact_data.getBuffer();
+	uint8_t stored_size = g_compact_data.getSize();
+	uint8_t stored_fport = cycle_batch ? BATCH_FPORT : COMPACT_FPORT;
+	if (airtime_compact())
+	{
+		buffer = g_compact_data.getBuffer();
+		size = g_compact_data.getSize();
+		fport = stored_fport;
+	}
+
 	// Check if it is LoRaWAN
 	if (api.lorawan.nwm.get() == 1)
 	{
-		MYLOG("UPLINK", "Sending packet over LoRaWAN with size %d", g_solution_data.getSize());
-		uint8_t proposed_dr = get_min_dr(api.lorawan.band.get(), g_solution_data.getSize());
-		MYLOG("UPLINK", "Check if datarate allows payload size, proposed is DR %d, current DR is %d", proposed_dr, api.lorawan.dr.get());
+		MYLOG("UPLINK", "Sending packet over LoRaWAN with size %d", size);
+		// Datarate with the lowest time on air that carries the payload and keeps the link margin
+		set_uplink_dr(size);
+		uint32_t toa = get_uplink_toa(api.lorawan.band.get(), api.lorawan.dr.get(), size);
 
-		if (proposed_dr == 16)
+		// Keep the reading in the backlog if the device is not joined or the send fails
+		if (api.lorawan.njs.get() == 0)
 		{
-			MYLOG("UPLINK", "No matching DR found");
+			MYLOG("UPLINK", "Not joined, store in backlog");
+			backlog_store(stored, stored_size, stored_fport);
+			return;
 		}
-		else
-		{
-			if (proposed_dr < api.lorawan.dr.get())
-			{
-				MYLOG("UPLINK", "Proposed DR is lower than current selected, switching to lower DR");
-				api.lorawan.dr.set(proposed_dr);
-			}
 
-			if (proposed_dr > api.lorawan.dr.get())
-			{
-				MYLOG("UPLINK", "Proposed DR is higher than current selected, switching to higher DR");
-				api.lorawan.dr.set(proposed_dr);
-			}
+		// Keep the reading in the backlog if the airtime budget is used up
+		if (!airtime_allows(toa))
+		{
+			MYLOG("UPLINK", "Airtime budget used up, store in backlog");
+			airtime_defer();
+			backlog_store(stored, stored_size, stored_fport);
+			return;
 		}
 
 		// Send the packet
-		if (api.lorawan.send(g_solution_data.getSize(), g_solution_data.getBuffer(), set_fPort, g_confirmed_mode, g_confirmed_retry))
+		if (api.lorawan.send(size, buffer, fport, g_confirmed_mode, g_confirmed_retry))
 		{
-			MYLOG("UPLINK", "Packet enqueued, size %d", g_solution_data.getSize());
+			MYLOG("UPLINK", "Packet enqueued, size %d", size);
+			airtime_add(toa);
+			backlog_uplink(stored, stored_size, stored_fport);
 		}
 		else
 		{
-			MYLOG("UPLINK", "Send failed");
+			MYLOG("UPLINK", "Send failed, store in backlog");
+			backlog_store(stored, stored_size, stored_fport);
 		}
 	}
 	// It is P2P
 	else
 	{
-		MYLOG("UPLINK", "Send packet with size %d over P2P", g_solution_data.getSize());
+		MYLOG("UPLINK", "Send packet with size %d over P2P", size);
 
 		digitalWrite(LED_BLUE, LOW);
 
-		if (api.lora.psend(g_solution_data.getSize(), g_solution_data.getBuffer(), true))
+		if (api.lora.psend(size, buffer, true))
 		{
 			MYLOG("UPLINK", "Packet enqueued");
 		}
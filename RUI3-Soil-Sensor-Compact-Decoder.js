@@ -0,0 +1,77 @@
+// Decoder for the compact payload of the RUI3 soil sensor, schema version 1, single reading on fPort 3, batch on fPort 4, backlog on fPort 5
+// Generated with ATC+DECODER=?, fields are [name, bits, optional, min, step numerator, step denominator]
+var header = [
+  ["version", 4, 0, 0, 1, 1],
+  ["errors", 4, 0, 0, 1, 1],
+  ["voltage", 8, 0, 250, 1, 100],
+];
+var probe = [
+  ["moisture", 8, 1, 0, 1, 2],
+  ["temperature", 11, 1, -400, 1, 10],
+  ["conductivity", 11, 1, 0, 10, 1],
+  ["ph", 8, 1, 0, 1, 10],
+  ["nitrogen", 10, 1, 0, 2, 1],
+  ["phosphorus", 10, 1, 0, 2, 1],
+  ["potassium", 10, 1, 0, 2, 1],
+  ["salinity", 11, 1, 0, 10, 1],
+  ["tds", 11, 1, 0, 10, 1],
+];
+function readBits(bytes, pos, bits) {
+  var value = 0;
+  for (var i = pos; i < pos + bits; i++) {
+    value = value * 2 + ((bytes[i >> 3] >> (7 - (i & 7))) & 1);
+  }
+  return value;
+}
+function decodeFields(bytes, pos, fields, data, suffix) {
+  for (var i = 0; i < fields.length; i++) {
+    var f = fields[i];
+    var code = readBits(bytes, pos, f[1]);
+    pos += f[1];
+    if (f[2] == 0 || code != Math.pow(2, f[1]) - 1) {
+      data[f[0] + suffix] = (code + f[3]) * f[4] / f[5];
+    }
+  }
+  return pos;
+}
+function decodeReading(bytes, pos, probes, data) {
+  pos = decodeFields(bytes, pos, header, data, "");
+  for (var n = 0; n < probes; n++) {
+    pos = decodeFields(bytes, pos, probe, data, n == 0 ? "" : "_" + n);
+  }
+  return pos;
+}
+function decodeUplink(input) {
+  var bytes = input.bytes;
+  var data = {};
+  if (input.fPort == 5 && bytes.length > 3) {
+    var result = decodeUplink({ fPort: bytes[0], bytes: bytes.slice(3) });
+    if (result.data) {
+      result.data.backlog_age = bytes[1] * 256 + bytes[2];
+    }
+    return result;
+  }
+  if (input.fPort == 3 && bytes.length > 0 && (bytes[0] >> 4) == 1) {
+    decodeReading(bytes, 0, Math.floor((bytes.length * 8 - 16) / 90), data);
+    return { data: data };
+  }
+  if (input.fPort == 4 && bytes.length > 0) {
+    var count = bytes[0] >> 4;
+    var probes = ((bytes[0] >> 2) & 3) + 1;
+    var pos = 8;
+    data.readings = [];
+    for (var i = 0; i < count; i++) {
+      var reading = { age: readBits(bytes, pos, 12) };
+      pos = decodeReading(bytes, pos + 12, probes, reading);
+      if (reading.version != 1) {
+        return { errors: ["not a batch of schema version 1"] };
+      }
+      data.readings.push(reading);
+    }
+    return { data: data };
+  }
+  return { errors: ["not a compact payload of schema version 1"] };
+}
+function Decode(fPort, bytes) {
+  return decodeUplink({ fPort: fPort, bytes: bytes }).data;
+}
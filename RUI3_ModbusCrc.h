@@ -0,0 +1,74 @@
+/**
+ * @file RUI3_ModbusCrc.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Table driven CRC-16 (polynom 0xA001) of the Modbus RTU frames
+ * 		Only depends on stdint.h, so the engines can be checked and timed on the host (see bench/crc_bench.cpp)
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#ifndef MODBUS_CRC_H
+#define MODBUS_CRC_H
+
+#include <stdint.h>
+
+/**
+ * @brief
+ * Compile time CRC-16 (polynom 0xA001) shift of a value by a number of bits.
+ * Used only to generate the lookup tables below.
+ */
+static constexpr uint16_t crcShift(uint16_t u16crc, uint8_t u8bits)
+{
+	return (u8bits == 0) ? u16crc : crcShift((u16crc & 0x0001) ? ((u16crc >> 1) ^ 0xA001) : (u16crc >> 1), u8bits - 1);
+}
+
+#define MB_CRC_NIBBLE_4(n) crcShift((n), 4), crcShift((n) + 1, 4), crcShift((n) + 2, 4), crcShift((n) + 3, 4)
+
+#define MB_CRC_BYTE_4(n) crcShift((n), 8), crcShift((n) + 1, 8), crcShift((n) + 2, 8), crcShift((n) + 3, 8)
+#define MB_CRC_BYTE_16(n) MB_CRC_BYTE_4(n), MB_CRC_BYTE_4((n) + 4), MB_CRC_BYTE_4((n) + 8), MB_CRC_BYTE_4((n) + 12)
+#define MB_CRC_BYTE_64(n) MB_CRC_BYTE_16(n), MB_CRC_BYTE_16((n) + 16), MB_CRC_BYTE_16((n) + 32), MB_CRC_BYTE_16((n) + 48)
+
+/** CRC lookup table for 4 bit nibbles, only placed in flash if crcUpdateNibble() is used */
+static constexpr uint16_t au16CrcNibbleTable[16] = {MB_CRC_NIBBLE_4(0), MB_CRC_NIBBLE_4(4), MB_CRC_NIBBLE_4(8), MB_CRC_NIBBLE_4(12)};
+
+/** CRC lookup table for full bytes, only placed in flash if crcUpdateByte() is used */
+static constexpr uint16_t au16CrcByteTable[256] = {MB_CRC_BYTE_64(0), MB_CRC_BYTE_64(64), MB_CRC_BYTE_64(128), MB_CRC_BYTE_64(192)};
+
+static_assert(au16CrcNibbleTable[1] == 0xCC01, "CRC nibble table mismatch");
+static_assert(au16CrcNibbleTable[15] == 0x4400, "CRC nibble table mismatch");
+static_assert(au16CrcByteTable[1] == 0xC0C1, "CRC byte table mismatch");
+static_assert(au16CrcByteTable[255] == 0x4040, "CRC byte table mismatch");
+
+/**
+ * @brief
+ * Add one byte to a running CRC with the 16 entry table, two lookups per byte
+ *
+ * @param u16crc CRC calculated so far, 0xFFFF for a new message
+ * @param u8byte next byte of the message
+ * @return uint16_t updated CRC value (not swapped)
+ */
+static inline uint16_t crcUpdateNibble(uint16_t u16crc, uint8_t u8byte)
+{
+	u16crc ^= u8byte;
+	u16crc = (u16crc >> 4) ^ au16CrcNibbleTable[u16crc & 0x000F];
+	u16crc = (u16crc >> 4) ^ au16CrcNibbleTable[u16crc & 0x000F];
+	return u16crc;
+}
+
+/**
+ * @brief
+ * Add one byte to a running CRC with the 256 entry table, one lookup per byte
+ *
+ * @param u16crc CRC calculated so far, 0xFFFF for a new message
+ * @param u8byte next byte of the message
+ * @return uint16_t updated CRC value (not swapped)
+ */
+static inline uint16_t crcUpdateByte(uint16_t u16crc, uint8_t u8byte)
+{
+	return (u16crc >> 8) ^ au16CrcByteTable[(u16crc ^ u8byte) & 0x00FF];
+}
+
+#endif // MODBUS_CRC_H
@@ -0,0 +1,163 @@
+/**
+ * @file RUI3_ModbusPlanner.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Coalesce scattered register reads into a minimum number of Modbus telegrams
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include "RUI3_ModbusPlanner.h"
+
+/**
+ * @brief Construct a new read planner
+ *
+ */
+ModbusPlanner::ModbusPlanner()
+{
+	u8wanted = 0;
+	u8telegrams = 0;
+	u8regs = 0;
+}
+
+/**
+ * @brief Plan the telegrams to read a set of registers
+ * 		Addresses are sorted and joined into blocks as long as the gap between
+ * 		two wanted registers is not larger than policy.u8maxGap and the block does
+ * 		not exceed policy.u8maxRegs. Extending each block as far as possible gives
+ * 		the minimum number of telegrams.
+ * 		The telegrams are written to transactions, ready for ModbusQueue::start().
+ *
+ * @param u8id slave address
+ * @param u8fct function code, MB_FC_READ_REGISTERS or MB_FC_READ_INPUT_REGISTER
+ * @param au16addr register addresses to read, in the order of the destination array
+ * @param u8count number of addresses
+ * @param policy join policy of the device
+ * @param transactions array for the planned transactions
+ * @param u8maxTransactions size of the transactions array
+ * @return uint8_t number of planned transactions, 0 if the plan does not fit
+ */
+uint8_t ModbusPlanner::plan(uint8_t u8id, uint8_t u8fct, const uint16_t *au16addr, uint8_t u8count,
+							modbus_read_policy_t policy, modbus_transaction_t *transactions, uint8_t u8maxTransactions)
+{
+	u8wanted = 0;
+	u8telegrams = 0;
+	u8regs = 0;
+
+	if ((u8count == 0) || (u8count > MB_PLAN_MAX_WANTED) || (u8maxTransactions == 0))
+	{
+		return 0;
+	}
+	if ((policy.u8maxRegs == 0) || (policy.u8maxRegs > MB_MAX_READ_REGS))
+	{
+		policy.u8maxRegs = MB_MAX_READ_REGS;
+	}
+
+	// sort the indexes of the wanted registers by address (insertion sort, the lists are short)
+	uint8_t au8order[MB_PLAN_MAX_WANTED];
+	for (uint8_t idx = 0; idx < u8count; idx++)
+	{
+		uint8_t pos = idx;
+		while ((pos > 0) && (au16addr[au8order[pos - 1]] > au16addr[idx]))
+		{
+			au8order[pos] = au8order[pos - 1];
+			pos--;
+		}
+		au8order[pos] = idx;
+	}
+
+	uint16_t u16used = 0;
+	uint16_t u16blockStart = au16addr[au8order[0]];
+	uint16_t u16blockEnd = u16blockStart;
+
+	for (uint8_t idx = 0; idx <= u8count; idx++)
+	{
+		bool bLast = (idx == u8count);
+		uint16_t u16addr = bLast ? 0 : au16addr[au8order[idx]];
+
+		// extend the current block if gap and size allow it
+		if (!bLast && (u16addr >= u16blockStart) &&
+			((u16addr <= u16blockEnd) ||
+			 (((uint32_t)u16addr - u16blockEnd - 1 <= policy.u8maxGap) &&
+			  ((uint32_t)u16addr - u16blockStart + 1 <= policy.u8maxRegs))))
+		{
+			if (u16addr > u16blockEnd)
+			{
+				u16blockEnd = u16addr;
+			}
+			continue;
+		}
+
+		// close the current block
+		uint16_t u16blockSize = u16blockEnd - u16blockStart + 1;
+		if ((u8telegrams >= u8maxTransactions) || (u16used + u16blockSize > MB_PLAN_MAX_REGS))
+		{
+			u8telegrams = 0;
+			return 0;
+		}
+		modbus_transaction_t *transaction = &transactions[u8telegrams];
+		transaction->telegram.u8id = u8id;
+		transaction->telegram.u8fct = u8fct;
+		transaction->telegram.u16RegAdd = u16blockStart;
+		transaction->telegram.u16CoilsNo = u16blockSize;
+		transaction->telegram.au16reg = &au16scratch[u16used];
+		transaction->u16timeOut = 0;
+		for (uint16_t reg = 0; reg < u16blockSize; reg++)
+		{
+			au16scratch[u16used + reg] = (int16_t)0xFFFF;
+		}
+
+		// remember where each wanted register of this block will be found
+		for (uint8_t wanted = 0; wanted < u8count; wanted++)
+		{
+			if ((au16addr[wanted] >= u16blockStart) && (au16addr[wanted] <= u16blockEnd))
+			{
+				au8source[wanted] = (uint8_t)(u16used + au16addr[wanted] - u16blockStart);
+				au8telegram[wanted] = u8telegrams;
+			}
+		}
+		u16used += u16blockSize;
+		u8telegrams++;
+
+		// start the next block
+		u16blockStart = u16blockEnd = u16addr;
+	}
+
+	u8wanted = u8count;
+	u8regs = (uint8_t)u16used;
+	return u8telegrams;
+}
+
+/**
+ * @brief Copy the received registers into the destination array
+ * 		Registers of failed telegrams are not copied
+ *
+ * @param transactions transactions as planned and executed
+ * @param au16dest destination array, one entry per wanted register in the order given to plan()
+ * @return uint32_t bit mask of the destination entries that were written
+ */
+uint32_t ModbusPlanner::scatter(const modbus_transaction_t *transactions, int16_t *au16dest)
+{
+	uint32_t u32filled = 0;
+	for (uint8_t wanted = 0; wanted < u8wanted; wanted++)
+	{
+		if (transactions[au8telegram[wanted]].u8result == MB_TR_OK)
+		{
+			au16dest[wanted] = au16scratch[au8source[wanted]];
+			u32filled |= (1UL << wanted);
+		}
+	}
+	return u32filled;
+}
+
+/**
+ * @brief Get the number of registers the plan reads from the bus, including gaps
+ *
+ * @return uint8_t number of registers
+ */
+uint8_t ModbusPlanner::getRegCount()
+{
+	return u8regs;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file RUI3_ModbusPlanner.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Coalesce scattered register reads into a minimum number of Modbus telegrams
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#ifndef MODBUS_PLANNER_H
+#define MODBUS_PLANNER_H
+
+#include "RUI3_ModbusQueue.h"
+
+#define MB_PLAN_MAX_WANTED 32				  //!< maximum number of registers in one plan
+#define MB_PLAN_MAX_REGS MB_MAX_READ_REGS //!< maximum number of registers read by one plan, including gaps
+
+/**
+ * @struct modbus_read_policy_t
+ * @brief
+ * Per device policy how reads may be combined
+ */
+typedef struct
+{
+	uint8_t u8maxGap;  /*!< Maximum number of unwanted registers read to join two blocks */
+	uint8_t u8maxRegs; /*!< Maximum number of registers per request (max 125) */
+} modbus_read_policy_t;
+
+/**
+ * @class ModbusPlanner
+ * @brief
+ * Plans the FC3/FC4 telegrams to read a set of register addresses and
+ * scatters the answers back into a destination array in the order of the
+ * requested addresses.
+ */
+class ModbusPlanner
+{
+private:
+	int16_t au16scratch[MB_PLAN_MAX_REGS];	  //!< receive buffer for all planned telegrams
+	uint8_t au8source[MB_PLAN_MAX_WANTED];	  //!< scratch index of each wanted register
+	uint8_t au8telegram[MB_PLAN_MAX_WANTED]; //!< telegram index of each wanted register
+	uint8_t u8wanted;						  //!< number of wanted registers
+	uint8_t u8telegrams;					  //!< number of planned telegrams
+	uint8_t u8regs;							  //!< number of registers read, including gaps
+
+public:
+	ModbusPlanner();
+
+	uint8_t plan(uint8_t u8id, uint8_t u8fct, const uint16_t *au16addr, uint8_t u8count,
+				 modbus_read_policy_t policy, modbus_transaction_t *transactions, uint8_t u8maxTransactions);
+	uint32_t scatter(const modbus_transaction_t *transactions, int16_t *au16dest);
+	uint8_t getRegCount();
+};
+
+#endif // MODBUS_PLANNER_H
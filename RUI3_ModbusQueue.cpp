@@ -0,0 +1,273 @@
+/**
+ * @file RUI3_ModbusQueue.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Non-blocking transaction queue for the Modbus master
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include "RUI3_ModbusQueue.h"
+
+/**
+ * @brief Construct a new transaction queue
+ *
+ * @param master Modbus master used to send the telegrams
+ */
+ModbusQueue::ModbusQueue(Modbus &master)
+{
+	this->master = &master;
+	this->pTransactions = NULL;
+	this->callback = NULL;
+	this->u8count = 0;
+	this->u8current = 0;
+	this->u8state = MBQ_IDLE;
+	this->u8maxRetries = 0;
+	this->u16backoff = 0;
+	this->u32backoff = 0;
+	this->u32duration = 0;
+	this->u32gap = 0;
+}
+
+/**
+ * @brief Set the retry policy for failed telegrams
+ * 		A telegram is repeated after a time-out or a corrupted answer,
+ * 		not after an exception of the slave or if it could not be sent.
+ *
+ * @param u8retries maximum number of repetitions, 0 = no retries
+ * @param u16backoff wait time before the first repetition in ms, doubled for each further repetition
+ */
+void ModbusQueue::setRetries(uint8_t u8retries, uint16_t u16backoff)
+{
+	this->u8maxRetries = u8retries;
+	this->u16backoff = u16backoff;
+}
+
+/**
+ * @brief Start a new batch of transactions
+ * 		The transactions array must stay valid until the batch is finished
+ *
+ * @param transactions array of transactions
+ * @param u8count number of transactions in the array
+ * @param callback called when all transactions are finished, can be NULL
+ * @return true batch started
+ * @return false another batch is still running or nothing to do
+ */
+bool ModbusQueue::start(modbus_transaction_t *transactions, uint8_t u8count, mb_queue_cb_t callback)
+{
+	if ((u8state != MBQ_IDLE) || (transactions == NULL) || (u8count == 0))
+	{
+		return false;
+	}
+
+	for (uint8_t idx = 0; idx < u8count; idx++)
+	{
+		transactions[idx].u8result = MB_TR_PENDING;
+		transactions[idx].u16rtt = 0;
+		transactions[idx].u8tries = 0;
+	}
+
+	this->pTransactions = transactions;
+	this->u8count = u8count;
+	this->callback = callback;
+	this->u8current = 0;
+	this->u16defaultTimeOut = master->getTimeOut();
+	this->u32start = millis();
+	// keep the inter-frame gap to the last transaction of the previous batch
+	this->u32backoff = 0;
+	this->u8state = MBQ_SEND;
+	return true;
+}
+
+/**
+ * @brief Advance the queue state machine, never blocks
+ *
+ * @return true batch is still running, call again after getPollDelay() ms
+ * @return false no batch running (anymore)
+ */
+bool ModbusQueue::run()
+{
+	switch (u8state)
+	{
+	case MBQ_SEND:
+	{
+		// keep the inter-frame gap and the back-off after the previous answer
+		if ((uint32_t)(micros() - u32gap) < getGap())
+		{
+			return true;
+		}
+		modbus_transaction_t *transaction = &pTransactions[u8current];
+		master->setTimeOut(transaction->u16timeOut != 0 ? transaction->u16timeOut : u16defaultTimeOut);
+		transaction->u8tries++;
+		u32sent = millis();
+		if (master->query(transaction->telegram) != 0)
+		{
+			finishTransaction(MB_TR_REJECTED);
+		}
+		else
+		{
+			u8state = MBQ_WAIT;
+		}
+		break;
+	}
+	case MBQ_WAIT:
+		master->poll();
+		if (master->getState() != COM_IDLE)
+		{
+			return true;
+		}
+		switch (master->getLastError())
+		{
+		case 0:
+			finishTransaction(MB_TR_OK);
+			break;
+		case NO_REPLY:
+			finishTransaction(MB_TR_TIMEOUT);
+			break;
+		case (uint8_t)ERR_EXCEPTION:
+			finishTransaction(MB_TR_EXCEPTION);
+			break;
+		default:
+			finishTransaction(MB_TR_ERROR);
+			break;
+		}
+		break;
+	case MBQ_IDLE:
+	default:
+		return false;
+	}
+	return u8state != MBQ_IDLE;
+}
+
+/**
+ * @brief Store the result of the current transaction and switch to the next one
+ * 		Calls the callback after the last transaction
+ *
+ * @param u8result result of the current transaction
+ */
+void ModbusQueue::finishTransaction(uint8_t u8result)
+{
+	modbus_transaction_t *transaction = &pTransactions[u8current];
+	transaction->u8result = u8result;
+	transaction->u16rtt = (uint16_t)(millis() - u32sent);
+	u32gap = micros();
+	u32backoff = 0;
+
+	// repeat the telegram if the answer was lost or corrupted
+	if (((u8result == MB_TR_TIMEOUT) || (u8result == MB_TR_ERROR)) && (transaction->u8tries <= u8maxRetries))
+	{
+		uint8_t u8shift = (transaction->u8tries > 5) ? 4 : (transaction->u8tries - 1);
+		u32backoff = ((uint32_t)u16backoff << u8shift) * 1000UL;
+		u8state = MBQ_SEND;
+		return;
+	}
+
+	u8current++;
+
+	if (u8current < u8count)
+	{
+		u8state = MBQ_SEND;
+		return;
+	}
+
+	u8state = MBQ_IDLE;
+	u32duration = millis() - u32start;
+	master->setTimeOut(u16defaultTimeOut);
+	if (callback != NULL)
+	{
+		callback(pTransactions, u8count);
+	}
+}
+
+/**
+ * @brief Stop the running batch, the callback is not called
+ *
+ */
+void ModbusQueue::abort()
+{
+	if (u8state != MBQ_IDLE)
+	{
+		master->setTimeOut(u16defaultTimeOut);
+	}
+	u8state = MBQ_IDLE;
+}
+
+/**
+ * @brief Check if a batch is running
+ *
+ * @return true batch is running
+ * @return false queue is idle
+ */
+bool ModbusQueue::isBusy()
+{
+	return u8state != MBQ_IDLE;
+}
+
+/**
+ * @brief Get the time until run() has something to do
+ *
+ * @return uint32_t time in ms, 0 if run() should be called immediately
+ */
+uint32_t ModbusQueue::getPollDelay()
+{
+	switch (u8state)
+	{
+	case MBQ_SEND:
+	{
+		uint32_t u32elapsed = micros() - u32gap;
+		if (u32elapsed >= getGap())
+		{
+			return 0;
+		}
+		return (getGap() - u32elapsed + 999) / 1000;
+	}
+	case MBQ_WAIT:
+		return master->getPollDelay();
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Get the minimum time between the end of the last transaction and the next telegram
+ *
+ * @return uint32_t inter-frame gap plus back-off in us
+ */
+uint32_t ModbusQueue::getGap()
+{
+	return master->getT35() + u32backoff;
+}
+
+/**
+ * @brief Get number of successful transactions of the current or last batch
+ *
+ * @return uint8_t number of transactions with result MB_TR_OK
+ */
+uint8_t ModbusQueue::getOkCount()
+{
+	uint8_t u8ok = 0;
+	for (uint8_t idx = 0; idx < u8count; idx++)
+	{
+		if (pTransactions[idx].u8result == MB_TR_OK)
+		{
+			u8ok++;
+		}
+	}
+	return u8ok;
+}
+
+/**
+ * @brief Get the bus time of the batch
+ *
+ * @return uint32_t time in ms since start while running, duration of the last batch when idle
+ */
+uint32_t ModbusQueue::getDuration()
+{
+	if (u8state != MBQ_IDLE)
+	{
+		return millis() - u32start;
+	}
+	return u32duration;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file RUI3_ModbusQueue.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Non-blocking transaction queue for the Modbus master
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#ifndef MODBUS_QUEUE_H
+#define MODBUS_QUEUE_H
+
+#include "RUI3_ModbusRtu.h"
+
+/**
+ * @enum MB_TR_RESULT
+ * @brief
+ * Result of a single queued transaction
+ */
+enum MB_TR_RESULT
+{
+	MB_TR_PENDING = 0,	 //!< not executed yet
+	MB_TR_OK = 1,		 //!< valid answer received
+	MB_TR_TIMEOUT = 2,	 //!< no answer within the time-out
+	MB_TR_ERROR = 3,	 //!< answer with CRC error, wrong length or buffer overflow
+	MB_TR_EXCEPTION = 4, //!< slave answered with an exception
+	MB_TR_REJECTED = 5	 //!< query could not be sent
+};
+
+/**
+ * @struct modbus_transaction_t
+ * @brief
+ * One entry of a transaction batch
+ */
+typedef struct
+{
+	modbus_t telegram;	 /*!< Query to send */
+	uint16_t u16timeOut; /*!< Response time-out in ms, 0 = time-out set in the Modbus master */
+	uint8_t u8result;	 /*!< Result, one of MB_TR_RESULT */
+	uint16_t u16rtt;	 /*!< Measured response time in ms */
+	uint8_t u8tries;	 /*!< Number of times the telegram was sent */
+} modbus_transaction_t;
+
+/** Callback when all transactions of a batch are finished */
+typedef void (*mb_queue_cb_t)(modbus_transaction_t *transactions, uint8_t u8count);
+
+/**
+ * @class ModbusQueue
+ * @brief
+ * Runs a list of telegrams, for one or more slaves, back-to-back on a Modbus master.
+ * Call run() until it returns false, waiting getPollDelay() ms between the calls.
+ * Telegrams without answer or with a corrupted answer are repeated up to the
+ * number of retries set with setRetries(), with an exponential back-off.
+ */
+class ModbusQueue
+{
+private:
+	enum
+	{
+		MBQ_IDLE = 0, //!< no batch active
+		MBQ_SEND = 1, //!< waiting for the inter-frame gap, then send next telegram
+		MBQ_WAIT = 2  //!< waiting for the answer of the slave
+	};
+
+	Modbus *master;
+	modbus_transaction_t *pTransactions;
+	mb_queue_cb_t callback;
+	uint8_t u8count;
+	uint8_t u8current;
+	uint8_t u8state;
+	uint16_t u16defaultTimeOut;
+	uint8_t u8maxRetries;	 //!< number of repetitions of a failed telegram
+	uint16_t u16backoff;	 //!< back-off before the first repetition in ms, doubled for each further one
+	uint32_t u32backoff;	 //!< back-off before the next telegram in us
+	uint32_t u32sent;	  //!< millis() when the current telegram was sent
+	uint32_t u32gap;	  //!< micros() when the last transaction finished
+	uint32_t u32start;	  //!< millis() when the batch was started
+	uint32_t u32duration; //!< duration of the last finished batch in ms
+
+	void finishTransaction(uint8_t u8result);
+	uint32_t getGap();
+
+public:
+	ModbusQueue(Modbus &master);
+
+	bool start(modbus_transaction_t *transactions, uint8_t u8count, mb_queue_cb_t callback = NULL);
+	void setRetries(uint8_t u8retries, uint16_t u16backoff);
+	bool run();
+	void abort();
+	bool isBusy();
+	uint32_t getPollDelay();
+	uint8_t getOkCount();
+	uint32_t getDuration();
+};
+
+#endif // MODBUS_QUEUE_H
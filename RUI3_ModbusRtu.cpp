@@ -39,6 +39,7 @@
  */
 
 #include "RUI3_ModbusRtu.h"
+#include "RUI3_ModbusCrc.h"
 
 // Changed function to work with RUI3
 uint16_t makeWord(unsigned char h, unsigned char l) { return (h << 8) | l; }
@@ -74,7 +75,16 @@ Modbus::Modbus(uint8_t u8id, Stream &port, uint8_t u8txenpin)
 	this->u8id = u8id;
 	this->u8txenpin = u8txenpin;
 	this->u16timeOut = 1000;
+	this->u16queryTimeOut = 1000;
+	this->bAdaptive = false;
 	this->u32overTime = 0;
+	this->u32T35 = T35 * 1000UL;
+	this->u32T15 = T35 * 1000UL * 3 / 7;
+	this->pQuerySlot = NULL;
+	this->u8state = COM_IDLE;
+	memset(aSlots, 0, sizeof(aSlots));
+	u8slotNext = 0;
+	clearStats();
 }
 
 /**
@@ -95,7 +105,16 @@ Modbus::Modbus(uint8_t u8id, uint8_t u8serno, uint8_t u8txenpin)
 	this->u8id = u8id;
 	this->u8txenpin = u8txenpin;
 	this->u16timeOut = 1000;
+	this->u16queryTimeOut = 1000;
+	this->bAdaptive = false;
 	this->u32overTime = 0;
+	this->u32T35 = T35 * 1000UL;
+	this->u32T15 = T35 * 1000UL * 3 / 7;
+	this->pQuerySlot = NULL;
+	this->u8state = COM_IDLE;
+	memset(aSlots, 0, sizeof(aSlots));
+	u8slotNext = 0;
+	clearStats();
 
 	switch (u8serno)
 	{
@@ -145,8 +164,9 @@ void Modbus::start()
 
 	while (port->read() >= 0)
 		;
-	u8lastRec = u8BufferSize = 0;
-	u16InCnt = u16OutCnt = u16errCnt = 0;
+	u16lastRec = u16BufferSize = u16expectedSize = 0;
+	bOverflow = false;
+	u16RxCRC = 0xFFFF;
 }
 
 /**
@@ -249,6 +269,101 @@ uint8_t Modbus::getID()
 	return this->u8id;
 }
 
+/**
+ * @brief
+ * Calculate the inter-character (T1.5) and inter-frame (T3.5) timeouts
+ * from the line speed as defined in the Modbus over serial line specification.
+ * For baud rates above 19200 the fixed values 750us and 1750us are used.
+ *
+ * Call after begin() of the serial port with the same baud rate.
+ *
+ * @param u32baud baud rate of the serial port
+ * @ingroup setup
+ */
+void Modbus::setBaudRate(uint32_t u32baud)
+{
+	if ((u32baud == 0) || (u32baud > 19200))
+	{
+		u32T15 = T15_FAST_US;
+		u32T35 = T35_FAST_US;
+	}
+	else
+	{
+		// character time = MB_CHAR_BITS / baud, T1.5 = 1.5 characters, T3.5 = 3.5 characters
+		u32T15 = (MB_CHAR_BITS * 1500000UL + u32baud - 1) / u32baud;
+		u32T35 = (MB_CHAR_BITS * 3500000UL + u32baud - 1) / u32baud;
+	}
+}
+
+/**
+ * @brief
+ * Get the inter-character timeout
+ *
+ * @return T1.5 in us
+ * @ingroup setup
+ */
+uint32_t Modbus::getT15()
+{
+	return u32T15;
+}
+
+/**
+ * @brief
+ * Get the inter-frame timeout
+ *
+ * @return T3.5 in us
+ * @ingroup setup
+ */
+uint32_t Modbus::getT35()
+{
+	return u32T35;
+}
+
+/**
+ * @brief
+ * *** Only Modbus Master ***
+ * Get the time until the next poll() call can change the state.
+ * While the first byte is outstanding this is one T3.5 period, once bytes
+ * arrive it is the remaining silence until the end of frame is detected,
+ * or the transmission time of the missing bytes if the response length is known.
+ * It is never longer than the remaining time-out.
+ * Use it to sleep or to start a timer instead of calling poll() in a loop.
+ *
+ * @return time in ms, 0 if poll() should be called immediately
+ * @ingroup loop
+ */
+uint32_t Modbus::getPollDelay()
+{
+	if (u8state != COM_WAITING)
+	{
+		return 0;
+	}
+
+	uint32_t u32elapsed = millis() - u32timeOut;
+	if (u32elapsed >= u16queryTimeOut)
+	{
+		return 0;
+	}
+	uint32_t u32remaining = u16queryTimeOut - u32elapsed;
+
+	uint32_t u32wait = u32T35;
+	if (u16lastRec != 0)
+	{
+		uint32_t u32silence = micros() - u32time;
+		u32wait = (u32silence >= u32T35) ? 0 : (u32T35 - u32silence);
+		// if the response length is known, check again when the missing bytes should be in
+		if (u16expectedSize > u16BufferSize)
+		{
+			uint32_t u32missing = (u16expectedSize - u16BufferSize) * (u32T35 * 2 / 7);
+			u32wait = (u32missing < u32wait) ? u32missing : u32wait;
+		}
+	}
+	// round up to full ms
+	u32wait = (u32wait + 999) / 1000;
+
+	return (u32wait < u32remaining) ? u32wait : u32remaining;
+}
+
 /**
  * @brief
  * Initialize time-out parameter
@@ -265,6 +380,173 @@ void Modbus::setTimeOut(uint16_t u16timeOut)
 	this->u16timeOut = u16timeOut;
 }
 
+/**
+ * @brief
+ * Get the configured time-out
+ *
+ * @return time-out value (ms)
+ * @ingroup setup
+ */
+uint16_t Modbus::getTimeOut()
+{
+	return u16timeOut;
+}
+
+/**
+ * @brief
+ * Enable or disable time-outs learned from the response times.
+ *
+ * When enabled, each query uses a time-out derived from the smoothed and the
+ * worst recent response time of the queried slave and function code.
+ * The value set with setTimeOut() is the upper limit and is used as long as
+ * nothing was learned yet. A time-out raises the learned worst case, so a
+ * repeated query waits longer.
+ *
+ * @param bAdaptive true to use learned time-outs
+ * @ingroup setup
+ */
+void Modbus::setAdaptiveTimeOut(boolean bAdaptive)
+{
+	this->bAdaptive = bAdaptive;
+}
+
+/**
+ * @brief
+ * Get the time-out a query to a slave and function code would use
+ *
+ * @param u8id slave address
+ * @param u8fct function code
+ * @return time-out in ms
+ * @ingroup setup
+ */
+uint16_t Modbus::getAdaptiveTimeOut(uint8_t u8id, uint8_t u8fct)
+{
+	if (!bAdaptive)
+	{
+		return u16timeOut;
+	}
+	modbus_slot_t *slot = findSlot(u8id, u8fct, false);
+	if ((slot == NULL) || (slot->rtt.u8samples == 0))
+	{
+		return u16timeOut;
+	}
+	modbus_rtt_t *rtt = &slot->rtt;
+
+	// twice the smoothed response time or 1.5 times the worst recent one
+	uint32_t u32learned = (uint32_t)rtt->u16ewma / 4;
+	uint32_t u32worst = (uint32_t)rtt->u16worst * 3 / 2;
+	u32learned = ((u32worst > u32learned) ? u32worst : u32learned) + MB_RTT_MARGIN;
+
+	if (u32learned < MB_RTT_MIN_TIMEOUT)
+	{
+		u32learned = MB_RTT_MIN_TIMEOUT;
+	}
+	return (u32learned < u16timeOut) ? (uint16_t)u32learned : u16timeOut;
+}
+
+/**
+ * @brief
+ * Get the learned response time of a slave and function code
+ *
+ * @param u8id slave address
+ * @param u8fct function code
+ * @return pointer to the learned values, NULL if the slave did not answer yet
+ * @ingroup setup
+ */
+const modbus_rtt_t *Modbus::getRtt(uint8_t u8id, uint8_t u8fct)
+{
+	modbus_slot_t *slot = findSlot(u8id, u8fct, false);
+	if ((slot == NULL) || (slot->rtt.u8samples == 0))
+	{
+		return NULL;
+	}
+	return &slot->rtt;
+}
+
+/**
+ * @brief
+ * Forget all learned response times, e.g. after changing the baud rate
+ * The statistics are kept.
+ *
+ * @ingroup setup
+ */
+void Modbus::clearRtt()
+{
+	for (uint8_t i = 0; i < MB_RTT_SLOTS; i++)
+	{
+		memset(&aSlots[i].rtt, 0, sizeof(modbus_rtt_t));
+	}
+}
+
+/**
+ * @brief
+ * Get the learned response time and the statistics of a slave and function code
+ * Iterate over u8index from 0 to MB_RTT_SLOTS - 1 to get all of them.
+ *
+ * @param u8index slot index
+ * @return pointer to the slot, NULL if the slot is not used
+ * @ingroup buffer
+ */
+const modbus_slot_t *Modbus::getSlot(uint8_t u8index)
+{
+	if ((u8index >= MB_RTT_SLOTS) || (aSlots[u8index].u8id == 0))
+	{
+		return NULL;
+	}
+	return &aSlots[u8index];
+}
+
+/**
+ * @brief
+ * Reset the message counters and the statistics of all slaves and function codes
+ * The counters are not reset by start(), they keep counting until this is called.
+ *
+ * @ingroup buffer
+ */
+void Modbus::clearStats()
+{
+	for (uint8_t i = 0; i < MB_RTT_SLOTS; i++)
+	{
+		memset(&aSlots[i].stats, 0, sizeof(modbus_stats_t));
+	}
+	u32InCnt = u32OutCnt = u32errCnt = 0;
+	u32slotEvictions = 0;
+}
+
+/**
+ * @brief
+ * Get the number of slots that were reused for another slave or function code
+ * The learned response time and the statistics of the old pair are lost on each of them,
+ * more than MB_RTT_SLOTS slave/function code pairs are polled if this is not 0.
+ *
+ * @return number of reused slots since the last clearStats()
+ * @ingroup buffer
+ */
+uint32_t Modbus::getSlotEvictions()
+{
+	return u32slotEvictions;
+}
+
+/**
+ * @brief
+ * Get the histogram bucket of a response time
+ *
+ * @param u16ms response time in ms
+ * @return bucket index, bucket n holds response times below MB_HIST_FIRST << n ms
+ * @ingroup buffer
+ */
+uint8_t Modbus::getLatencyBucket(uint16_t u16ms)
+{
+	uint8_t u8bucket = 0;
+	uint16_t u16limit = MB_HIST_FIRST;
+	while ((u16ms >= u16limit) && (u8bucket < MB_HIST_BUCKETS - 1))
+	{
+		u16limit <<= 1;
+		u8bucket++;
+	}
+	return u8bucket;
+}
+
 /**
  * @brief
  * Return communication Watchdog state.
@@ -286,9 +568,9 @@ boolean Modbus::getTimeOutState()
  * @return input messages counter
  * @ingroup buffer
  */
-uint16_t Modbus::getInCnt()
+uint32_t Modbus::getInCnt()
 {
-	return u16InCnt;
+	return u32InCnt;
 }
 
 /**
@@ -299,9 +581,9 @@ uint16_t Modbus::getInCnt()
  * @return transmitted messages counter
  * @ingroup buffer
  */
-uint16_t Modbus::getOutCnt()
+uint32_t Modbus::getOutCnt()
 {
-	return u16OutCnt;
+	return u32OutCnt;
 }
 
 /**
@@ -312,9 +594,9 @@ uint16_t Modbus::getOutCnt()
  * @return errors counter
  * @ingroup buffer
  */
-uint16_t Modbus::getErrCnt()
+uint32_t Modbus::getErrCnt()
 {
-	return u16errCnt;
+	return u32errCnt;
 }
 
 /**
@@ -331,7 +613,11 @@ uint8_t Modbus::getState()
 /**
  * Get the last error in the protocol processor
  *
- * @returnreturn   NO_REPLY = 255      Time-out
+ * @return   0                   No error
+ * @return   NO_REPLY = 255      Time-out or answer from wrong slave
+ * @return   (uint8_t)ERR_BAD_CRC        Answer with CRC error or too short
+ * @return   (uint8_t)ERR_BUFF_OVERFLOW  Answer too long
+ * @return   (uint8_t)ERR_EXCEPTION      Slave answered with an exception
  * @return   EXC_FUNC_CODE = 1   Function code not available
  * @return   EXC_ADDR_RANGE = 2  Address beyond available space for Modbus registers
  * @return   EXC_REGS_QUANT = 3  Coils or registers number beyond the available space
@@ -351,12 +637,14 @@ uint8_t Modbus::getLastError()
  *
  * @see modbus_t
  * @param modbus_t  modbus telegram structure (id, fct, ...)
+ * @return 0 if the query was sent
+ * @return -1 master is busy, -2 not a master, -3 invalid slave address
+ * @return ERR_QUANTITY number of coils or registers is 0 or exceeds the protocol limit
  * @ingroup loop
- * @todo finish function 15
  */
 int8_t Modbus::query(modbus_t telegram)
 {
-	uint8_t u8regsno, u8bytesno;
+	uint16_t u16bytesno;
 	if (u8id != 0)
 		return -2;
 	if (u8state != COM_IDLE)
@@ -365,7 +653,37 @@ int8_t Modbus::query(modbus_t telegram)
 	if ((telegram.u8id == 0) || (telegram.u8id > 247))
 		return -3;
 
+	// limit the quantities, so that request and response always fit into au8Buffer
+	uint16_t u16maxQuantity = 0xFFFF;
+	switch (telegram.u8fct)
+	{
+	case MB_FC_READ_COILS:
+	case MB_FC_READ_DISCRETE_INPUT:
+		u16maxQuantity = MB_MAX_READ_BITS;
+		break;
+	case MB_FC_READ_REGISTERS:
+	case MB_FC_READ_INPUT_REGISTER:
+		u16maxQuantity = MB_MAX_READ_REGS;
+		break;
+	case MB_FC_WRITE_MULTIPLE_COILS:
+		u16maxQuantity = MB_MAX_WRITE_BITS;
+		break;
+	case MB_FC_WRITE_MULTIPLE_REGISTERS:
+		u16maxQuantity = MB_MAX_WRITE_REGS;
+		break;
+	default:
+		break;
+	}
+	if ((u16maxQuantity != 0xFFFF) && ((telegram.u16CoilsNo == 0) || (telegram.u16CoilsNo > u16maxQuantity)))
+		return ERR_QUANTITY;
+
 	au16regs = telegram.au16reg;
+	u8queryId = telegram.u8id;
+	u16queryTimeOut = getAdaptiveTimeOut(telegram.u8id, telegram.u8fct);
+	pQuerySlot = findSlot(telegram.u8id, telegram.u8fct, true);
+	pQuerySlot->stats.u32requests++;
+	u16lastRec = 0;
+	bOverflow = false;
 
 	// telegram header
 	au8Buffer[ID] = telegram.u8id;
@@ -373,71 +691,84 @@ int8_t Modbus::query(modbus_t telegram)
 	au8Buffer[ADD_HI] = highByte(telegram.u16RegAdd);
 	au8Buffer[ADD_LO] = lowByte(telegram.u16RegAdd);
 
+	// expected response: id + fct + byte count + data + crc for reads, echo of the first 6 bytes + crc for writes
+	u16expectedSize = RESPONSE_SIZE + CHECKSUM_SIZE;
+
 	switch (telegram.u8fct)
 	{
 	case MB_FC_READ_COILS:
 	case MB_FC_READ_DISCRETE_INPUT:
+		au8Buffer[NB_HI] = highByte(telegram.u16CoilsNo);
+		au8Buffer[NB_LO] = lowByte(telegram.u16CoilsNo);
+		u16BufferSize = 6;
+		u16expectedSize = expectedSize((telegram.u16CoilsNo + 7) / 8);
+		break;
 	case MB_FC_READ_REGISTERS:
 	case MB_FC_READ_INPUT_REGISTER:
 		au8Buffer[NB_HI] = highByte(telegram.u16CoilsNo);
 		au8Buffer[NB_LO] = lowByte(telegram.u16CoilsNo);
-		u8BufferSize = 6;
+		u16BufferSize = 6;
+		u16expectedSize = expectedSize(telegram.u16CoilsNo * 2);
 		break;
 	case MB_FC_WRITE_COIL:
 		au8Buffer[NB_HI] = ((au16regs[0] > 0) ? 0xff : 0);
 		au8Buffer[NB_LO] = 0;
-		u8BufferSize = 6;
+		u16BufferSize = 6;
 		break;
 	case MB_FC_WRITE_REGISTER:
 		au8Buffer[NB_HI] = highByte(au16regs[0]);
 		au8Buffer[NB_LO] = lowByte(au16regs[0]);
-		u8BufferSize = 6;
+		u16BufferSize = 6;
 		break;
-	case MB_FC_WRITE_MULTIPLE_COILS: // TODO: implement "sending coils"
-		u8regsno = telegram.u16CoilsNo / 16;
-		u8bytesno = u8regsno * 2;
-		if ((telegram.u16CoilsNo % 16) != 0)
-		{
-			u8bytesno++;
-			u8regsno++;
-		}
+	case MB_FC_WRITE_MULTIPLE_COILS:
+		// one data byte per 8 coils, taken from au16regs high byte first
+		u16bytesno = (telegram.u16CoilsNo + 7) / 8;
 
 		au8Buffer[NB_HI] = highByte(telegram.u16CoilsNo);
 		au8Buffer[NB_LO] = lowByte(telegram.u16CoilsNo);
-		au8Buffer[BYTE_CNT] = u8bytesno;
-		u8BufferSize = 7;
+		au8Buffer[BYTE_CNT] = (uint8_t)u16bytesno;
+		u16BufferSize = 7;
 
-		for (uint16_t i = 0; i < u8bytesno; i++)
+		for (uint16_t i = 0; i < u16bytesno; i++)
 		{
 			if (i % 2)
 			{
-				au8Buffer[u8BufferSize] = lowByte(au16regs[i / 2]);
+				au8Buffer[u16BufferSize] = lowByte(au16regs[i / 2]);
 			}
 			else
 			{
-				au8Buffer[u8BufferSize] = highByte(au16regs[i / 2]);
+				au8Buffer[u16BufferSize] = highByte(au16regs[i / 2]);
 			}
-			u8BufferSize++;
+			u16BufferSize++;
 		}
 		break;
 
 	case MB_FC_WRITE_MULTIPLE_REGISTERS:
 		au8Buffer[NB_HI] = highByte(telegram.u16CoilsNo);
 		au8Buffer[NB_LO] = lowByte(telegram.u16CoilsNo);
-		au8Buffer[BYTE_CNT] = (uint8_t)(telegram.u16CoilsNo * 2);
-		u8BufferSize = 7;
+		u16bytesno = telegram.u16CoilsNo * 2;
+		au8Buffer[BYTE_CNT] = (uint8_t)u16bytesno;
+		u16BufferSize = 7;
 
 		for (uint16_t i = 0; i < telegram.u16CoilsNo; i++)
 		{
-			au8Buffer[u8BufferSize] = highByte(au16regs[i]);
-			u8BufferSize++;
-			au8Buffer[u8BufferSize] = lowByte(au16regs[i]);
-			u8BufferSize++;
+			au8Buffer[u16BufferSize] = highByte(au16regs[i]);
+			u16BufferSize++;
+			au8Buffer[u16BufferSize] = lowByte(au16regs[i]);
+			u16BufferSize++;
 		}
 		break;
+	default:
+		// unknown response length, use T35 silence only
+		u16expectedSize = 0;
+		break;
 	}
 
+	// drop stale bytes, e.g. the tail of a rejected oversized frame
+	while (port->read() >= 0)
+		;
 	sendTxBuffer();
+	u16RxCRC = 0xFFFF;
 	u8state = COM_WAITING;
 	u8lastError = 0;
 	return 0;
@@ -454,51 +785,97 @@ int8_t Modbus::query(modbus_t telegram)
  * as defined in its modbus_t query telegram.
  *
  * @params	nothing
- * @return errors counter
+ * @return size of the received frame, 0 while waiting, < 0 on buffer overflow
  * @ingroup loop
  */
-int8_t Modbus::poll()
+int16_t Modbus::poll()
 {
-	// check if there is any incoming frame
-	uint8_t u8current;
-	u8current = port->available();
+	if (u8state != COM_WAITING)
+		return 0;
 
-	if ((unsigned long)(millis() - u32timeOut) > (unsigned long)u16timeOut)
+	if ((unsigned long)(millis() - u32timeOut) > (unsigned long)u16queryTimeOut)
 	{
 		u8state = COM_IDLE;
 		u8lastError = NO_REPLY;
-		u16errCnt++;
+		u32errCnt++;
+		pQuerySlot->stats.u32timeouts++;
+		// the slave needed at least this long, next query to it waits longer
+		if ((pQuerySlot->rtt.u8samples != 0) && (pQuerySlot->rtt.u16worst < u16queryTimeOut))
+		{
+			pQuerySlot->rtt.u16worst = u16queryTimeOut;
+		}
 		return 0;
 	}
 
-	if (u8current == 0)
-		return 0;
-
-	// check T35 after frame end or still no frame end
-	if (u8current != u8lastRec)
+	// transfer new bytes from the Serial buffer to au8Buffer, CRC is updated on the fly
+	if (port->available() != 0)
 	{
-		u8lastRec = u8current;
-		u32time = millis();
-		return 0;
+		// a frame longer than the expected response or the buffer is rejected
+		// with the first surplus byte, without waiting for the end of the frame
+		if (getRxBuffer() == ERR_BUFF_OVERFLOW)
+		{
+			u8state = COM_IDLE;
+			u8lastError = (uint8_t)ERR_BUFF_OVERFLOW;
+			u16lastRec = 0;
+			u32InCnt++;
+			u32errCnt++;
+			pQuerySlot->stats.u32overflows++;
+			return ERR_BUFF_OVERFLOW;
+		}
+		u16lastRec = u16BufferSize;
+		u32time = micros();
 	}
-	if ((unsigned long)(millis() - u32time) < (unsigned long)T35)
+
+	if (u16BufferSize == 0)
+		return 0;
+
+	// the frame is complete as soon as the expected response or an exception with a valid CRC is in
+	// otherwise fall back to check T35 after frame end or still no frame end
+	boolean bException = (au8Buffer[FUNC] & 0x80) != 0;
+	boolean bComplete = (u16RxCRC == 0) &&
+						((u16BufferSize == u16expectedSize) ||
+						 (bException && (u16BufferSize == EXCEPTION_SIZE + CHECKSUM_SIZE)));
+	if (!bComplete && ((unsigned long)(micros() - u32time) < (unsigned long)u32T35))
 		return 0;
 
-	// transfer Serial buffer frame to auBuffer
-	u8lastRec = 0;
-	int8_t i8state = getRxBuffer();
-	if (i8state < 6) // 7 was incorrect for functions 1 and 2 the smallest frame could be 6 bytes long
+	u16lastRec = 0;
+	u32InCnt++;
+	int16_t i16state = u16BufferSize;
+	// 7 was incorrect for functions 1 and 2 the smallest frame could be 6 bytes long, an exception is 5 bytes long
+	if (i16state < (bException ? (EXCEPTION_SIZE + CHECKSUM_SIZE) : 6))
 	{
 		u8state = COM_IDLE;
-		u16errCnt++;
-		return i8state;
+		u8lastError = (uint8_t)ERR_BAD_CRC; // frame too short to be valid
+		u32errCnt++;
+		pQuerySlot->stats.u32crcErrors++;
+		return i16state;
 	}
 
 	// validate message: id, CRC, FCT, exception
 	uint8_t u8exception = validateAnswer();
+	if ((u8exception == 0) || (u8exception == (uint8_t)ERR_EXCEPTION))
+	{
+		// the queried slave answered, learn its response time
+		uint16_t u16rtt = (uint16_t)(millis() - u32timeOut);
+		updateRtt(u16rtt);
+		pQuerySlot->stats.au32latency[getLatencyBucket(u16rtt)]++;
+		if (u8exception == 0)
+		{
+			pQuerySlot->stats.u32answers++;
+		}
+		else
+		{
+			pQuerySlot->stats.u32exceptions++;
+		}
+	}
+	else
+	{
+		pQuerySlot->stats.u32crcErrors++;
+	}
 	if (u8exception != 0)
 	{
 		u8state = COM_IDLE;
+		u8lastError = u8exception;
 		return u8exception;
 	}
 
@@ -525,7 +902,7 @@ int8_t Modbus::poll()
 		break;
 	}
 	u8state = COM_IDLE;
-	return u8BufferSize;
+	return u16BufferSize;
 }
 
 /**
@@ -541,39 +918,49 @@ int8_t Modbus::poll()
  * @return 0 if no query, 1..4 if communication error, >4 if correct query processed
  * @ingroup loop
  */
-int8_t Modbus::poll(int16_t *regs, uint8_t u8size)
+int16_t Modbus::poll(int16_t *regs, uint8_t u8size)
 {
 
 	au16regs = regs;
 	u8regsize = u8size;
-	uint8_t u8current;
+	uint16_t u16current;
 
 	// check if there is any incoming frame
-	u8current = port->available();
+	u16current = port->available();
 
-	if (u8current == 0)
+	if (u16current == 0)
 	{
 		return 0;
 	}
 
 	// check T35 after frame end or still no frame end
-	if (u8current != u8lastRec)
+	if (u16current != u16lastRec)
 	{
-		u8lastRec = u8current;
-		u32time = millis();
+		u16lastRec = u16current;
+		u32time = micros();
 		return 0;
 	}
-	if ((unsigned long)(millis() - u32time) < (unsigned long)T35)
+	if ((unsigned long)(micros() - u32time) < (unsigned long)u32T35)
 	{
 		return 0;
 	}
 
-	u8lastRec = 0;
-	int8_t i8state = getRxBuffer();
-	u8lastError = i8state;
-	if (i8state < 7)
+	u16lastRec = 0;
+	u16BufferSize = 0;
+	u16RxCRC = 0xFFFF;
+	bOverflow = false;
+	int16_t i16state = getRxBuffer();
+	u32InCnt++;
+	if (i16state == ERR_BUFF_OVERFLOW)
 	{
-		return i8state;
+		u32errCnt++;
+		u8lastError = (uint8_t)ERR_BUFF_OVERFLOW;
+		return i16state;
+	}
+	u8lastError = 0;
+	if (i16state < 7)
+	{
+		return i16state;
 	}
 
 	// check slave id
@@ -624,7 +1011,7 @@ int8_t Modbus::poll(int16_t *regs, uint8_t u8size)
 	default:
 		break;
 	}
-	return i8state;
+	return i16state;
 }
 
 /* _____PRIVATE FUNCTIONS_____________________________________________________ */
@@ -632,34 +1019,42 @@ int8_t Modbus::poll(int16_t *regs, uint8_t u8size)
 /**
  * @brief
  * This method moves Serial buffer data to the Modbus au8Buffer.
+ * The data is appended to the bytes already in au8Buffer, so it can be called
+ * repeatedly while a frame comes in. The CRC is updated with every byte, so it
+ * is ready when the frame is complete.
+ * Reset u16BufferSize, u16RxCRC and bOverflow before the first call for a new frame.
+ *
+ * au8Buffer is never written beyond its end. Bytes beyond MAX_BUFFER, or beyond
+ * the expected response size if it is known, are read from the port and dropped.
  *
- * @return buffer size if OK, ERR_BUFF_OVERFLOW if u8BufferSize >= MAX_BUFFER
+ * @return buffer size if OK, ERR_BUFF_OVERFLOW if the frame is too long
  * @ingroup buffer
  */
-int8_t Modbus::getRxBuffer()
+int16_t Modbus::getRxBuffer()
 {
-	boolean bBuffOverflow = false;
+	uint16_t u16limit = ((u16expectedSize != 0) && (u16expectedSize < MAX_BUFFER)) ? u16expectedSize : MAX_BUFFER;
 
 	if (u8txenpin > 1)
 		digitalWrite(u8txenpin, LOW);
 
-	u8BufferSize = 0;
 	while (port->available())
 	{
-		au8Buffer[u8BufferSize] = port->read();
-		u8BufferSize++;
-
-		if (u8BufferSize >= MAX_BUFFER)
-			bBuffOverflow = true;
+		uint8_t u8byte = port->read();
+		if (u16BufferSize >= u16limit)
+		{
+			bOverflow = true;
+			continue;
+		}
+		au8Buffer[u16BufferSize] = u8byte;
+		u16RxCRC = updateCRC(u16RxCRC, u8byte);
+		u16BufferSize++;
 	}
-	u16InCnt++;
 
-	if (bBuffOverflow)
+	if (bOverflow)
 	{
-		u16errCnt++;
 		return ERR_BUFF_OVERFLOW;
 	}
-	return u8BufferSize;
+	return u16BufferSize;
 }
 
 /**
@@ -677,11 +1072,11 @@ int8_t Modbus::getRxBuffer()
 void Modbus::sendTxBuffer()
 {
 	// append CRC to message
-	uint16_t u16crc = calcCRC(u8BufferSize);
-	au8Buffer[u8BufferSize] = u16crc >> 8;
-	u8BufferSize++;
-	au8Buffer[u8BufferSize] = u16crc & 0x00ff;
-	u8BufferSize++;
+	uint16_t u16crc = calcCRC(u16BufferSize);
+	au8Buffer[u16BufferSize] = u16crc >> 8;
+	u16BufferSize++;
+	au8Buffer[u16BufferSize] = u16crc & 0x00ff;
+	u16BufferSize++;
 
 	if (u8txenpin > 1)
 	{
@@ -690,7 +1085,7 @@ void Modbus::sendTxBuffer()
 	}
 
 	// transfer buffer to serial line
-	port->write(au8Buffer, u8BufferSize);
+	port->write(au8Buffer, u16BufferSize);
 	port->flush();
 	// port->read();
 	digitalWrite(PIN_SERIAL1_TX, LOW); // Switch to RX immediately
@@ -710,13 +1105,31 @@ void Modbus::sendTxBuffer()
 	}
 	// while (port->read() >= 0)
 	// 	;
-	u8BufferSize = 0;
+	u16BufferSize = 0;
 
 	// set time-out for master
 	u32timeOut = millis();
 
 	// increase message counter
-	u16OutCnt++;
+	u32OutCnt++;
+}
+
+/**
+ * @brief
+ * This method adds one byte to a running CRC
+ *
+ * @param u16crc CRC calculated so far, 0xFFFF for a new message
+ * @param u8byte next byte of the message
+ * @return uint16_t updated CRC value (not swapped)
+ * @ingroup buffer
+ */
+uint16_t Modbus::updateCRC(uint16_t u16crc, uint8_t u8byte)
+{
+#ifdef MB_CRC_NIBBLE_TABLE
+	return crcUpdateNibble(u16crc, u8byte);
+#else
+	return crcUpdateByte(u16crc, u8byte);
+#endif
 }
 
 /**
@@ -726,28 +1139,32 @@ void Modbus::sendTxBuffer()
  * @return uint16_t calculated CRC value for the message
  * @ingroup buffer
  */
-uint16_t Modbus::calcCRC(uint8_t u8length)
+uint16_t Modbus::calcCRC(uint16_t u16length)
 {
-	unsigned int temp, temp2, flag;
-	temp = 0xFFFF;
-	for (unsigned char i = 0; i < u8length; i++)
+	uint16_t temp = 0xFFFF;
+	for (uint16_t i = 0; i < u16length; i++)
 	{
-		temp = temp ^ au8Buffer[i];
-		for (unsigned char j = 1; j <= 8; j++)
-		{
-			flag = temp & 0x0001;
-			temp >>= 1;
-			if (flag)
-				temp ^= 0xA001;
-		}
+		temp = updateCRC(temp, au8Buffer[i]);
 	}
 	// Reverse byte order.
-	temp2 = temp >> 8;
-	temp = (temp << 8) | temp2;
-	temp &= 0xFFFF;
 	// the returned value is already swapped
 	// crcLo byte is first & crcHi byte is last
-	return temp;
+	return (uint16_t)((temp << 8) | (temp >> 8));
+}
+
+/**
+ * @brief
+ * This method calculates the expected length of a read response
+ *
+ * @param u16dataBytes number of data bytes requested from the slave
+ * @return uint16_t expected frame size including CRC, 0 if it does not fit into the buffer
+ * @ingroup buffer
+ */
+uint16_t Modbus::expectedSize(uint16_t u16dataBytes)
+{
+	// id + fct + byte count + data + crc
+	uint16_t u16size = 3 + u16dataBytes + CHECKSUM_SIZE;
+	return (u16size <= MAX_BUFFER) ? u16size : 0;
 }
 
 /**
@@ -759,12 +1176,10 @@ uint16_t Modbus::calcCRC(uint8_t u8length)
  */
 uint8_t Modbus::validateRequest()
 {
-	// check message crc vs calculated crc
-	uint16_t u16MsgCRC =
-		((au8Buffer[u8BufferSize - 2] << 8) | au8Buffer[u8BufferSize - 1]); // combine the crc Low & High bytes
-	if (calcCRC(u8BufferSize - 2) != u16MsgCRC)
+	// check message crc, the running CRC over message and crc bytes is 0 for a valid frame
+	if (u16RxCRC != 0)
 	{
-		u16errCnt++;
+		u32errCnt++;
 		return NO_REPLY;
 	}
 
@@ -780,43 +1195,66 @@ uint8_t Modbus::validateRequest()
 	}
 	if (!isSupported)
 	{
-		u16errCnt++;
+		u32errCnt++;
 		return EXC_FUNC_CODE;
 	}
 
-	// check start address & nb range
-	uint16_t u16regs = 0;
-	uint8_t u8regs;
+	// check quantity, so that the response fits into au8Buffer,
+	// and that the byte count of write requests matches the received frame
+	uint16_t u16start = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]);
+	uint16_t u16quantity = makeWord(au8Buffer[NB_HI], au8Buffer[NB_LO]);
 	switch (au8Buffer[FUNC])
 	{
 	case MB_FC_READ_COILS:
 	case MB_FC_READ_DISCRETE_INPUT:
+		if ((u16quantity == 0) || (u16quantity > MB_MAX_READ_BITS))
+			return EXC_REGS_QUANT;
+		break;
+	case MB_FC_READ_REGISTERS:
+	case MB_FC_READ_INPUT_REGISTER:
+		if ((u16quantity == 0) || (u16quantity > MB_MAX_READ_REGS))
+			return EXC_REGS_QUANT;
+		break;
 	case MB_FC_WRITE_MULTIPLE_COILS:
-		u16regs = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]) / 16;
-		u16regs += makeWord(au8Buffer[NB_HI], au8Buffer[NB_LO]) / 16;
-		u8regs = (uint8_t)u16regs;
-		if (u8regs > u8regsize)
+		if ((u16quantity == 0) || (u16quantity > MB_MAX_WRITE_BITS) ||
+			(au8Buffer[BYTE_CNT] != (u16quantity + 7) / 8) ||
+			(u16BufferSize != BYTE_CNT + 1 + au8Buffer[BYTE_CNT] + CHECKSUM_SIZE))
+			return EXC_REGS_QUANT;
+		break;
+	case MB_FC_WRITE_MULTIPLE_REGISTERS:
+		if ((u16quantity == 0) || (u16quantity > MB_MAX_WRITE_REGS) ||
+			(au8Buffer[BYTE_CNT] != u16quantity * 2) ||
+			(u16BufferSize != BYTE_CNT + 1 + au8Buffer[BYTE_CNT] + CHECKSUM_SIZE))
+			return EXC_REGS_QUANT;
+		break;
+	}
+
+	// check start address & nb range, calculated in 32 bit to avoid wrap around
+	uint32_t u32regs = 0;
+	switch (au8Buffer[FUNC])
+	{
+	case MB_FC_READ_COILS:
+	case MB_FC_READ_DISCRETE_INPUT:
+	case MB_FC_WRITE_MULTIPLE_COILS:
+		u32regs = ((uint32_t)u16start + u16quantity + 15) / 16;
+		if (u32regs > u8regsize)
 			return EXC_ADDR_RANGE;
 		break;
 	case MB_FC_WRITE_COIL:
-		u16regs = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]) / 16;
-		u8regs = (uint8_t)u16regs;
-		if (u8regs > u8regsize)
+		u32regs = u16start / 16;
+		if (u32regs >= u8regsize)
 			return EXC_ADDR_RANGE;
 		break;
 	case MB_FC_WRITE_REGISTER:
-		u16regs = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]);
-		u8regs = (uint8_t)u16regs;
-		if (u8regs > u8regsize)
+		u32regs = u16start;
+		if (u32regs >= u8regsize)
 			return EXC_ADDR_RANGE;
 		break;
 	case MB_FC_READ_REGISTERS:
 	case MB_FC_READ_INPUT_REGISTER:
 	case MB_FC_WRITE_MULTIPLE_REGISTERS:
-		u16regs = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]);
-		u16regs += makeWord(au8Buffer[NB_HI], au8Buffer[NB_LO]);
-		u8regs = (uint8_t)u16regs;
-		if (u8regs > u8regsize)
+		u32regs = (uint32_t)u16start + u16quantity;
+		if (u32regs > u8regsize)
 			return EXC_ADDR_RANGE;
 		break;
 	}
@@ -832,22 +1270,38 @@ uint8_t Modbus::validateRequest()
  */
 uint8_t Modbus::validateAnswer()
 {
-	// check message crc vs calculated crc
-	uint16_t u16MsgCRC =
-		((au8Buffer[u8BufferSize - 2] << 8) | au8Buffer[u8BufferSize - 1]); // combine the crc Low & High bytes
-	if (calcCRC(u8BufferSize - 2) != u16MsgCRC)
+	// check message crc, the running CRC over message and crc bytes is 0 for a valid frame
+	if (u16RxCRC != 0)
+	{
+		u32errCnt++;
+		return (uint8_t)ERR_BAD_CRC;
+	}
+
+	// check that the answer comes from the slave that was queried
+	if (au8Buffer[ID] != u8queryId)
 	{
-		u16errCnt++;
+		u32errCnt++;
 		return NO_REPLY;
 	}
 
 	// check exception
 	if ((au8Buffer[FUNC] & 0x80) != 0)
 	{
-		u16errCnt++;
+		u32errCnt++;
 		return ERR_EXCEPTION;
 	}
 
+	// check the length of read responses before the data is copied to au16regs
+	if ((au8Buffer[FUNC] >= MB_FC_READ_COILS) && (au8Buffer[FUNC] <= MB_FC_READ_INPUT_REGISTER))
+	{
+		if ((au8Buffer[2] + 3 + CHECKSUM_SIZE != u16BufferSize) ||
+			((u16expectedSize != 0) && (u16BufferSize != u16expectedSize)))
+		{
+			u32errCnt++;
+			return (uint8_t)ERR_BAD_CRC;
+		}
+	}
+
 	// check fct code
 	boolean isSupported = false;
 	for (uint8_t i = 0; i < sizeof(fctsupported); i++)
@@ -860,13 +1314,93 @@ uint8_t Modbus::validateAnswer()
 	}
 	if (!isSupported)
 	{
-		u16errCnt++;
+		u32errCnt++;
 		return EXC_FUNC_CODE;
 	}
 
 	return 0; // OK, no exception code thrown
 }
 
+/**
+ * @brief
+ * This method finds the slot with the learned response time and the statistics
+ * of a slave and function code
+ *
+ * @param u8id slave address
+ * @param u8fct function code
+ * @param bCreate true to assign a slot if there is none yet,
+ * 		the oldest assigned slot is reused and counted as eviction if all are in use
+ * @return pointer to the slot, NULL if not found and bCreate is false
+ * @ingroup buffer
+ */
+modbus_slot_t *Modbus::findSlot(uint8_t u8id, uint8_t u8fct, boolean bCreate)
+{
+	modbus_slot_t *free = NULL;
+	for (uint8_t i = 0; i < MB_RTT_SLOTS; i++)
+	{
+		if ((aSlots[i].u8id == u8id) && (aSlots[i].u8fct == u8fct))
+		{
+			return &aSlots[i];
+		}
+		if ((free == NULL) && (aSlots[i].u8id == 0))
+		{
+			free = &aSlots[i];
+		}
+	}
+	if (!bCreate)
+	{
+		return NULL;
+	}
+	if (free == NULL)
+	{
+		free = &aSlots[u8slotNext];
+		u8slotNext = (u8slotNext + 1) % MB_RTT_SLOTS;
+		u32slotEvictions++;
+	}
+	memset(free, 0, sizeof(modbus_slot_t));
+	free->u8id = u8id;
+	free->u8fct = u8fct;
+	return free;
+}
+
+/**
+ * @brief
+ * This method adds a response time of the pending query to the learned values.
+ * The smoothed value is an EWMA with a weight of 1/8, the worst value decays
+ * by 1/8 with every answer, so a single slow answer is forgotten after a while.
+ *
+ * @param u16rtt time from the end of the query to the complete answer in ms
+ * @ingroup buffer
+ */
+void Modbus::updateRtt(uint16_t u16rtt)
+{
+	modbus_rtt_t *rtt = &pQuerySlot->rtt;
+
+	// limit, so that the EWMA in 1/8 ms fits into 16 bit
+	if (u16rtt > 0x1FFF)
+	{
+		u16rtt = 0x1FFF;
+	}
+	if (rtt->u8samples == 0)
+	{
+		rtt->u16ewma = u16rtt << 3;
+		rtt->u16worst = u16rtt;
+	}
+	else
+	{
+		rtt->u16ewma = rtt->u16ewma - (rtt->u16ewma >> 3) + u16rtt;
+		rtt->u16worst -= rtt->u16worst >> 3;
+		if (u16rtt > rtt->u16worst)
+		{
+			rtt->u16worst = u16rtt;
+		}
+	}
+	if (rtt->u8samples < 255)
+	{
+		rtt->u8samples++;
+	}
+}
+
 /**
  * @brief
  * This method builds an exception message
@@ -880,7 +1414,7 @@ void Modbus::buildException(uint8_t u8exception)
 	au8Buffer[ID] = u8id;
 	au8Buffer[FUNC] = u8func + 0x80;
 	au8Buffer[2] = u8exception;
-	u8BufferSize = EXCEPTION_SIZE;
+	u16BufferSize = EXCEPTION_SIZE;
 }
 
 /**
@@ -934,13 +1468,13 @@ void Modbus::get_FC3()
  * This method processes functions 1 & 2
  * This method reads a bit array and transfers it to the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup discrete
  */
-int8_t Modbus::process_FC1(int16_t *regs, uint8_t /*u8size*/)
+int16_t Modbus::process_FC1(int16_t *regs, uint8_t /*u8size*/)
 {
 	uint8_t u8currentRegister, u8currentBit, u8bytesno, u8bitsno;
-	uint8_t u8CopyBufferSize;
+	uint16_t u16CopyBufferSize;
 	uint16_t u16currentCoil, u16coil;
 
 	// get the first and last coil from the message
@@ -952,8 +1486,8 @@ int8_t Modbus::process_FC1(int16_t *regs, uint8_t /*u8size*/)
 	if (u16Coilno % 8 != 0)
 		u8bytesno++;
 	au8Buffer[ADD_HI] = u8bytesno;
-	u8BufferSize = ADD_LO;
-	au8Buffer[u8BufferSize + u8bytesno - 1] = 0;
+	u16BufferSize = ADD_LO;
+	au8Buffer[u16BufferSize + u8bytesno - 1] = 0;
 
 	// read each coil from the register map and put its value inside the outcoming message
 	u8bitsno = 0;
@@ -965,7 +1499,7 @@ int8_t Modbus::process_FC1(int16_t *regs, uint8_t /*u8size*/)
 		u8currentBit = (uint8_t)(u16coil % 16);
 
 		bitWrite(
-			au8Buffer[u8BufferSize],
+			au8Buffer[u16BufferSize],
 			u8bitsno,
 			bitRead(regs[u8currentRegister], u8currentBit));
 		u8bitsno++;
@@ -973,16 +1507,16 @@ int8_t Modbus::process_FC1(int16_t *regs, uint8_t /*u8size*/)
 		if (u8bitsno > 7)
 		{
 			u8bitsno = 0;
-			u8BufferSize++;
+			u16BufferSize++;
 		}
 	}
 
 	// send outcoming message
 	if (u16Coilno % 8 != 0)
-		u8BufferSize++;
-	u8CopyBufferSize = u8BufferSize + 2;
+		u16BufferSize++;
+	u16CopyBufferSize = u16BufferSize + 2;
 	sendTxBuffer();
-	return u8CopyBufferSize;
+	return u16CopyBufferSize;
 }
 
 /**
@@ -990,31 +1524,31 @@ int8_t Modbus::process_FC1(int16_t *regs, uint8_t /*u8size*/)
  * This method processes functions 3 & 4
  * This method reads a makeWord array and transfers it to the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup register
  */
-int8_t Modbus::process_FC3(int16_t *regs, uint8_t /*u8size*/)
+int16_t Modbus::process_FC3(int16_t *regs, uint8_t /*u8size*/)
 {
 
 	uint8_t u8StartAdd = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]);
 	uint8_t u8regsno = makeWord(au8Buffer[NB_HI], au8Buffer[NB_LO]);
-	uint8_t u8CopyBufferSize;
+	uint16_t u16CopyBufferSize;
 	uint8_t i;
 
 	au8Buffer[2] = u8regsno * 2;
-	u8BufferSize = 3;
+	u16BufferSize = 3;
 
 	for (i = u8StartAdd; i < u8StartAdd + u8regsno; i++)
 	{
-		au8Buffer[u8BufferSize] = highByte(regs[i]);
-		u8BufferSize++;
-		au8Buffer[u8BufferSize] = lowByte(regs[i]);
-		u8BufferSize++;
+		au8Buffer[u16BufferSize] = highByte(regs[i]);
+		u16BufferSize++;
+		au8Buffer[u16BufferSize] = lowByte(regs[i]);
+		u16BufferSize++;
 	}
-	u8CopyBufferSize = u8BufferSize + 2;
+	u16CopyBufferSize = u16BufferSize + 2;
 	sendTxBuffer();
 
-	return u8CopyBufferSize;
+	return u16CopyBufferSize;
 }
 
 /**
@@ -1022,13 +1556,13 @@ int8_t Modbus::process_FC3(int16_t *regs, uint8_t /*u8size*/)
  * This method processes function 5
  * This method writes a value assigned by the master to a single bit
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup discrete
  */
-int8_t Modbus::process_FC5(int16_t *regs, uint8_t /*u8size*/)
+int16_t Modbus::process_FC5(int16_t *regs, uint8_t /*u8size*/)
 {
 	uint8_t u8currentRegister, u8currentBit;
-	uint8_t u8CopyBufferSize;
+	uint16_t u16CopyBufferSize;
 	uint16_t u16coil = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]);
 
 	// point to the register and its bit
@@ -1042,11 +1576,11 @@ int8_t Modbus::process_FC5(int16_t *regs, uint8_t /*u8size*/)
 		au8Buffer[NB_HI] == 0xff);
 
 	// send answer to master
-	u8BufferSize = 6;
-	u8CopyBufferSize = u8BufferSize + 2;
+	u16BufferSize = 6;
+	u16CopyBufferSize = u16BufferSize + 2;
 	sendTxBuffer();
 
-	return u8CopyBufferSize;
+	return u16CopyBufferSize;
 }
 
 /**
@@ -1054,25 +1588,25 @@ int8_t Modbus::process_FC5(int16_t *regs, uint8_t /*u8size*/)
  * This method processes function 6
  * This method writes a value assigned by the master to a single makeWord
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup register
  */
-int8_t Modbus::process_FC6(int16_t *regs, uint8_t /*u8size*/)
+int16_t Modbus::process_FC6(int16_t *regs, uint8_t /*u8size*/)
 {
 
 	uint8_t u8add = makeWord(au8Buffer[ADD_HI], au8Buffer[ADD_LO]);
-	uint8_t u8CopyBufferSize;
+	uint16_t u16CopyBufferSize;
 	uint16_t u16val = makeWord(au8Buffer[NB_HI], au8Buffer[NB_LO]);
 
 	regs[u8add] = u16val;
 
 	// keep the same header
-	u8BufferSize = RESPONSE_SIZE;
+	u16BufferSize = RESPONSE_SIZE;
 
-	u8CopyBufferSize = u8BufferSize + 2;
+	u16CopyBufferSize = u16BufferSize + 2;
 	sendTxBuffer();
 
-	return u8CopyBufferSize;
+	return u16CopyBufferSize;
 }
 
 /**
@@ -1080,13 +1614,13 @@ int8_t Modbus::process_FC6(int16_t *regs, uint8_t /*u8size*/)
  * This method processes function 15
  * This method writes a bit array assigned by the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup discrete
  */
-int8_t Modbus::process_FC15(int16_t *regs, uint8_t /*u8size*/)
+int16_t Modbus::process_FC15(int16_t *regs, uint8_t /*u8size*/)
 {
 	uint8_t u8currentRegister, u8currentBit, u8frameByte, u8bitsno;
-	uint8_t u8CopyBufferSize;
+	uint16_t u16CopyBufferSize;
 	uint16_t u16currentCoil, u16coil;
 	boolean bTemp;
 
@@ -1124,10 +1658,10 @@ int8_t Modbus::process_FC15(int16_t *regs, uint8_t /*u8size*/)
 
 	// send outcoming message
 	// it's just a copy of the incomping frame until 6th byte
-	u8BufferSize = 6;
-	u8CopyBufferSize = u8BufferSize + 2;
+	u16BufferSize = 6;
+	u16CopyBufferSize = u16BufferSize + 2;
 	sendTxBuffer();
-	return u8CopyBufferSize;
+	return u16CopyBufferSize;
 }
 
 /**
@@ -1135,21 +1669,21 @@ int8_t Modbus::process_FC15(int16_t *regs, uint8_t /*u8size*/)
  * This method processes function 16
  * This method writes a makeWord array assigned by the master
  *
- * @return u8BufferSize Response to master length
+ * @return u16BufferSize Response to master length
  * @ingroup register
  */
-int8_t Modbus::process_FC16(int16_t *regs, uint8_t /*u8size*/)
+int16_t Modbus::process_FC16(int16_t *regs, uint8_t /*u8size*/)
 {
 	uint8_t u8StartAdd = au8Buffer[ADD_HI] << 8 | au8Buffer[ADD_LO];
 	uint8_t u8regsno = au8Buffer[NB_HI] << 8 | au8Buffer[NB_LO];
-	uint8_t u8CopyBufferSize;
+	uint16_t u16CopyBufferSize;
 	uint8_t i;
 	uint16_t temp;
 
 	// build header
 	au8Buffer[NB_HI] = 0;
 	au8Buffer[NB_LO] = u8regsno;
-	u8BufferSize = RESPONSE_SIZE;
+	u16BufferSize = RESPONSE_SIZE;
 
 	// write registers
 	for (i = 0; i < u8regsno; i++)
@@ -1160,8 +1694,8 @@ int8_t Modbus::process_FC16(int16_t *regs, uint8_t /*u8size*/)
 
 		regs[u8StartAdd + i] = temp;
 	}
-	u8CopyBufferSize = u8BufferSize + 2;
+	u16CopyBufferSize = u16BufferSize + 2;
 	sendTxBuffer();
 
-	return u8CopyBufferSize;
+	return u16CopyBufferSize;
 }
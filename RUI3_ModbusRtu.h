@@ -61,6 +61,50 @@ typedef struct
 	int16_t *au16reg;	 /*!< Pointer to memory image in master */
 } modbus_t;
 
+/**
+ * @struct modbus_rtt_t
+ * @brief
+ * Learned response time of one slave and function code
+ */
+typedef struct
+{
+	uint8_t u8samples;	/*!< Number of answers seen, saturates at 255 */
+	uint16_t u16ewma;	/*!< Smoothed response time in 1/8 ms */
+	uint16_t u16worst;	/*!< Worst recent response time in ms, decays with every answer */
+} modbus_rtt_t;
+
+#define MB_HIST_BUCKETS 8 //!< number of response time histogram buckets
+#define MB_HIST_FIRST 16  //!< upper limit of the first histogram bucket in ms, doubled for each next bucket
+
+/**
+ * @struct modbus_stats_t
+ * @brief
+ * Bus statistics of one slave and function code
+ */
+typedef struct
+{
+	uint32_t u32requests;					/*!< Queries sent */
+	uint32_t u32answers;					/*!< Valid answers */
+	uint32_t u32timeouts;					/*!< Queries without answer */
+	uint32_t u32crcErrors;					/*!< Answers with CRC error, wrong length or from another slave */
+	uint32_t u32exceptions;					/*!< Exception answers */
+	uint32_t u32overflows;					/*!< Answers longer than expected */
+	uint32_t au32latency[MB_HIST_BUCKETS]; /*!< Response times of valid and exception answers, bucket n < MB_HIST_FIRST << n ms, last bucket unlimited */
+} modbus_stats_t;
+
+/**
+ * @struct modbus_slot_t
+ * @brief
+ * Learned response time and statistics of one slave and function code
+ */
+typedef struct
+{
+	uint8_t u8id;		  /*!< Slave address, 0 = slot unused */
+	uint8_t u8fct;		  /*!< Function code */
+	modbus_rtt_t rtt;	  /*!< Learned response time */
+	modbus_stats_t stats; /*!< Bus statistics */
+} modbus_slot_t;
+
 enum
 {
 	RESPONSE_SIZE = 6,
@@ -119,7 +163,8 @@ enum ERR_LIST
 	ERR_POLLING = -2,
 	ERR_BUFF_OVERFLOW = -3,
 	ERR_BAD_CRC = -4,
-	ERR_EXCEPTION = -5
+	ERR_EXCEPTION = -5,
+	ERR_QUANTITY = -6
 };
 
 enum
@@ -142,8 +187,27 @@ const unsigned char fctsupported[] =
 		MB_FC_WRITE_MULTIPLE_COILS,
 		MB_FC_WRITE_MULTIPLE_REGISTERS};
 
-#define T35 5
-#define MAX_BUFFER 128 //!< maximum size for the communication buffer in bytes
+#define T35 5			   //!< default inter-frame silence in ms, used until setBaudRate() is called
+#define T35_FAST_US 1750   //!< fixed inter-frame silence in us for baud rates above 19200
+#define T15_FAST_US 750	   //!< fixed inter-character timeout in us for baud rates above 19200
+#define MB_CHAR_BITS 11	   //!< bits per character on the line (start + 8 data + parity/stop + stop)
+#define MAX_BUFFER 256		   //!< maximum size for the communication buffer in bytes, a complete RTU ADU
+#define MB_MAX_READ_BITS 2000  //!< maximum number of coils or inputs in one FC1/FC2 request
+#define MB_MAX_READ_REGS 125   //!< maximum number of registers in one FC3/FC4 request
+#define MB_MAX_WRITE_BITS 1968 //!< maximum number of coils in one FC15 request
+#define MB_MAX_WRITE_REGS 123  //!< maximum number of registers in one FC16 request
+#define MB_RTT_SLOTS 8		   //!< number of slave/function code pairs with learned response times and statistics
+#define MB_RTT_MIN_TIMEOUT 50  //!< lower limit of a learned time-out in ms
+#define MB_RTT_MARGIN 20	   //!< safety margin added to a learned time-out in ms
+
+/**
+ * CRC engine selection
+ * Default is a 256 entry lookup table (512 bytes flash, one lookup per byte).
+ * Define MB_CRC_NIBBLE_TABLE to use a 16 entry lookup table instead
+ * (32 bytes flash, two lookups per byte) for flash-tight builds.
+ * bench/crc_bench.cpp compares both with the bit loop on the host.
+ */
+// #define MB_CRC_NIBBLE_TABLE
 
 /**
  * @class Modbus
@@ -160,42 +224,69 @@ private:
 	uint8_t u8state;
 	uint8_t u8lastError;
 	uint8_t au8Buffer[MAX_BUFFER];
-	uint8_t u8BufferSize;
-	uint8_t u8lastRec;
+	uint16_t u16BufferSize;
+	uint16_t u16lastRec;
+	uint8_t u8queryId;		 //!< slave address of the pending query
+	uint16_t u16expectedSize; //!< expected size of the slave response, 0 if unknown
+	boolean bOverflow;		 //!< more bytes received than fit into au8Buffer or than expected
+	uint16_t u16RxCRC;		//!< running CRC of the bytes received so far, 0 after a complete valid frame
 	int16_t *au16regs;
-	uint16_t u16InCnt, u16OutCnt, u16errCnt;
-	uint16_t u16timeOut;
+	uint32_t u32InCnt, u32OutCnt, u32errCnt;
+	uint16_t u16timeOut;	   //!< configured time-out, upper limit for the learned time-outs
+	uint16_t u16queryTimeOut; //!< time-out of the pending query
+	boolean bAdaptive;		   //!< use learned time-outs
+	modbus_slot_t aSlots[MB_RTT_SLOTS];
+	modbus_slot_t *pQuerySlot; //!< slot of the pending query
+	uint8_t u8slotNext;		   //!< next slot to replace if all slots are used
+	uint32_t u32slotEvictions; //!< number of slots reused for another slave or function code
 	uint32_t u32time, u32timeOut, u32overTime;
+	uint32_t u32T15, u32T35; //!< inter-character and inter-frame timeouts in us
 	uint8_t u8regsize;
 
 	void sendTxBuffer();
-	int8_t getRxBuffer();
-	uint16_t calcCRC(uint8_t u8length);
+	int16_t getRxBuffer();
+	uint16_t calcCRC(uint16_t u16length);
+	static uint16_t updateCRC(uint16_t u16crc, uint8_t u8byte);
+	uint16_t expectedSize(uint16_t u16dataBytes);
 	uint8_t validateAnswer();
 	uint8_t validateRequest();
 	void get_FC1();
 	void get_FC3();
-	int8_t process_FC1(int16_t *regs, uint8_t u8size);
-	int8_t process_FC3(int16_t *regs, uint8_t u8size);
-	int8_t process_FC5(int16_t *regs, uint8_t u8size);
-	int8_t process_FC6(int16_t *regs, uint8_t u8size);
-	int8_t process_FC15(int16_t *regs, uint8_t u8size);
-	int8_t process_FC16(int16_t *regs, uint8_t u8size);
+	int16_t process_FC1(int16_t *regs, uint8_t u8size);
+	int16_t process_FC3(int16_t *regs, uint8_t u8size);
+	int16_t process_FC5(int16_t *regs, uint8_t u8size);
+	int16_t process_FC6(int16_t *regs, uint8_t u8size);
+	int16_t process_FC15(int16_t *regs, uint8_t u8size);
+	int16_t process_FC16(int16_t *regs, uint8_t u8size);
 	void buildException(uint8_t u8exception); // build exception message
+	modbus_slot_t *findSlot(uint8_t u8id, uint8_t u8fct, boolean bCreate);
+	void updateRtt(uint16_t u16rtt);
 
 public:
 	Modbus(uint8_t u8id, Stream &port, uint8_t u8txenpin = 0);
 
 	void start();
+	void setBaudRate(uint32_t u32baud);			//!< derive T1.5 and T3.5 from the line speed
+	uint32_t getT15();							//!< get inter-character timeout in us
+	uint32_t getT35();							//!< get inter-frame timeout in us
+	uint32_t getPollDelay();					//!< ms until poll() needs to be called again
 	void setTimeOut(uint16_t u16timeOut);		//!< write communication watch-dog timer
 	uint16_t getTimeOut();						//!< get communication watch-dog timer value
 	boolean getTimeOutState();					//!< get communication watch-dog timer state
+	void setAdaptiveTimeOut(boolean bAdaptive);	//!< enable time-outs learned from the response times
+	uint16_t getAdaptiveTimeOut(uint8_t u8id, uint8_t u8fct); //!< time-out used for the next query
+	const modbus_rtt_t *getRtt(uint8_t u8id, uint8_t u8fct);   //!< learned response time, NULL if unknown
+	void clearRtt();							//!< forget all learned response times
+	const modbus_slot_t *getSlot(uint8_t u8index); //!< learned response time and statistics, NULL if unused
+	void clearStats();							//!< reset all statistics and counters
+	uint32_t getSlotEvictions();				//!< number of slots whose statistics were dropped for another slave
+	static uint8_t getLatencyBucket(uint16_t u16ms); //!< histogram bucket of a response time
 	int8_t query(modbus_t telegram);			//!< only for master
-	int8_t poll();								//!< cyclic poll for master
-	int8_t poll(int16_t *regs, uint8_t u8size); //!< cyclic poll for slave
-	uint16_t getInCnt();						//!< number of incoming messages
-	uint16_t getOutCnt();						//!< number of outcoming messages
-	uint16_t getErrCnt();						//!< error counter
+	int16_t poll();								 //!< cyclic poll for master
+	int16_t poll(int16_t *regs, uint8_t u8size); //!< cyclic poll for slave
+	uint32_t getInCnt();						//!< number of incoming messages
+	uint32_t getOutCnt();						//!< number of outcoming messages
+	uint32_t getErrCnt();						//!< error counter
 	uint8_t getID();							//!< get slave ID between 1 and 247
 	uint8_t getState();
 	uint8_t getLastError();	  //!< get last error message
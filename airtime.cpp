@@ -0,0 +1,274 @@
+/**
+ * @file airtime.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Airtime accounting against a daily budget, uplinks are reduced or deferred before the budget is used up
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Number of hourly buckets of the accounting window */
+#define AIRTIME_BUCKETS 24
+/** Time of one bucket in ms */
+#define AIRTIME_BUCKET_TIME 3600000
+/** Used share of the daily budget in % from which the uplinks are reduced */
+#define AIRTIME_LOW_SHARE 50
+/** Used share of the daily budget in % from which the uplinks are deferred */
+#define AIRTIME_OUT_SHARE 90
+/** Batch latency while the airtime is low and no batch latency is set, in minutes */
+#define AIRTIME_BATCH_LATENCY 60
+
+/** Airtime used in each hour of the last day in ms */
+uint32_t airtime_buckets[AIRTIME_BUCKETS];
+/** Bucket of the current hour */
+uint8_t airtime_bucket = 0;
+/** millis() when the current hour started */
+uint32_t airtime_hour_start = 0;
+/** Airtime state of the running sensor cycle, one of AIRTIME_xxx */
+uint8_t airtime_level = AIRTIME_OK;
+/** Time on air of the last uplink in us */
+uint32_t airtime_last_toa = 0;
+/** Number of readings deferred to the backlog because of the budget */
+uint16_t airtime_deferred = 0;
+
+/** Names of the airtime states */
+const char *airtime_level_names[] = {"ok", "low, compact payload and batching", "out, uplinks deferred"};
+
+// Forward declarations
+int airtime_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Move to the bucket of the current hour, buckets older than a day are cleared
+ *
+ */
+void airtime_rotate(void)
+{
+	uint8_t steps = 0;
+	while ((uint32_t)(millis() - airtime_hour_start) >= AIRTIME_BUCKET_TIME)
+	{
+		airtime_hour_start += AIRTIME_BUCKET_TIME;
+		airtime_bucket = (airtime_bucket + 1) % AIRTIME_BUCKETS;
+		airtime_buckets[airtime_bucket] = 0;
+		if (++steps >= AIRTIME_BUCKETS)
+		{
+			// Nothing was sent for a day
+			airtime_hour_start = millis();
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Get the airtime used in the last 24 hours
+ *
+ * @return uint32_t airtime in ms
+ */
+uint32_t airtime_used(void)
+{
+	airtime_rotate();
+	uint32_t used = 0;
+	for (uint8_t idx = 0; idx < AIRTIME_BUCKETS; idx++)
+	{
+		used += airtime_buckets[idx];
+	}
+	return used;
+}
+
+/**
+ * @brief Update the airtime state, called at the start of each sensor cycle
+ * 		The state is kept for the whole cycle so the payload format does not change between encoding and sending
+ *
+ */
+void airtime_update(void)
+{
+	if (custom_parameters.airtime_daily == 0)
+	{
+		airtime_level = AIRTIME_OK;
+		return;
+	}
+	uint32_t share = airtime_used() / (custom_parameters.airtime_daily * 10);
+	if (share >= AIRTIME_OUT_SHARE)
+	{
+		airtime_level = AIRTIME_OUT;
+	}
+	else if (share >= AIRTIME_LOW_SHARE)
+	{
+		airtime_level = AIRTIME_LOW;
+	}
+	else
+	{
+		airtime_level = AIRTIME_OK;
+	}
+	MYLOG("AIRTIME", "Used %ld ms of %d s, %s", airtime_used(), custom_parameters.airtime_daily, airtime_level_names[airtime_level]);
+}
+
+/**
+ * @brief Get the airtime state of the running sensor cycle
+ *
+ * @return uint8_t AIRTIME_OK, AIRTIME_LOW or AIRTIME_OUT
+ */
+uint8_t airtime_state(void)
+{
+	return airtime_level;
+}
+
+/**
+ * @brief Check if an uplink fits into the remaining budget
+ *
+ * @param toa time on air of the uplink in us
+ * @return true uplink can be sent
+ * @return false uplink has to be deferred
+ */
+bool airtime_allows(uint32_t toa)
+{
+	if (custom_parameters.airtime_daily == 0)
+	{
+		return true;
+	}
+	if (airtime_level == AIRTIME_OUT)
+	{
+		return false;
+	}
+	return airtime_used() + toa / 1000 <= (uint32_t)custom_parameters.airtime_daily * 1000;
+}
+
+/**
+ * @brief Record an uplink that was enqueued
+ *
+ * @param toa time on air of the uplink in us
+ */
+void airtime_add(uint32_t toa)
+{
+	airtime_rotate();
+	airtime_buckets[airtime_bucket] += (toa + 500) / 1000;
+	airtime_last_toa = toa;
+}
+
+/**
+ * @brief Record the retransmissions of an uplink, called from the send callback
+ * 		A confirmed uplink without ACK was sent g_confirmed_retry times more.
+ * 		The retransmissions of an acknowledged uplink are not reported by the stack and are not counted.
+ *
+ * @param success true if the uplink was sent (and acknowledged in confirmed mode)
+ */
+void airtime_send_done(bool success)
+{
+	if (!success && g_confirmed_mode)
+	{
+		airtime_rotate();
+		airtime_buckets[airtime_bucket] += g_confirmed_retry * ((airtime_last_toa + 500) / 1000);
+	}
+	airtime_last_toa = 0;
+}
+
+/**
+ * @brief Count a reading that was deferred because of the budget
+ *
+ */
+void airtime_defer(void)
+{
+	airtime_deferred++;
+}
+
+/**
+ * @brief Get the batch latency
+ * 		While the airtime is low, readings are batched even if no batch latency is set
+ *
+ * @return uint16_t batch latency in minutes, 0 = send each reading
+ */
+uint16_t airtime_batch_latency(void)
+{
+	// Not while uplinks are deferred, a batch may be too large for the backlog
+	if ((custom_parameters.batch_latency == 0) && (airtime_level == AIRTIME_LOW))
+	{
+		return AIRTIME_BATCH_LATENCY;
+	}
+	return custom_parameters.batch_latency;
+}
+
+/**
+ * @brief Check if the compact payload is sent
+ * 		While the airtime is low, the compact payload is sent instead of Cayenne LPP
+ *
+ * @return true compact payload
+ * @return false Cayenne LPP payload
+ */
+bool airtime_compact(void)
+{
+	// Stored batch readings are in compact format, keep it until they are sent
+	return (custom_parameters.payload_format == PAYLOAD_COMPACT) || (airtime_level != AIRTIME_OK) || batch_pending();
+}
+
+/**
+ * @brief Print the airtime status
+ *
+ */
+void print_airtime(void)
+{
+	uint32_t used = airtime_used();
+	AT_PRINTF("Airtime %ld.%03ld s in 24 h, %ld.%03ld s in this hour, %s, %d readings deferred", used / 1000, used % 1000,
+			  airtime_buckets[airtime_bucket] / 1000, airtime_buckets[airtime_bucket] % 1000, airtime_level_names[airtime_level],
+			  airtime_deferred);
+}
+
+/**
+ * @brief Add airtime AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_airtime_at(void)
+{
+	return api.system.atMode.add((char *)"AIRTIME",
+								 (char *)"Set/Get the airtime budget in seconds per day, 0 = no budget",
+								 (char *)"Airtime Budget", airtime_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for airtime AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int airtime_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d", cmd, custom_parameters.airtime_daily);
+		print_airtime();
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		uint32_t new_budget = strtoul(param->argv[0], NULL, 10);
+		if (new_budget > AIRTIME_MAX_DAILY)
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (new_budget != custom_parameters.airtime_daily)
+		{
+			custom_parameters.airtime_daily = new_budget;
+			save_at_setting();
+			airtime_update();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
@@ -11,6 +11,8 @@
 
 #include <Arduino.h>
 #include "RUI3_ModbusRtu.h"
+#include "RUI3_ModbusQueue.h"
+#include "RUI3_ModbusPlanner.h"
 
 // Test mode
 // Test mode set to 0 to use long sensor reading times
@@ -82,56 +84,213 @@
 	delay(100)
 #endif
 
-// Modbus stuff
-/** Sensor register structure */
-struct sensor_data_s
-{
-	// int16_t coils;
-	int16_t reg_1;
-	int16_t reg_2;
-	int16_t reg_3;
-	int16_t reg_4;
-	int16_t reg_5;
-	int16_t reg_6;
-	int16_t reg_7;
-	int16_t reg_8;
-	int16_t reg_9;
-};
+/** Flag of the first settings layout, send interval only */
+#define SETTINGS_FLAG_V1 0xAA
+/** Flag of the extensible settings layout, new fields are appended and default if not in flash */
+#define SETTINGS_FLAG 0xAB
+
+/** Built-in sensor profile VEM SEE SN-3002-TR-ECTHNPKKPH-N01 */
+#define PROFILE_VEMSEE 0
+/** Built-in sensor profile GEMHO 7in1 Soil Sensor */
+#define PROFILE_GEMHO 1
+/** Number of built-in sensor profiles */
+#define PROFILE_BUILTIN 2
+/** Number of sensor profiles in flash, they follow the built-in profiles */
+#define PROFILE_FLASH_SLOTS 4
+/** Number of sensor profiles */
+#define PROFILE_NUM (PROFILE_BUILTIN + PROFILE_FLASH_SLOTS)
+/** Flash offset of the first sensor profile, behind the custom flash parameters */
+#define PROFILE_FLASH_OFFSET 256
+/** Flash space reserved per sensor profile */
+#define PROFILE_FLASH_SIZE 256
+/** Flash offset of the backlog of unsent readings, behind the sensor profiles */
+#define BACKLOG_FLASH_OFFSET 1280
+/** Shortest interval between two backlog uplinks in seconds */
+#define BACKLOG_MIN_INTERVAL 10
+
+/** Maximum number of sensor probes on the RS485 bus */
+#define MB_MAX_PROBES 4
+/** Maximum number of coil and register writes in one downlink */
+#define MB_MAX_WRITES 8
+/** Maximum number of registers of one write, coils are packed 16 per register */
+#define MB_WRITE_MAX_REGS 8
+
+/** Downlink command to write a part of a profile into the receive buffer: AA 55 A0 <profile> <offset> <data> */
+#define DL_PROFILE_WRITE 0xA0
+/** Downlink command to check the received profile and save it to flash: AA 55 A1 <profile> */
+#define DL_PROFILE_SAVE 0xA1
+/** Downlink command to set the probes: AA 55 A2 <address> <profile> [<address> <profile> ...] */
+#define DL_PROBES 0xA2
+/** Downlink command with several coil and register writes: AA 55 B0 <fc> <len> <address> <start> <data> [...] */
+#define DL_MB_WRITE 0xB0
+/** LPP channel offset between two probes, probe n uses the channels of the register map + n * PROBE_CHANNEL_STEP */
+#define PROBE_CHANNEL_STEP 16
+/** LPP channel offset of the spread of a value, the spread of a value on channel n is sent on channel n + SPREAD_CHANNEL_OFFSET */
+#define SPREAD_CHANNEL_OFFSET 64
+
+/** Payload format Cayenne LPP */
+#define PAYLOAD_LPP 0
+/** Payload format bit-packed compact payload */
+#define PAYLOAD_COMPACT 1
+/** fPort of the compact payload */
+#define COMPACT_FPORT 3
+/** fPort of a batch of compact payloads */
+#define BATCH_FPORT 4
+/** Bits of the age of a reading in a batch, in minutes */
+#define BATCH_AGE_BITS 12
+/** fPort of a reading sent from the backlog */
+#define BACKLOG_FPORT 5
+
+/** Number of soil sensor values with a deadband, same as SOIL_FIELD_NUM */
+#define RBE_FIELDS 9
+/** Longest heartbeat of the report-by-exception in minutes */
+#define RBE_MAX_HEARTBEAT 1440
+
+/** Airtime state, uplinks as configured */
+#define AIRTIME_OK 0
+/** Airtime state, compact payload and batching to save airtime */
+#define AIRTIME_LOW 1
+/** Airtime state, uplinks are deferred to the backlog */
+#define AIRTIME_OUT 2
+/** Largest daily airtime budget in seconds */
+#define AIRTIME_MAX_DAILY 3600
+
+/** Maximum number of reads per sensor read with oversampling */
+#define OVERSAMPLE_MAX 9
+/** Oversampling filter, median of the reads */
+#define OVERSAMPLE_MEDIAN 0
+/** Oversampling filter, mean of the reads without the lowest and highest quarter */
+#define OVERSAMPLE_TRIMMED_MEAN 1
 
-/** Union for received data mapping */
-union coils_n_regs_u
+/** Sensor probe on the RS485 bus */
+struct probe_s
 {
-	sensor_data_s sensor_data;
-	int16_t data[9];
+	/** Modbus slave address, 0 = slave address of the profile */
+	uint8_t address;
+	/** Sensor profile, one of PROFILE_xxx */
+	uint8_t profile;
 };
 
-extern coils_n_regs_u au16data;
-
 /** Custom flash parameters structure */
 struct custom_param_s
 {
-	uint8_t valid_flag = 0xAA;
+	uint8_t valid_flag = SETTINGS_FLAG;
+	uint8_t reserved = 0;
+	/** Number of bytes of this structure when it was saved */
+	uint16_t param_size = sizeof(custom_param_s);
 	uint32_t send_interval = 0;
+	/** Add bus statistics to the uplink, 0 = off, 1 = counters, 2 = counters and latency histogram */
+	uint8_t mb_stats_uplink = 0;
+	/** Fill up to the size of the layout that ended with mb_stats_uplink, new fields must start after it */
+	uint8_t reserved_2[3] = {0, 0, 0};
+	/** Interval of the sensor reads during warm-up in seconds, 0 = fixed power up time */
+	uint16_t warmup_interval = 0;
+	/** Allowed change between two warm-up reads in percent of the value */
+	uint8_t warmup_tolerance = 2;
+	uint8_t reserved_3 = 0;
+	/** Number of sensor probes on the RS485 bus */
+	uint8_t probe_num = 1;
+	uint8_t reserved_4 = 0;
+	/** Sensor probes, read in this order in one power up */
+	probe_s probes[MB_MAX_PROBES] = {{1, PROFILE_VEMSEE}, {2, PROFILE_VEMSEE}, {3, PROFILE_VEMSEE}, {4, PROFILE_VEMSEE}};
+	uint8_t reserved_5[2] = {0, 0};
+	/** Number of reads per sensor read, filtered into one value, 1 = no oversampling */
+	uint8_t oversample_reads = 1;
+	/** Filter of the oversampled reads, OVERSAMPLE_MEDIAN or OVERSAMPLE_TRIMMED_MEAN */
+	uint8_t oversample_filter = OVERSAMPLE_MEDIAN;
+	/** Add the spread of the oversampled values to the uplink, 0 = off, 1 = on */
+	uint8_t oversample_spread = 0;
+	uint8_t reserved_6 = 0;
+	/** Low battery level in mV, below it the send interval is stretched, 0 = off */
+	uint16_t batt_low = 0;
+	uint8_t reserved_7[2] = {0, 0};
+	/** Payload format, PAYLOAD_LPP or PAYLOAD_COMPACT */
+	uint8_t payload_format = PAYLOAD_LPP;
+	uint8_t reserved_8[3] = {0, 0, 0};
+	/** Maximum time a reading is held back to send it with later readings in minutes, 0 = send each reading */
+	uint16_t batch_latency = 0;
+	uint8_t reserved_9[2] = {0, 0};
+	/** Interval between two uplinks of readings from the backlog in seconds */
+	uint16_t backlog_interval = 60;
+	uint8_t reserved_10[2] = {0, 0};
+	/** Heartbeat of the report-by-exception in minutes, a reading is sent at least this often, 0 = send each reading */
+	uint16_t rbe_heartbeat = 0;
+	uint8_t reserved_11[2] = {0, 0};
+	/** Deadband of each soil sensor value in 1/10 of its LPP unit, a larger change is sent, 0 = changes are not sent */
+	uint16_t deadband[RBE_FIELDS] = {20, 5, 200, 2, 50, 50, 50, 200, 200};
+	uint8_t reserved_12[2] = {0, 0};
+	/** Number of datarates below the link datarate kept as link margin */
+	uint8_t dr_margin = 0;
+	uint8_t reserved_13[3] = {0, 0, 0};
+	/** Airtime budget in seconds per day, e.g. a fair use policy, 0 = no budget */
+	uint16_t airtime_daily = 0;
+	uint8_t reserved_14[2] = {0, 0};
+};
+
+/** Warm-up statistics */
+struct warmup_stats_s
+{
+	/** Time to convergence of the last power up in ms, 0 if it did not converge */
+	uint32_t last_time = 0;
+	/** Shortest time to convergence in ms */
+	uint32_t min_time = 0;
+	/** Longest time to convergence in ms */
+	uint32_t max_time = 0;
+	/** Sum of all times to convergence in ms */
+	uint32_t sum_time = 0;
+	/** Number of power ups that converged */
+	uint16_t converged = 0;
+	/** Number of power ups that reached SENSOR_POWER_TIME */
+	uint16_t timed_out = 0;
 };
 
+/** Warm-up statistics */
+extern warmup_stats_s warmup_stats;
+
 /** Custom flash parameters */
 extern custom_param_s custom_parameters;
 
-/** This is the structure which contains a write to set/reset coils */
-struct coil_s
+/** States of the sensor acquisition cycle */
+enum cycle_state_e
+{
+	CYC_IDLE = 0,	//!< sensor is off
+	CYC_POWER_UP,	//!< sensor is powered, waiting for the next read
+	CYC_UART_INIT,	//!< RS485 UART and Modbus master initialization
+	CYC_SETTLE,		//!< waiting for the RS485 line to settle
+	CYC_QUERY,		//!< read requests are planned and queued
+	CYC_RESPONSE,	//!< read requests are running on the bus
+	CYC_POWER_DOWN, //!< sensor and UART are switched off
+	CYC_ENCODE,		//!< battery, statistics and error flag are added to the payload
+	CYC_SEND,		//!< payload is sent
+	CYC_NUM_STATES
+};
+
+/** Timing trace of a sensor acquisition cycle */
+struct cycle_trace_s
 {
-	int8_t dev_addr = 1;
-	int8_t coils[16];
-	int8_t num_coils = 0;
+	/** Time spent in each state in ms */
+	uint32_t state_time[CYC_NUM_STATES];
+	/** Time the CPU was busy in each state in us */
+	uint32_t awake_time[CYC_NUM_STATES];
+	/** Number of timer callbacks of the cycle */
+	uint16_t steps;
+	/** Number of sensor reads */
+	uint8_t reads;
 };
 
-/** This is the structure to write to specific registers in the ModBus slave */
-struct register_s
+/** Coil or register write, passed from the radio callbacks to the Modbus worker */
+struct write_cmd_s
 {
-	int8_t dev_addr = 1;
-	int8_t registers[16];
-	int8_t num_registers = 0;
-	int16_t register_start_address = 0;
+	/** Slave address */
+	uint8_t dev_addr;
+	/** Function code MB_FC_WRITE_COIL, MB_FC_WRITE_REGISTER, MB_FC_WRITE_MULTIPLE_COILS or MB_FC_WRITE_MULTIPLE_REGISTERS */
+	uint8_t fct;
+	/** Address of the first coil or register */
+	uint16_t start;
+	/** Number of coils or registers */
+	uint16_t count;
+	/** Register values or coils packed 8 per byte, first coil in bit 0, high byte of each register first */
+	int16_t values[MB_WRITE_MAX_REGS];
 };
 
 // Forward declarations
@@ -139,24 +298,90 @@ void send_packet(void);
 bool init_status_at(void);
 bool init_interval_at(void);
 bool init_test_at(void);
+bool init_mbstat_at(void);
+bool init_warmup_at(void);
+bool init_probes_at(void);
+bool init_profile_at(void);
+void load_profiles(void);
+bool dl_profile_write(const uint8_t *buffer, uint8_t size);
+bool dl_profile_save(const uint8_t *buffer, uint8_t size);
+bool dl_probes(const uint8_t *buffer, uint8_t size);
+bool write_reserve(uint8_t num);
+write_cmd_s *write_slot(uint8_t idx);
+void write_commit(uint8_t num);
+bool write_pending(void);
+void write_clear(void);
+uint8_t write_collect(void);
+uint8_t write_batch(uint8_t first, uint32_t baud);
+void write_finished(void);
+void add_write_result(void);
+void downlink_decode(const uint8_t *buffer, uint8_t size);
+uint32_t write_baud(uint8_t dev_addr);
+bool init_oversample_at(void);
+void oversample_reset(void);
+void battery_init(void);
+void battery_sample(void *);
+void battery_hold_off(void);
+int32_t battery_mv(void);
+int32_t battery_trend(void);
+uint8_t battery_interval_factor(void);
+bool battery_skip_reading(void);
+void print_battery(void);
+bool init_batt_at(void);
+bool init_payload_at(void);
+bool init_batch_at(void);
+bool batch_enabled(void);
+bool batch_pending(void);
+bool batch_due(uint32_t next_reading);
+bool init_backlog_at(void);
+void backlog_init(void);
+void backlog_drain(void *);
+void backlog_start_drain(void);
+bool backlog_store(const uint8_t *buffer, uint8_t size, uint8_t fport);
+void backlog_uplink(const uint8_t *buffer, uint8_t size, uint8_t fport);
+void backlog_send_done(bool success);
+uint16_t backlog_count(void);
+bool init_rbe_at(void);
+bool rbe_enabled(void);
+void print_bus_stats(void);
+void add_bus_stats(uint8_t mode);
 bool get_at_setting(void);
 bool save_at_setting(void);
-uint8_t get_min_dr(uint16_t region, uint16_t payload_size);
+uint8_t set_uplink_dr(uint16_t payload_size);
+uint32_t get_uplink_toa(uint16_t region, uint8_t datarate, uint16_t payload_size);
+bool init_dr_margin_at(void);
+bool init_airtime_at(void);
+void airtime_update(void);
+uint8_t airtime_state(void);
+bool airtime_allows(uint32_t toa);
+void airtime_add(uint32_t toa);
+void airtime_send_done(bool success);
+void airtime_defer(void);
+uint16_t airtime_batch_latency(void);
+bool airtime_compact(void);
+void print_airtime(void);
+uint16_t get_max_payload(uint16_t region, uint8_t datarate);
 void joinCallback(int32_t status);
 void receiveCallback(SERVICE_LORA_RECEIVE_T *data);
 void sendCallback(int32_t status);
 void recv_cb(rui_lora_p2p_recv_t data);
 void send_cb(void);
 void cad_cb(bool result);
-void modbus_read_register(void *test);
-extern bool is_registers;
-extern coil_s coil_data;
-extern register_s register_data;
+bool sensor_cycle_start(bool test);
+void print_cycle_trace(void);
 extern bool sensor_active;
+extern bool write_active;
+extern modbus_transaction_t write_transactions[MB_MAX_WRITES];
+extern uint8_t write_num;
+extern Modbus master;
 extern const char *sw_version;
+extern bool g_confirmed_mode;
+extern uint8_t g_confirmed_retry;
 
 // LoRaWAN stuff
 #include "wisblock_cayenne.h"
+#include "sensor_map.h"
+#include "compact_payload.h"
 // Cayenne LPP Channel numbers per sensor value
 #define LPP_CHANNEL_BATT 1 // Base Board
 #define LPP_CHANNEL_MOIST 2
@@ -169,5 +394,19 @@ extern const char *sw_version;
 #define LPP_CHANNEL_SALIN 9
 #define LPP_CHANNEL_TDS 10
 #define LPP_CHANNEL_ERROR 11
+#define LPP_CHANNEL_MB_STATS 12
+#define LPP_CHANNEL_MB_HIST 13
+#define LPP_CHANNEL_MB_WRITE 14
 
 extern WisCayenne g_solution_data;
+extern CompactPayload g_compact_data;
+const sensor_profile_s *get_profile(uint8_t id);
+bool check_probes(const probe_s *probes, uint8_t num);
+const sensor_profile_s *probe_profile(uint8_t probe);
+bool rbe_report(const soil_data_s *data, uint8_t errors, uint32_t next_reading);
+bool oversample_add(const soil_data_s &data);
+void oversample_filter(const sensor_profile_s *profile, soil_data_s &data, soil_data_s &spread);
+void compact_add_header(CompactPayload &payload, int32_t battery, uint8_t errors);
+void compact_add_probe(CompactPayload &payload, const sensor_profile_s *profile, const soil_data_s &data);
+bool batch_add(const CompactPayload &reading, uint8_t probes);
+void batch_build(CompactPayload &payload);
@@ -0,0 +1,412 @@
+/**
+ * @file backlog.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Circular log in flash for compact readings that could not be sent, sent later when the link is back
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Marks a valid backlog index */
+#define BACKLOG_MAGIC 0xB1
+/** Number of index copies, written in turn to spread the writes */
+#define BACKLOG_INDEX_COPIES 4
+/** Flash space of one index copy */
+#define BACKLOG_INDEX_SIZE 16
+/** Flash space of one record */
+#define BACKLOG_SLOT_SIZE 64
+/** Number of records in the backlog */
+#define BACKLOG_SLOTS 32
+/** Flash offset of the first record */
+#define BACKLOG_RECORD_OFFSET (BACKLOG_FLASH_OFFSET + BACKLOG_INDEX_COPIES * BACKLOG_INDEX_SIZE)
+/** Payload bytes of a record */
+#define BACKLOG_DATA_SIZE (BACKLOG_SLOT_SIZE - 9)
+
+/** Backlog index, where the log starts and ends */
+struct backlog_index_s
+{
+	/** BACKLOG_MAGIC if the index is valid */
+	uint8_t magic;
+	uint8_t reserved;
+	/** Sequence number of the next record to write */
+	uint16_t head;
+	/** Sequence number of the oldest record not sent yet */
+	uint16_t tail;
+	uint8_t reserved_2[2];
+	/** Number of index writes, the copy with the highest count is the current one */
+	uint32_t count;
+	/** Backlog clock in minutes when the index was written */
+	uint32_t minutes;
+};
+
+/** Record of a reading that was not sent */
+struct backlog_record_s
+{
+	/** Sequence number, record n is in slot n % BACKLOG_SLOTS */
+	uint16_t seq;
+	/** fPort of the payload */
+	uint8_t fport;
+	/** Size of the payload */
+	uint8_t size;
+	/** Backlog clock in minutes when the reading was taken */
+	uint32_t minutes;
+	/** Payload */
+	uint8_t data[BACKLOG_DATA_SIZE];
+	/** Sum of all bytes before, to detect erased or partly written slots */
+	uint8_t check;
+};
+
+static_assert(sizeof(backlog_index_s) == BACKLOG_INDEX_SIZE, "Backlog index does not fit its flash space");
+static_assert(sizeof(backlog_record_s) == BACKLOG_SLOT_SIZE, "Backlog record does not fit its flash space");
+static_assert(BACKLOG_FLASH_OFFSET >= PROFILE_FLASH_OFFSET + PROFILE_FLASH_SLOTS * PROFILE_FLASH_SIZE, "Backlog overlaps the sensor profiles");
+
+/** Current backlog index */
+backlog_index_s backlog_index;
+/** Backlog clock in minutes */
+uint32_t backlog_clock = 0;
+/** millis() of the last backlog clock update */
+uint32_t backlog_clock_ms = 0;
+/** Flag if a backlog record is being sent */
+bool backlog_in_flight = false;
+/** Copy of the payload of the last regular uplink, stored if it fails */
+uint8_t last_data[BACKLOG_DATA_SIZE];
+/** Size of the last regular uplink, 0 = nothing to store */
+uint8_t last_size = 0;
+/** fPort of the last regular uplink */
+uint8_t last_fport = 0;
+
+// Forward declarations
+int backlog_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Get the backlog clock
+ * 		Continues from the last index write after a reboot, the time the device was off is not counted.
+ * 		Updated from the difference of millis() so it survives the millis() overflow after 49 days.
+ *
+ * @return uint32_t minutes
+ */
+uint32_t backlog_minutes(void)
+{
+	uint32_t elapsed = millis() - backlog_clock_ms;
+	backlog_clock += elapsed / 60000;
+	backlog_clock_ms += (elapsed / 60000) * 60000;
+	return backlog_clock;
+}
+
+/**
+ * @brief Get the number of stored records
+ *
+ * @return uint16_t number of records not sent yet
+ */
+uint16_t backlog_count(void)
+{
+	return (uint16_t)(backlog_index.head - backlog_index.tail);
+}
+
+/**
+ * @brief Calculate the check byte of a record
+ *
+ * @param record backlog record
+ * @return uint8_t sum of all bytes before the check byte
+ */
+uint8_t backlog_check(const backlog_record_s &record)
+{
+	const uint8_t *bytes = (const uint8_t *)&record;
+	uint8_t sum = 0;
+	for (uint8_t idx = 0; idx < offsetof(backlog_record_s, check); idx++)
+	{
+		sum += bytes[idx];
+	}
+	return sum;
+}
+
+/**
+ * @brief Write the index into the next index copy
+ *
+ */
+void backlog_save_index(void)
+{
+	backlog_index.count++;
+	backlog_index.minutes = backlog_minutes();
+	uint32_t offset = BACKLOG_FLASH_OFFSET + (backlog_index.count % BACKLOG_INDEX_COPIES) * BACKLOG_INDEX_SIZE;
+	if (!api.system.flash.set(offset, (uint8_t *)&backlog_index, sizeof(backlog_index_s)))
+	{
+		MYLOG("BACKLOG", "Failed to save index");
+	}
+}
+
+/**
+ * @brief Read the backlog index from flash, called once in setup()
+ * 		Only the index copies are read, not the records
+ *
+ */
+void backlog_init(void)
+{
+	backlog_index_s copy;
+	bool found = false;
+	for (uint8_t idx = 0; idx < BACKLOG_INDEX_COPIES; idx++)
+	{
+		if (!api.system.flash.get(BACKLOG_FLASH_OFFSET + idx * BACKLOG_INDEX_SIZE, (uint8_t *)&copy, sizeof(backlog_index_s)))
+		{
+			continue;
+		}
+		if ((copy.magic != BACKLOG_MAGIC) || ((uint16_t)(copy.head - copy.tail) > BACKLOG_SLOTS))
+		{
+			continue;
+		}
+		if (!found || ((int32_t)(copy.count - backlog_index.count) > 0))
+		{
+			backlog_index = copy;
+			found = true;
+		}
+	}
+	if (!found)
+	{
+		memset(&backlog_index, 0, sizeof(backlog_index_s));
+		backlog_index.magic = BACKLOG_MAGIC;
+	}
+	backlog_clock = backlog_index.minutes;
+	backlog_clock_ms = millis();
+	MYLOG("BACKLOG", "%d records stored", backlog_count());
+
+	api.system.timer.create(RAK_TIMER_4, backlog_drain, RAK_TIMER_ONESHOT);
+}
+
+/**
+ * @brief Store a payload that could not be sent
+ * 		If the backlog is full, the oldest record is overwritten
+ *
+ * @param buffer payload
+ * @param size size of the payload
+ * @param fport fPort of the payload
+ * @return true payload stored
+ * @return false payload too large
+ */
+bool backlog_store(const uint8_t *buffer, uint8_t size, uint8_t fport)
+{
+	if (size > BACKLOG_DATA_SIZE)
+	{
+		MYLOG("BACKLOG", "Payload with %d bytes is too large for the backlog", size);
+		return false;
+	}
+	backlog_record_s record;
+	memset(&record, 0, sizeof(backlog_record_s));
+	record.seq = backlog_index.head;
+	record.fport = fport;
+	record.size = size;
+	record.minutes = backlog_minutes();
+	memcpy(record.data, buffer, size);
+	record.check = backlog_check(record);
+
+	uint32_t offset = BACKLOG_RECORD_OFFSET + (record.seq % BACKLOG_SLOTS) * BACKLOG_SLOT_SIZE;
+	if (!api.system.flash.set(offset, (uint8_t *)&record, sizeof(backlog_record_s)))
+	{
+		MYLOG("BACKLOG", "Failed to save record");
+		return false;
+	}
+	backlog_index.head++;
+	if (backlog_count() > BACKLOG_SLOTS)
+	{
+		backlog_index.tail++;
+	}
+	backlog_save_index();
+	MYLOG("BACKLOG", "Stored record %d, %d records in backlog", record.seq, backlog_count());
+	return true;
+}
+
+/**
+ * @brief Remember the payload of a regular uplink, it is stored in the backlog if the uplink fails
+ * 		The payload is copied, the payload buffers are reused for the next reading before the send callback
+ *
+ * @param buffer payload
+ * @param size size of the payload
+ * @param fport fPort of the payload
+ */
+void backlog_uplink(const uint8_t *buffer, uint8_t size, uint8_t fport)
+{
+	if (size > BACKLOG_DATA_SIZE)
+	{
+		MYLOG("BACKLOG", "Payload with %d bytes is too large for the backlog", size);
+		last_size = 0;
+		return;
+	}
+	memcpy(last_data, buffer, size);
+	last_size = size;
+	last_fport = fport;
+}
+
+/**
+ * @brief Start sending the backlog after the drain interval
+ *
+ */
+void backlog_start_drain(void)
+{
+	if ((backlog_count() != 0) && !backlog_in_flight)
+	{
+		api.system.timer.start(RAK_TIMER_4, custom_parameters.backlog_interval * 1000, NULL);
+	}
+}
+
+/**
+ * @brief Timer callback to send the oldest record
+ * 		One record per drain interval, the next one is sent after the send callback of this one.
+ * 		Records are sent on BACKLOG_FPORT with the original fPort and the age in minutes in front of the payload.
+ *
+ */
+void backlog_drain(void *)
+{
+	if ((backlog_count() == 0) || (api.lorawan.njs.get() == 0))
+	{
+		return;
+	}
+	if (sensor_active)
+	{
+		// Don't interfere with the regular uplink, try again later
+		api.system.timer.start(RAK_TIMER_4, custom_parameters.backlog_interval * 1000, NULL);
+		return;
+	}
+
+	backlog_record_s record;
+	uint32_t offset = BACKLOG_RECORD_OFFSET + (backlog_index.tail % BACKLOG_SLOTS) * BACKLOG_SLOT_SIZE;
+	if (!api.system.flash.get(offset, (uint8_t *)&record, sizeof(backlog_record_s)) ||
+		(record.seq != backlog_index.tail) || (record.size > BACKLOG_DATA_SIZE) || (record.check != backlog_check(record)))
+	{
+		MYLOG("BACKLOG", "Record %d is invalid, skip it", backlog_index.tail);
+		backlog_index.tail++;
+		backlog_save_index();
+		backlog_start_drain();
+		return;
+	}
+
+	uint8_t payload[BACKLOG_DATA_SIZE + 3];
+	uint32_t age = backlog_minutes() - record.minutes;
+	payload[0] = record.fport;
+	payload[1] = age > 0xFFFF ? 0xFF : (uint8_t)(age >> 8);
+	payload[2] = age > 0xFFFF ? 0xFF : (uint8_t)age;
+	memcpy(&payload[3], record.data, record.size);
+
+	set_uplink_dr(record.size + 3);
+	uint32_t toa = get_uplink_toa(api.lorawan.band.get(), api.lorawan.dr.get(), record.size + 3);
+	if ((airtime_state() != AIRTIME_OK) || !airtime_allows(toa))
+	{
+		// Airtime is needed for the current readings, try again later
+		api.system.timer.start(RAK_TIMER_4, custom_parameters.backlog_interval * 1000, NULL);
+		return;
+	}
+	if (api.lorawan.send(record.size + 3, payload, BACKLOG_FPORT, g_confirmed_mode, g_confirmed_retry))
+	{
+		MYLOG("BACKLOG", "Sending record %d, age %ld minutes", record.seq, age);
+		airtime_add(toa);
+		backlog_in_flight = true;
+	}
+	else
+	{
+		// Probably blocked by the duty cycle, try again later
+		MYLOG("BACKLOG", "Send failed, retry later");
+		api.system.timer.start(RAK_TIMER_4, custom_parameters.backlog_interval * 1000, NULL);
+	}
+}
+
+/**
+ * @brief Handle the result of an uplink, called from the send callback
+ * 		A sent record is removed from the backlog, a failed regular uplink is added to it.
+ * 		After a successful uplink the next record is sent after the drain interval.
+ *
+ * @param success true if the uplink was sent (and acknowledged in confirmed mode)
+ */
+void backlog_send_done(bool success)
+{
+	// Keep the backlog clock updated, it must be read at least once between two millis() overflows
+	backlog_minutes();
+
+	if (backlog_in_flight)
+	{
+		backlog_in_flight = false;
+		if (success)
+		{
+			backlog_index.tail++;
+			backlog_save_index();
+		}
+	}
+	else if (!success && (last_size != 0))
+	{
+		backlog_store(last_data, last_size, last_fport);
+	}
+	last_size = 0;
+
+	if (success)
+	{
+		backlog_start_drain();
+	}
+	else if (backlog_count() != 0)
+	{
+		// Link is down, the next successful uplink starts the drain again
+		MYLOG("BACKLOG", "Uplink failed, %d records in backlog", backlog_count());
+	}
+}
+
+/**
+ * @brief Add backlog AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_backlog_at(void)
+{
+	return api.system.atMode.add((char *)"BACKLOG",
+								 (char *)"Set/Get the interval between two backlog uplinks in seconds, CLR = delete the backlog",
+								 (char *)"Backlog", backlog_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for backlog AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int backlog_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d", cmd, custom_parameters.backlog_interval);
+		AT_PRINTF("%d of %d records stored", backlog_count(), BACKLOG_SLOTS);
+	}
+	else if (param->argc == 1 && !strcmp(param->argv[0], "CLR"))
+	{
+		backlog_index.tail = backlog_index.head;
+		backlog_save_index();
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		uint32_t new_interval = strtoul(param->argv[0], NULL, 10);
+		if ((new_interval < BACKLOG_MIN_INTERVAL) || (new_interval > 3600))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (new_interval != custom_parameters.backlog_interval)
+		{
+			custom_parameters.backlog_interval = new_interval;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
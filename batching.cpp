@@ -0,0 +1,214 @@
+/**
+ * @file batching.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Collect several compact readings and send them in one uplink
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Maximum number of readings in a batch, the count is sent in 4 bits */
+#define BATCH_MAX 15
+/** Bits of the batch header, number of readings, number of probes - 1 and 2 reserved bits */
+#define BATCH_HEADER_BITS 8
+
+static_assert(MB_MAX_PROBES <= 4, "Number of probes of a batch is sent in 2 bits");
+
+/** Stored readings in compact format, back-to-back without age */
+CompactPayload batch_data;
+/** millis() of each stored reading */
+uint32_t batch_times[BATCH_MAX];
+/** Number of stored readings */
+uint8_t batch_num = 0;
+/** Number of probes of the stored readings */
+uint8_t batch_probes = 1;
+
+// Forward declarations
+int batch_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Check if readings are collected instead of sent one by one
+ *
+ * @return true batching is enabled and possible
+ * @return false each reading is sent
+ */
+bool batch_enabled(void)
+{
+	// Stored readings are sent with the next reading even if batching was switched off
+	return ((airtime_batch_latency() != 0) || (batch_num != 0)) && airtime_compact() && (custom_parameters.send_interval != 0);
+}
+
+/**
+ * @brief Check if readings are stored in the batch
+ *
+ * @return true batch has readings to send
+ * @return false batch is empty
+ */
+bool batch_pending(void)
+{
+	return batch_num != 0;
+}
+
+/**
+ * @brief Get the payload size a batch may have
+ *
+ * @return uint16_t largest payload the current datarate allows, in LoRa P2P the largest compact payload
+ */
+uint16_t batch_limit(void)
+{
+	if (api.lorawan.nwm.get() != 1)
+	{
+		return COMPACT_MAX_SIZE;
+	}
+	uint16_t size = get_max_payload(api.lorawan.band.get(), api.lorawan.dr.get());
+	return ((size == 0) || (size > COMPACT_MAX_SIZE)) ? COMPACT_MAX_SIZE : size;
+}
+
+/**
+ * @brief Store a reading in the batch
+ * 		A reading with another number of probes than the stored readings starts a new batch
+ *
+ * @param reading reading in compact format
+ * @param probes number of probes in the reading
+ * @return true reading stored
+ * @return false batch is full
+ */
+bool batch_add(const CompactPayload &reading, uint8_t probes)
+{
+	if ((batch_num != 0) && (probes != batch_probes))
+	{
+		MYLOG("BATCH", "Number of probes changed, %d stored readings dropped", batch_num);
+		batch_num = 0;
+		batch_data.reset();
+	}
+	if ((batch_num >= BATCH_MAX) || !batch_data.addPayload(reading))
+	{
+		return false;
+	}
+	batch_probes = probes;
+	batch_times[batch_num++] = millis();
+	return true;
+}
+
+/**
+ * @brief Check if the batch has to be sent now
+ * 		It is sent if the next reading would not fit into the payload size of the current datarate,
+ * 		or if the oldest reading would be older than the maximum latency when the next reading is due
+ *
+ * @param next_reading time until the next reading in ms
+ * @return true send the batch now
+ * @return false wait for more readings
+ */
+bool batch_due(uint32_t next_reading)
+{
+	if (batch_num == 0)
+	{
+		return false;
+	}
+	if (batch_num >= BATCH_MAX)
+	{
+		return true;
+	}
+	uint16_t reading_bits = batch_data.getBitCount() / batch_num;
+	uint32_t next_bits = BATCH_HEADER_BITS + (uint32_t)(batch_num + 1) * (BATCH_AGE_BITS + reading_bits);
+	if ((next_bits + 7) / 8 > batch_limit())
+	{
+		return true;
+	}
+	return (millis() - batch_times[0]) + next_reading > (uint32_t)airtime_batch_latency() * 60000;
+}
+
+/**
+ * @brief Build the batch uplink and clear the batch
+ * 		Header with number of readings and probes, then each reading with its age in minutes
+ *
+ * @param payload payload for the batch uplink
+ */
+void batch_build(CompactPayload &payload)
+{
+	uint32_t now = millis();
+	uint16_t reading_bits = batch_data.getBitCount() / batch_num;
+
+	payload.reset();
+	payload.addBits(batch_num, 4);
+	payload.addBits(batch_probes - 1, 2);
+	payload.addBits(0, 2);
+	for (uint8_t idx = 0; idx < batch_num; idx++)
+	{
+		uint32_t age = (now - batch_times[idx] + 30000) / 60000;
+		uint32_t max_age = (1UL << BATCH_AGE_BITS) - 1;
+		payload.addBits(age > max_age ? max_age : age, BATCH_AGE_BITS);
+		for (uint16_t pos = 0; pos < reading_bits; pos += 16)
+		{
+			uint8_t bits = (reading_bits - pos) < 16 ? (reading_bits - pos) : 16;
+			payload.addBits(batch_data.getBits(idx * reading_bits + pos, bits), bits);
+		}
+	}
+	MYLOG("BATCH", "Sending %d readings in %d bytes", batch_num, payload.getSize());
+
+	batch_num = 0;
+	batch_data.reset();
+}
+
+/**
+ * @brief Add batching AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_batch_at(void)
+{
+	return api.system.atMode.add((char *)"BATCH",
+								 (char *)"Set/Get the maximum latency of batched readings in minutes, 0 = send each reading. Needs compact payload",
+								 (char *)"Batching", batch_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for batching AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int batch_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d", cmd, custom_parameters.batch_latency);
+		AT_PRINTF("Batching %s, %d readings stored, max %d bytes per uplink", batch_enabled() ? "active" : "inactive",
+				  batch_num, batch_limit());
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		uint32_t new_latency = strtoul(param->argv[0], NULL, 10);
+		// Ages are sent in minutes with BATCH_AGE_BITS
+		if (new_latency >= (1UL << BATCH_AGE_BITS))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (new_latency != custom_parameters.batch_latency)
+		{
+			custom_parameters.batch_latency = new_latency;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
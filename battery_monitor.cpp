@@ -0,0 +1,244 @@
+/**
+ * @file battery_monitor.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Battery voltage sampled while the device is idle, smoothed value and trend for the payload
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Interval of the battery samples in ms */
+#define BATT_SAMPLE_TIME 300000
+/** Time after the sensor supply was switched off before the battery is sampled in ms */
+#define BATT_HOLD_OFF 10000
+/** Time over which the slope of the smoothed voltage is measured in ms */
+#define BATT_TREND_TIME 3600000
+/** Number of ADC reads averaged for the first sample */
+#define BATT_FIRST_READS 4
+/** Fraction bits of the smoothed voltage and of the trend */
+#define BATT_FRAC_BITS 8
+/** Divisor of the voltage EMA, weight of a new sample is 1/8 */
+#define BATT_EMA_DIV 8
+/** Divisor of the trend EMA, weight of a new slope is 1/4 */
+#define BATT_TREND_DIV 4
+/** Voltage drop below the low battery level that doubles the send interval again in mV */
+#define BATT_STRETCH_STEP 100
+/** Maximum send interval multiplier is 1 << BATT_STRETCH_MAX */
+#define BATT_STRETCH_MAX 3
+
+/** Smoothed battery voltage in mV << BATT_FRAC_BITS */
+int32_t batt_ema = 0;
+/** Smoothed change of the battery voltage in mV per day << BATT_FRAC_BITS */
+int32_t batt_trend = 0;
+/** Smoothed battery voltage at the start of the slope measurement */
+int32_t batt_trend_ema = 0;
+/** millis() of the start of the slope measurement */
+uint32_t batt_trend_start = 0;
+/** millis() when the sensor supply was switched off */
+uint32_t batt_hold_off_start = 0;
+/** Number of send timer events since the last sensor reading */
+uint8_t batt_skipped = 0;
+
+// Forward declarations
+int batt_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Read the battery voltage
+ *
+ * @return int32_t battery voltage in mV
+ */
+int32_t battery_read(void)
+{
+	return (int32_t)(api.system.bat.get() * 1000.0);
+}
+
+/**
+ * @brief Take the first battery sample and start the sample timer on RAK_TIMER_3
+ * 		Called in setup() before the sensor is powered
+ *
+ */
+void battery_init(void)
+{
+	int32_t sum = 0;
+	for (uint8_t idx = 0; idx < BATT_FIRST_READS; idx++)
+	{
+		sum += battery_read();
+	}
+	batt_ema = (sum << BATT_FRAC_BITS) / BATT_FIRST_READS;
+	batt_trend_ema = batt_ema;
+	batt_trend_start = millis();
+	MYLOG("BATT", "Battery %ld mV", battery_mv());
+
+	api.system.timer.create(RAK_TIMER_3, battery_sample, RAK_TIMER_PERIODIC);
+	api.system.timer.start(RAK_TIMER_3, BATT_SAMPLE_TIME, NULL);
+}
+
+/**
+ * @brief Remember that the sensor supply was just switched off
+ * 		The battery voltage recovers for some seconds after the load is removed
+ *
+ */
+void battery_hold_off(void)
+{
+	batt_hold_off_start = millis();
+}
+
+/**
+ * @brief Timer callback to sample the battery voltage
+ * 		Skipped while the sensor supply is on and shortly after it was switched off,
+ * 		the voltage under load or while recovering would distort the trend
+ *
+ */
+void battery_sample(void *)
+{
+	if ((digitalRead(WB_IO2) == HIGH) || ((uint32_t)(millis() - batt_hold_off_start) < BATT_HOLD_OFF))
+	{
+		MYLOG("BATT", "Sensor supply active, skip battery sample");
+		return;
+	}
+
+	batt_ema += ((battery_read() << BATT_FRAC_BITS) - batt_ema) / BATT_EMA_DIV;
+
+	// Slope of the smoothed voltage over BATT_TREND_TIME, scaled to one day.
+	// The slope between two samples would mostly be ADC noise.
+	uint32_t now = millis();
+	if ((uint32_t)(now - batt_trend_start) >= BATT_TREND_TIME)
+	{
+		uint32_t elapsed = (now - batt_trend_start) / 1000;
+		int32_t slope = (int32_t)((int64_t)(batt_ema - batt_trend_ema) * 86400 / elapsed);
+		batt_trend += (slope - batt_trend) / BATT_TREND_DIV;
+		batt_trend_ema = batt_ema;
+		batt_trend_start = now;
+	}
+	MYLOG("BATT", "Battery %ld mV, trend %ld mV/day", battery_mv(), battery_trend());
+}
+
+/**
+ * @brief Get the smoothed battery voltage, no ADC read
+ *
+ * @return int32_t battery voltage in mV
+ */
+int32_t battery_mv(void)
+{
+	return (batt_ema + (1 << (BATT_FRAC_BITS - 1))) >> BATT_FRAC_BITS;
+}
+
+/**
+ * @brief Get the smoothed change of the battery voltage
+ *
+ * @return int32_t change in mV per day, negative while discharging
+ */
+int32_t battery_trend(void)
+{
+	return batt_trend / (1 << BATT_FRAC_BITS);
+}
+
+/**
+ * @brief Get the multiplier of the send interval
+ * 		The battery voltage expected in one day (voltage + trend) is compared with the low battery level.
+ * 		Below it the send interval is doubled, and doubled again for every BATT_STRETCH_STEP mV further down.
+ *
+ * @return uint8_t send interval multiplier, 1 = normal send interval
+ */
+uint8_t battery_interval_factor(void)
+{
+	if (custom_parameters.batt_low == 0)
+	{
+		return 1;
+	}
+	int32_t expected = battery_mv() + battery_trend();
+	if (expected >= custom_parameters.batt_low)
+	{
+		return 1;
+	}
+	int32_t steps = 1 + (custom_parameters.batt_low - expected) / BATT_STRETCH_STEP;
+	return 1 << (steps > BATT_STRETCH_MAX ? BATT_STRETCH_MAX : steps);
+}
+
+/**
+ * @brief Check if the sensor reading of this send timer event is skipped to save the battery
+ *
+ * @return true skip this reading
+ * @return false read the sensor and send
+ */
+bool battery_skip_reading(void)
+{
+	batt_skipped++;
+	if (batt_skipped < battery_interval_factor())
+	{
+		MYLOG("BATT", "Low battery, skip reading %d of %d", batt_skipped, battery_interval_factor());
+		return true;
+	}
+	batt_skipped = 0;
+	return false;
+}
+
+/**
+ * @brief Print the battery status
+ *
+ */
+void print_battery(void)
+{
+	AT_PRINTF("Battery %ld mV, trend %ld mV/day, send interval x%d", battery_mv(), battery_trend(), battery_interval_factor());
+}
+
+/**
+ * @brief Add battery AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_batt_at(void)
+{
+	return api.system.atMode.add((char *)"BATT",
+								 (char *)"Set/Get the low battery level in mV (0 = off), below it the send interval is stretched",
+								 (char *)"Battery Monitor", batt_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for battery AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int batt_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d", cmd, custom_parameters.batt_low);
+		print_battery();
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		uint32_t new_low = strtoul(param->argv[0], NULL, 10);
+		if ((new_low != 0) && ((new_low < 2000) || (new_low > 5000)))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (new_low != custom_parameters.batt_low)
+		{
+			custom_parameters.batt_low = new_low;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
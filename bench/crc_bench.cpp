@@ -0,0 +1,210 @@
+/**
+ * @file crc_bench.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host benchmark of the Modbus CRC engines
+ * 		Checks that the byte table and the nibble table engines of RUI3_ModbusCrc.h, which Modbus::updateCRC() uses,
+ * 		give the same CRC as the bit loop they replaced on random frames, then times them against each other.
+ * 		Build and run from the sketch folder:
+ * 		g++ -std=gnu++11 -O2 -o crc_bench bench/crc_bench.cpp && ./crc_bench
+ * 		Host timings only show the relative cost, the numbers on the MCU are different
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "../RUI3_ModbusCrc.h"
+
+/** Number of random frames of each size checked against the bit loop */
+#define BENCH_CHECK_FRAMES 100000
+/** Number of CRCs timed per engine and frame size */
+#define BENCH_RUNS 2000000
+
+/**
+ * @brief CRC of a frame with the bit loop of the original library, the reference
+ *
+ * @param buffer frame
+ * @param length frame size
+ * @return uint16_t CRC (not swapped)
+ */
+uint16_t crc_bits(const uint8_t *buffer, uint16_t length)
+{
+	uint16_t temp = 0xFFFF;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		temp = temp ^ buffer[i];
+		for (uint8_t j = 1; j <= 8; j++)
+		{
+			uint16_t flag = temp & 0x0001;
+			temp >>= 1;
+			if (flag)
+			{
+				temp ^= 0xA001;
+			}
+		}
+	}
+	return temp;
+}
+
+/**
+ * @brief CRC of a frame with the nibble table engine (MB_CRC_NIBBLE_TABLE)
+ *
+ * @param buffer frame
+ * @param length frame size
+ * @return uint16_t CRC (not swapped)
+ */
+uint16_t crc_nibble(const uint8_t *buffer, uint16_t length)
+{
+	uint16_t temp = 0xFFFF;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		temp = crcUpdateNibble(temp, buffer[i]);
+	}
+	return temp;
+}
+
+/**
+ * @brief CRC of a frame with the byte table engine (default)
+ *
+ * @param buffer frame
+ * @param length frame size
+ * @return uint16_t CRC (not swapped)
+ */
+uint16_t crc_byte(const uint8_t *buffer, uint16_t length)
+{
+	uint16_t temp = 0xFFFF;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		temp = crcUpdateByte(temp, buffer[i]);
+	}
+	return temp;
+}
+
+/** CRC engine under test */
+struct crc_engine_s
+{
+	const char *name;
+	uint16_t (*crc)(const uint8_t *buffer, uint16_t length);
+};
+
+const crc_engine_s engines[] = {
+	{"bit loop", crc_bits},
+	{"nibble table", crc_nibble},
+	{"byte table", crc_byte},
+};
+
+#define ENGINE_NUM (sizeof(engines) / sizeof(engines[0]))
+
+/** Frame sizes, a read request and the largest RTU frame */
+const uint16_t frame_sizes[] = {6, 64, 256};
+
+/** Largest Modbus RTU frame */
+#define FRAME_MAX 256
+
+/**
+ * @brief Fill a frame with random bytes
+ *
+ * @param buffer frame
+ * @param length frame size
+ */
+void random_frame(uint8_t *buffer, uint16_t length)
+{
+	for (uint16_t i = 0; i < length; i++)
+	{
+		buffer[i] = rand() & 0xFF;
+	}
+}
+
+/**
+ * @brief Check all engines against the bit loop
+ *
+ * @return int number of mismatches
+ */
+int check_engines(void)
+{
+	uint8_t frame[FRAME_MAX];
+	int failed = 0;
+
+	// Read holding registers 0 to 9 of slave 1, CRC is sent as C5 CD
+	const uint8_t request[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x0A};
+	for (uint8_t e = 0; e < ENGINE_NUM; e++)
+	{
+		if (engines[e].crc(request, sizeof(request)) != 0xCDC5)
+		{
+			printf("%s: wrong CRC of the reference frame\n", engines[e].name);
+			failed++;
+		}
+	}
+
+	for (uint32_t n = 0; n < BENCH_CHECK_FRAMES; n++)
+	{
+		uint16_t length = 1 + rand() % FRAME_MAX;
+		random_frame(frame, length);
+		uint16_t expected = crc_bits(frame, length);
+		for (uint8_t e = 1; e < ENGINE_NUM; e++)
+		{
+			if (engines[e].crc(frame, length) != expected)
+			{
+				printf("%s: CRC mismatch on a %d byte frame\n", engines[e].name, length);
+				failed++;
+			}
+		}
+	}
+	return failed;
+}
+
+/**
+ * @brief Time all engines on each frame size
+ *
+ */
+void time_engines(void)
+{
+	uint8_t frame[FRAME_MAX];
+	random_frame(frame, FRAME_MAX);
+	volatile uint16_t sink = 0;
+
+	printf("%-14s", "bytes/frame");
+	for (uint8_t e = 0; e < ENGINE_NUM; e++)
+	{
+		printf("%16s", engines[e].name);
+	}
+	printf("\n");
+
+	for (uint16_t size : frame_sizes)
+	{
+		printf("%-14d", size);
+		for (uint8_t e = 0; e < ENGINE_NUM; e++)
+		{
+			uint32_t runs = BENCH_RUNS / size;
+			auto start = std::chrono::steady_clock::now();
+			for (uint32_t n = 0; n < runs; n++)
+			{
+				// Change the frame a little, else the compiler may calculate the CRC only once
+				frame[0] = (uint8_t)n;
+				sink = sink ^ engines[e].crc(frame, size);
+			}
+			auto stop = std::chrono::steady_clock::now();
+			double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+			printf("%11.2f ns/B", ns / ((double)runs * size));
+		}
+		printf("\n");
+	}
+	(void)sink;
+}
+
+int main(void)
+{
+	srand(42);
+	int failed = check_engines();
+	printf("%s, %d CRCs do not match the bit loop\n\n", failed ? "FAIL" : "PASS", failed);
+	if (failed)
+	{
+		return 1;
+	}
+	time_engines();
+	return 0;
+}
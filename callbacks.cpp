@@ -28,6 +28,8 @@ void joinCallback(int32_t status)
 	{
 		MYLOG("JOIN-CB", "LoRaWan OTAA - joined! \r\n");
 		digitalWrite(LED_BLUE, LOW);
+		// Send the readings collected while not joined
+		backlog_start_drain();
 	}
 }
 
@@ -51,80 +53,8 @@ void receiveCallback(SERVICE_LORA_RECEIVE_T *data)
 		MYLOG("RX-CB", "MAC command");
 		return;
 	}
-	// Check for valid command sequence
-	if ((data->Buffer[0] == 0xAA) && (data->Buffer[1] == 0x55))
-	{
-		// Check for command
-		if (data->Buffer[2] == MB_FC_WRITE_MULTIPLE_COILS)
-		{
-			// Write coils, set flag for coils write
-			is_registers = false;
-			// Get slave address
-			coil_data.dev_addr = data->Buffer[3];
-			if ((coil_data.dev_addr > 0) && (coil_data.dev_addr < 17))
-			{
-				// Get number of coils
-				coil_data.num_coils = data->Buffer[4];
-
-				// Check for coil number in range (1 to 16)
-				if ((coil_data.num_coils > 0) && (coil_data.num_coils < 17))
-				{
-					// Save coil status
-					for (int idx = 0; idx < coil_data.num_coils; idx++)
-					{
-						coil_data.coils[idx] = data->Buffer[5 + idx];
-					}
-					// Start a timer to handle the incoming coil write request.
-					api.system.timer.start(RAK_TIMER_1, 100, NULL);
-				}
-				else
-				{
-					MYLOG("RX_CB", "Wrong num of coils");
-				}
-			}
-			else
-			{
-				MYLOG("RX_CB", "invalid slave address");
-			}
-		}
-		else if ((data->Buffer[2] == MB_FC_WRITE_REGISTER) || (data->Buffer[2] == MB_FC_WRITE_MULTIPLE_REGISTERS))
-		{
-			// Write registers, set flag for register write
-			is_registers = true;
-
-			// Get slave address
-			register_data.dev_addr = data->Buffer[3];
-			if ((register_data.dev_addr > 0) && (register_data.dev_addr < 17))
-			{
-				// Get start address of the registers
-				register_data.register_start_address = data->Buffer[4];
-
-				// Get number of coils
-				register_data.num_registers = data->Buffer[5];
-
-				// Save register status
-				for (int idx = 0; idx < register_data.num_registers * 2; idx = idx + 2)
-				{
-					register_data.registers[idx / 2] = (uint16_t)(data->Buffer[6 + idx]) << 8;
-					register_data.registers[idx / 2] |= (uint16_t)(data->Buffer[7 + idx]);
-				}
-				// Start a timer to handle the incoming register write request.
-				api.system.timer.start(RAK_TIMER_1, 100, NULL);
-			}
-			else
-			{
-				MYLOG("RX_CB", "invalid slave address");
-			}
-		}
-		else
-		{
-			MYLOG("RX_CB", "Wrong command");
-		}
-	}
-	else
-	{
-		MYLOG("RX_CB", "Wrong format");
-	}
+	// Decode and queue the command
+	downlink_decode(data->Buffer, data->BufferSize);
 }
 
 /**
@@ -136,6 +66,8 @@ void sendCallback(int32_t status)
 {
 	MYLOG("TX-CB", "TX status %d", status);
 	digitalWrite(LED_BLUE, LOW);
+	airtime_send_done(status == 0);
+	backlog_send_done(status == 0);
 }
 
 /**
@@ -152,49 +84,8 @@ void recv_cb(rui_lora_p2p_recv_t data)
 	}
 	Serial.print("\r\n");
 
-	// Check for valid command sequence
-	if ((data.Buffer[0] == 0xAA) && (data.Buffer[1] == 0x55))
-	{
-		// Check for command (only MB_FC_WRITE_MULTIPLE_COILS supported atm)
-		if (data.Buffer[2] == MB_FC_WRITE_MULTIPLE_COILS)
-		{
-			// Get slave address
-			coil_data.dev_addr = data.Buffer[3];
-			if ((coil_data.dev_addr > 0) && (coil_data.dev_addr < 17))
-			{
-				// Get number of coils
-				coil_data.num_coils = data.Buffer[4];
-
-				// Check for coil number in range (1 to 16)
-				if ((coil_data.num_coils > 0) && (coil_data.num_coils < 17))
-				{
-					// Save coil status
-					for (int idx = 0; idx < coil_data.num_coils; idx++)
-					{
-						coil_data.coils[idx] = data.Buffer[5 + idx];
-					}
-					// Start a timer to handle the incoming coil write request.
-					api.system.timer.start(RAK_TIMER_1, 100, NULL);
-				}
-				else
-				{
-					MYLOG("RX_CB", "Wrong num of coils");
-				}
-			}
-			else
-			{
-				MYLOG("RX_CB", "invalid slave address");
-			}
-		}
-		else
-		{
-			MYLOG("RX_CB", "Wrong command");
-		}
-	}
-	else
-	{
-		MYLOG("RX_CB", "Wrong format");
-	}
+	// Decode and queue the command
+	downlink_decode(data.Buffer, data.BufferSize);
 }
 
 /**
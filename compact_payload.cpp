@@ -0,0 +1,411 @@
+/**
+ * @file compact_payload.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Bit-packed payload with a fixed schema, the JavaScript decoder is generated from the same schema
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Version of the compact payload schema, first field of the payload. Increase it when the schema changes */
+#define COMPACT_VERSION 1
+
+/** Header of the compact payload, sent once */
+const compact_field_s compact_header[] = {
+	// name, source, bits, optional, min, step numerator, step denominator
+	{"version", COMPACT_SRC_VERSION, 4, 0, 0, 1, 1},
+	{"errors", COMPACT_SRC_ERRORS, MB_MAX_PROBES, 0, 0, 1, 1},
+	{"voltage", COMPACT_SRC_BATTERY, 8, 0, 250, 1, 100}, // 2.50 V to 5.05 V
+};
+
+/** Values of a probe, sent for each probe */
+const compact_field_s compact_probe[] = {
+	// name, source, bits, optional, min, step numerator, step denominator
+	{"moisture", SOIL_MOISTURE, 8, 1, 0, 1, 2},			   // 0 % to 127 % in 0.5 %
+	{"temperature", SOIL_TEMPERATURE, 11, 1, -400, 1, 10}, // -40.0 °C to 164.6 °C in 0.1 °C
+	{"conductivity", SOIL_CONDUCTIVITY, 11, 1, 0, 10, 1},  // 0 to 20460 uS/cm in 10 uS/cm
+	{"ph", SOIL_PH, 8, 1, 0, 1, 10},					   // 0.0 to 25.4 in 0.1
+	{"nitrogen", SOIL_NITROGEN, 10, 1, 0, 2, 1},		   // 0 to 2044 mg/kg in 2 mg/kg
+	{"phosphorus", SOIL_PHOSPHORUS, 10, 1, 0, 2, 1},	   // 0 to 2044 mg/kg in 2 mg/kg
+	{"potassium", SOIL_POTASSIUM, 10, 1, 0, 2, 1},		   // 0 to 2044 mg/kg in 2 mg/kg
+	{"salinity", SOIL_SALINITY, 11, 1, 0, 10, 1},		   // 0 to 20460 mg/L in 10 mg/L
+	{"tds", SOIL_TDS, 11, 1, 0, 10, 1},					   // 0 to 20460 mg/L in 10 mg/L
+};
+
+static_assert(MB_MAX_PROBES <= 8, "Error mask of the compact payload has one bit per probe");
+
+// Forward declarations
+int payload_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int decoder_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Clear the payload
+ *
+ */
+void CompactPayload::reset(void)
+{
+	memset(_buffer, 0, COMPACT_MAX_SIZE);
+	_bits = 0;
+}
+
+/**
+ * @brief Append a value, MSB first
+ *
+ * @param value value, only the lower bits are used
+ * @param bits number of bits
+ * @return true value added
+ * @return false payload is full
+ */
+bool CompactPayload::addBits(uint32_t value, uint8_t bits)
+{
+	if ((_bits + bits) > (COMPACT_MAX_SIZE * 8))
+	{
+		return false;
+	}
+	for (int8_t bit = bits - 1; bit >= 0; bit--)
+	{
+		if (((value >> bit) & 1) != 0)
+		{
+			_buffer[_bits >> 3] |= 0x80 >> (_bits & 7);
+		}
+		_bits++;
+	}
+	return true;
+}
+
+/**
+ * @brief Append all bits of another payload
+ *
+ * @param other payload to append
+ * @return true payload added
+ * @return false payload is full
+ */
+bool CompactPayload::addPayload(const CompactPayload &other)
+{
+	if ((_bits + other.getBitCount()) > (COMPACT_MAX_SIZE * 8))
+	{
+		return false;
+	}
+	for (uint16_t pos = 0; pos < other.getBitCount(); pos += 8)
+	{
+		uint8_t bits = (other.getBitCount() - pos) < 8 ? (other.getBitCount() - pos) : 8;
+		addBits(other.getBits(pos, bits), bits);
+	}
+	return true;
+}
+
+/**
+ * @brief Read bits of the payload, MSB first
+ *
+ * @param pos position of the first bit
+ * @param bits number of bits, max 32
+ * @return uint32_t value of the bits
+ */
+uint32_t CompactPayload::getBits(uint16_t pos, uint8_t bits) const
+{
+	uint32_t value = 0;
+	for (uint16_t bit = pos; bit < pos + bits; bit++)
+	{
+		value = (value << 1) | ((_buffer[bit >> 3] >> (7 - (bit & 7))) & 1);
+	}
+	return value;
+}
+
+/**
+ * @brief Append a value in the resolution and range of a schema field
+ * 		The value is rounded to the step of the field and limited to its range
+ *
+ * @param field schema field
+ * @param raw value in units of 1 / divisor
+ * @param divisor divisor of the raw value
+ * @return true value added
+ * @return false payload is full
+ */
+bool CompactPayload::addField(const compact_field_s &field, int32_t raw, uint16_t divisor)
+{
+	int64_t num = (int64_t)raw * field.step_den;
+	int64_t den = (int64_t)(divisor == 0 ? 1 : divisor) * field.step_num;
+	int64_t code = (num >= 0 ? (num + den / 2) / den : (num - den / 2) / den) - field.min;
+	int64_t max_code = (1L << field.bits) - (field.optional ? 2 : 1);
+	if (code < 0)
+	{
+		code = 0;
+	}
+	if (code > max_code)
+	{
+		code = max_code;
+	}
+	return addBits((uint32_t)code, field.bits);
+}
+
+/**
+ * @brief Append the missing value code of a schema field
+ *
+ * @param field schema field, must be optional
+ * @return true value added
+ * @return false payload is full
+ */
+bool CompactPayload::addMissing(const compact_field_s &field)
+{
+	return addBits((1UL << field.bits) - 1, field.bits);
+}
+
+/**
+ * @brief Get the number of bits of a part of the schema
+ *
+ * @param fields schema fields
+ * @param num number of fields
+ * @return uint16_t number of bits
+ */
+uint16_t compact_bits(const compact_field_s *fields, uint8_t num)
+{
+	uint16_t bits = 0;
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		bits += fields[idx].bits;
+	}
+	return bits;
+}
+
+/**
+ * @brief Start a compact payload with the header
+ *
+ * @param payload compact payload
+ * @param battery battery voltage in mV
+ * @param errors bit n is set if not all values of probe n were received
+ */
+void compact_add_header(CompactPayload &payload, int32_t battery, uint8_t errors)
+{
+	payload.reset();
+	for (uint8_t idx = 0; idx < REG_MAP_SIZE(compact_header); idx++)
+	{
+		const compact_field_s &field = compact_header[idx];
+		switch (field.source)
+		{
+		case COMPACT_SRC_VERSION:
+			payload.addField(field, COMPACT_VERSION, 1);
+			break;
+		case COMPACT_SRC_ERRORS:
+			payload.addField(field, errors, 1);
+			break;
+		case COMPACT_SRC_BATTERY:
+			payload.addField(field, battery, 1000);
+			break;
+		default:
+			payload.addMissing(field);
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Add the values of a probe to the compact payload
+ * 		Values that are not in the register map of the probe or were not received are sent as missing
+ *
+ * @param payload compact payload
+ * @param profile sensor profile of the probe
+ * @param data decoded values of the probe
+ */
+void compact_add_probe(CompactPayload &payload, const sensor_profile_s *profile, const soil_data_s &data)
+{
+	for (uint8_t idx = 0; idx < REG_MAP_SIZE(compact_probe); idx++)
+	{
+		const compact_field_s &field = compact_probe[idx];
+		bool added = false;
+		for (uint8_t entry = 0; entry < profile->map_size; entry++)
+		{
+			if ((profile->map[entry].field == field.source) && ((data.valid & (1UL << entry)) != 0))
+			{
+				payload.addField(field, data.*(soil_data_s::fields[field.source]), profile->map[entry].divisor);
+				added = true;
+				break;
+			}
+		}
+		if (!added)
+		{
+			payload.addMissing(field);
+		}
+	}
+}
+
+/**
+ * @brief Print the fields of a part of the schema as JavaScript array
+ *
+ * @param name name of the array
+ * @param fields schema fields
+ * @param num number of fields
+ */
+void print_decoder_fields(const char *name, const compact_field_s *fields, uint8_t num)
+{
+	AT_PRINTF("var %s = [", name);
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		AT_PRINTF("  [\"%s\", %d, %d, %ld, %d, %d],", fields[idx].name, fields[idx].bits, fields[idx].optional,
+				  fields[idx].min, fields[idx].step_num, fields[idx].step_den);
+	}
+	AT_PRINTF("];");
+}
+
+/**
+ * @brief Print the JavaScript decoder of the compact payload, generated from the schema
+ * 		Works with decodeUplink() of TTN and Chirpstack v4 and Decode() of Chirpstack v3.
+ * 		A batch is decoded into an array of readings, each with its age in minutes.
+ * 		A reading from the backlog is decoded like the original uplink, with the backlog age in minutes added
+ *
+ */
+void print_compact_decoder(void)
+{
+	AT_PRINTF("// Decoder for the compact payload of the RUI3 soil sensor, schema version %d, single reading on fPort %d, batch on fPort %d, backlog on fPort %d",
+			  COMPACT_VERSION, COMPACT_FPORT, BATCH_FPORT, BACKLOG_FPORT);
+	AT_PRINTF("// Generated with ATC+DECODER=?, fields are [name, bits, optional, min, step numerator, step denominator]");
+	print_decoder_fields("header", compact_header, REG_MAP_SIZE(compact_header));
+	print_decoder_fields("probe", compact_probe, REG_MAP_SIZE(compact_probe));
+	AT_PRINTF("function readBits(bytes, pos, bits) {");
+	AT_PRINTF("  var value = 0;");
+	AT_PRINTF("  for (var i = pos; i < pos + bits; i++) {");
+	AT_PRINTF("    value = value * 2 + ((bytes[i >> 3] >> (7 - (i & 7))) & 1);");
+	AT_PRINTF("  }");
+	AT_PRINTF("  return value;");
+	AT_PRINTF("}");
+	AT_PRINTF("function decodeFields(bytes, pos, fields, data, suffix) {");
+	AT_PRINTF("  for (var i = 0; i < fields.length; i++) {");
+	AT_PRINTF("    var f = fields[i];");
+	AT_PRINTF("    var code = readBits(bytes, pos, f[1]);");
+	AT_PRINTF("    pos += f[1];");
+	AT_PRINTF("    if (f[2] == 0 || code != Math.pow(2, f[1]) - 1) {");
+	AT_PRINTF("      data[f[0] + suffix] = (code + f[3]) * f[4] / f[5];");
+	AT_PRINTF("    }");
+	AT_PRINTF("  }");
+	AT_PRINTF("  return pos;");
+	AT_PRINTF("}");
+	AT_PRINTF("function decodeReading(bytes, pos, probes, data) {");
+	AT_PRINTF("  pos = decodeFields(bytes, pos, header, data, \"\");");
+	AT_PRINTF("  for (var n = 0; n < probes; n++) {");
+	AT_PRINTF("    pos = decodeFields(bytes, pos, probe, data, n == 0 ? \"\" : \"_\" + n);");
+	AT_PRINTF("  }");
+	AT_PRINTF("  return pos;");
+	AT_PRINTF("}");
+	AT_PRINTF("function decodeUplink(input) {");
+	AT_PRINTF("  var bytes = input.bytes;");
+	AT_PRINTF("  var data = {};");
+	AT_PRINTF("  if (input.fPort == %d && bytes.length > 3) {", BACKLOG_FPORT);
+	AT_PRINTF("    var result = decodeUplink({ fPort: bytes[0], bytes: bytes.slice(3) });");
+	AT_PRINTF("    if (result.data) {");
+	AT_PRINTF("      result.data.backlog_age = bytes[1] * 256 + bytes[2];");
+	AT_PRINTF("    }");
+	AT_PRINTF("    return result;");
+	AT_PRINTF("  }");
+	AT_PRINTF("  if (input.fPort == %d && bytes.length > 0 && (bytes[0] >> 4) == %d) {", COMPACT_FPORT, COMPACT_VERSION);
+	AT_PRINTF("    decodeReading(bytes, 0, Math.floor((bytes.length * 8 - %d) / %d), data);",
+			  compact_bits(compact_header, REG_MAP_SIZE(compact_header)), compact_bits(compact_probe, REG_MAP_SIZE(compact_probe)));
+	AT_PRINTF("    return { data: data };");
+	AT_PRINTF("  }");
+	AT_PRINTF("  if (input.fPort == %d && bytes.length > 0) {", BATCH_FPORT);
+	AT_PRINTF("    var count = bytes[0] >> 4;");
+	AT_PRINTF("    var probes = ((bytes[0] >> 2) & 3) + 1;");
+	AT_PRINTF("    var pos = 8;");
+	AT_PRINTF("    data.readings = [];");
+	AT_PRINTF("    for (var i = 0; i < count; i++) {");
+	AT_PRINTF("      var reading = { age: readBits(bytes, pos, %d) };", BATCH_AGE_BITS);
+	AT_PRINTF("      pos = decodeReading(bytes, pos + %d, probes, reading);", BATCH_AGE_BITS);
+	AT_PRINTF("      if (reading.version != %d) {", COMPACT_VERSION);
+	AT_PRINTF("        return { errors: [\"not a batch of schema version %d\"] };", COMPACT_VERSION);
+	AT_PRINTF("      }");
+	AT_PRINTF("      data.readings.push(reading);");
+	AT_PRINTF("    }");
+	AT_PRINTF("    return { data: data };");
+	AT_PRINTF("  }");
+	AT_PRINTF("  return { errors: [\"not a compact payload of schema version %d\"] };", COMPACT_VERSION);
+	AT_PRINTF("}");
+	AT_PRINTF("function Decode(fPort, bytes) {");
+	AT_PRINTF("  return decodeUplink({ fPort: fPort, bytes: bytes }).data;");
+	AT_PRINTF("}");
+}
+
+/**
+ * @brief Add payload format AT commands
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_payload_at(void)
+{
+	if (!api.system.atMode.add((char *)"PAYLOAD",
+							   (char *)"Set/Get the payload format 0 = Cayenne LPP, 1 = compact",
+							   (char *)"Payload Format", payload_handler,
+							   RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ))
+	{
+		return false;
+	}
+	return api.system.atMode.add((char *)"DECODER",
+								 (char *)"Get the JavaScript decoder of the compact payload",
+								 (char *)"Compact Payload Decoder", decoder_handler,
+								 RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for payload format AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int payload_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		uint16_t header_bits = compact_bits(compact_header, REG_MAP_SIZE(compact_header));
+		uint16_t probe_bits = compact_bits(compact_probe, REG_MAP_SIZE(compact_probe));
+		AT_PRINTF("%s=%d", cmd, custom_parameters.payload_format);
+		AT_PRINTF("Compact payload %d bits header, %d bits per probe, %d bytes with %d probes on fPort %d",
+				  header_bits, probe_bits, (header_bits + probe_bits * custom_parameters.probe_num + 7) / 8,
+				  custom_parameters.probe_num, COMPACT_FPORT);
+	}
+	else if (param->argc == 1)
+	{
+		if ((strlen(param->argv[0]) != 1) || (param->argv[0][0] < '0') || (param->argv[0][0] > '1'))
+		{
+			return AT_PARAM_ERROR;
+		}
+		uint8_t new_format = param->argv[0][0] - '0';
+		if (new_format != custom_parameters.payload_format)
+		{
+			custom_parameters.payload_format = new_format;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for the decoder AT command
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int decoder_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		print_compact_decoder();
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file compact_payload.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Bit-packed payload with a fixed schema, alternative to Cayenne LPP for small payload sizes
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#ifndef COMPACT_PAYLOAD_H
+#define COMPACT_PAYLOAD_H
+
+#include <Arduino.h>
+
+/** Maximum size of a compact payload in bytes, largest LoRaWAN payload */
+#define COMPACT_MAX_SIZE 242
+
+/** Value source schema version, sources below are the fields of the sensor values */
+#define COMPACT_SRC_VERSION 0x80
+/** Value source error mask of the probes */
+#define COMPACT_SRC_ERRORS 0x81
+/** Value source battery voltage */
+#define COMPACT_SRC_BATTERY 0x82
+
+/**
+ * @brief Field of the compact payload schema
+ * 		The value is sent as round(value / step) - min in bits bits, MSB first.
+ * 		step is step_num / step_den in the unit of the value.
+ */
+struct compact_field_s
+{
+	/** Name of the value in the decoded payload */
+	const char *name;
+	/** Source of the value, soil_field_e or one of COMPACT_SRC_xxx */
+	uint8_t source;
+	/** Number of bits */
+	uint8_t bits;
+	/** If not 0, the highest code of the field marks a missing value */
+	uint8_t optional;
+	/** Lowest value in steps */
+	int32_t min;
+	/** Numerator of the step */
+	uint16_t step_num;
+	/** Denominator of the step */
+	uint16_t step_den;
+};
+
+/** Bit-packed payload buffer */
+class CompactPayload
+{
+public:
+	CompactPayload(void) { reset(); }
+
+	void reset(void);
+	bool addBits(uint32_t value, uint8_t bits);
+	bool addField(const compact_field_s &field, int32_t raw, uint16_t divisor);
+	bool addMissing(const compact_field_s &field);
+	bool addPayload(const CompactPayload &other);
+	uint32_t getBits(uint16_t pos, uint8_t bits) const;
+	uint8_t *getBuffer(void) { return _buffer; }
+	uint8_t getSize(void) { return (_bits + 7) / 8; }
+	uint16_t getBitCount(void) const { return _bits; }
+
+private:
+	uint8_t _buffer[COMPACT_MAX_SIZE];
+	uint16_t _bits;
+};
+
+#endif
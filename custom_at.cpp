@@ -13,13 +13,13 @@
 /** Custom flash parameters */
 custom_param_s custom_parameters;
 
-/** Flag if test read is active */
-volatile bool test_running = false;
-
 // Forward declarations
 int interval_send_handler(SERIAL_PORT port, char *cmd, stParam *param);
 int status_handler(SERIAL_PORT port, char *cmd, stParam *param);
 int test_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int mbstat_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int warmup_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int probes_handler(SERIAL_PORT port, char *cmd, stParam *param);
 
 /**
  * @brief Add send interval AT command
@@ -98,27 +98,6 @@ int interval_send_handler(SERIAL_PORT port, char *cmd, stParam *param)
 	return AT_OK;
 }
 
-/**
- * @brief Timer callback to read the sensor
- *
- * @return * void
- */
-void test_read(void *)
-{
-	MYLOG("AT", "Start reading sensor"); // Try to read the sensor
-	uint8_t test = 0;
-	modbus_read_register(&test);
-	MYLOG("AT", "Finished reading sensor");
-
-	test_running = false;
-
-	// Shut down sensors and communication for lowest power consumption
-	digitalWrite(WB_IO2, LOW);
-	Serial1.end();
-	udrv_serial_deinit(SERIAL_UART1);
-	digitalWrite(LED_GREEN, LOW);
-}
-
 /**
  * @brief Add sensor test AT command
  *
@@ -127,9 +106,6 @@ void test_read(void *)
  */
 bool init_test_at(void)
 {
-	// Create a timer to read the sensor after 5 seconds power up.
-	api.system.timer.create(RAK_TIMER_3, test_read, RAK_TIMER_ONESHOT);
-
 	return api.system.atMode.add((char *)"STEST",
 								 (char *)"Read sensor",
 								 (char *)"Sensor Test", test_handler,
@@ -150,26 +126,233 @@ int test_handler(SERIAL_PORT port, char *cmd, stParam *param)
 {
 	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
 	{
-		if (sensor_active)
+		// Can't use delay here. The sensor cycle reads the sensor after 5 seconds of powerup
+		if (!sensor_cycle_start(true))
 		{
 			return AT_BUSY_ERROR;
 		}
 
-		if (test_running)
+		AT_PRINTF("Sensor Power Up");
+	}
+	else if (param->argc >= 1)
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
+
+/**
+ * @brief Add Modbus statistics AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_mbstat_at(void)
+{
+	return api.system.atMode.add((char *)"MBSTAT",
+								 (char *)"Get Modbus statistics, set uplink of statistics 0 = off, 1 = counters, 2 = counters and latency, CLR = reset statistics",
+								 (char *)"Modbus Statistics", mbstat_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for Modbus statistics AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int mbstat_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d", cmd, custom_parameters.mb_stats_uplink);
+		print_bus_stats();
+	}
+	else if (param->argc == 1 && !strcmp(param->argv[0], "CLR"))
+	{
+		master.clearStats();
+	}
+	else if (param->argc == 1)
+	{
+		if ((strlen(param->argv[0]) != 1) || (param->argv[0][0] < '0') || (param->argv[0][0] > '2'))
+		{
+			return AT_PARAM_ERROR;
+		}
+		uint8_t new_mode = param->argv[0][0] - '0';
+		if (new_mode != custom_parameters.mb_stats_uplink)
+		{
+			custom_parameters.mb_stats_uplink = new_mode;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
+
+/**
+ * @brief Add sensor warm-up AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_warmup_at(void)
+{
+	return api.system.atMode.add((char *)"WARMUP",
+								 (char *)"Set/Get sensor warm-up read interval in seconds (0 = fixed power up time) and tolerance in percent, e.g. 20:2",
+								 (char *)"Sensor Warm-up", warmup_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for sensor warm-up AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int warmup_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d:%d", cmd, custom_parameters.warmup_interval, custom_parameters.warmup_tolerance);
+		AT_PRINTF("Converged %d times, last %ld ms, min %ld ms, max %ld ms, avg %ld ms",
+				  warmup_stats.converged, warmup_stats.last_time, warmup_stats.min_time, warmup_stats.max_time,
+				  warmup_stats.converged == 0 ? 0 : warmup_stats.sum_time / warmup_stats.converged);
+		AT_PRINTF("Reached max power up time %d times", warmup_stats.timed_out);
+	}
+	else if (param->argc == 2)
+	{
+		for (int arg = 0; arg < 2; arg++)
+		{
+			for (int i = 0; i < strlen(param->argv[arg]); i++)
+			{
+				if (!isdigit(*(param->argv[arg] + i)))
+				{
+					return AT_PARAM_ERROR;
+				}
+			}
+		}
+
+		uint32_t new_interval = strtoul(param->argv[0], NULL, 10);
+		uint32_t new_tolerance = strtoul(param->argv[1], NULL, 10);
+
+		// Interval must allow at least two reads within the power up time
+		if ((new_interval != 0) && ((new_interval < 5) || (new_interval * 1000 * 2 > SENSOR_POWER_TIME)))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if ((new_tolerance < 1) || (new_tolerance > 50))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		if ((new_interval != custom_parameters.warmup_interval) || (new_tolerance != custom_parameters.warmup_tolerance))
+		{
+			custom_parameters.warmup_interval = new_interval;
+			custom_parameters.warmup_tolerance = new_tolerance;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
+
+/**
+ * @brief Add sensor probes AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_probes_at(void)
+{
+	return api.system.atMode.add((char *)"PROBES",
+								 (char *)"Set/Get the sensor probes as slave address (0 = address of the profile) and profile pairs, e.g. 1:0:2:0",
+								 (char *)"Sensor Probes", probes_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for sensor probes AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int probes_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		char list[MB_MAX_PROBES * 8 + 1] = {0};
+		for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
+		{
+			snprintf(&list[strlen(list)], sizeof(list) - strlen(list), "%s%d:%d", probe == 0 ? "" : ":",
+					 custom_parameters.probes[probe].address, custom_parameters.probes[probe].profile);
+		}
+		AT_PRINTF("%s=%s", cmd, list);
+		for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
+		{
+			const sensor_profile_s *profile = get_profile(custom_parameters.probes[probe].profile);
+			AT_PRINTF("Probe %d: address %d, profile %d %.*s, LPP channel offset %d", probe, custom_parameters.probes[probe].address,
+					  custom_parameters.probes[probe].profile, PROFILE_NAME_LEN, profile != NULL ? profile->name : "missing",
+					  probe * PROBE_CHANNEL_STEP);
+		}
+	}
+	else if ((param->argc >= 2) && (param->argc <= MB_MAX_PROBES * 2) && ((param->argc & 1) == 0))
+	{
+		if (sensor_active)
 		{
 			return AT_BUSY_ERROR;
 		}
-		
-		test_running = true;
 
-		AT_PRINTF("Sensor Power Up");
-		// MYLOG("AT", "Powerup sensor");
-		digitalWrite(WB_IO2, HIGH);
-		digitalWrite(LED_GREEN, HIGH); // Show powered up
-		// Can't use delay here. Use timer to read sensor after 5 seconds of powerup
-		api.system.timer.start(RAK_TIMER_3, 5000, NULL);
+		probe_s new_probes[MB_MAX_PROBES];
+		uint8_t new_num = param->argc / 2;
+		for (int arg = 0; arg < param->argc; arg++)
+		{
+			for (int i = 0; i < strlen(param->argv[arg]); i++)
+			{
+				if (!isdigit(*(param->argv[arg] + i)))
+				{
+					return AT_PARAM_ERROR;
+				}
+			}
+		}
+		for (uint8_t probe = 0; probe < new_num; probe++)
+		{
+			uint32_t address = strtoul(param->argv[probe * 2], NULL, 10);
+			uint32_t profile = strtoul(param->argv[probe * 2 + 1], NULL, 10);
+			if ((address > 247) || (profile >= PROFILE_NUM))
+			{
+				return AT_PARAM_ERROR;
+			}
+			new_probes[probe].address = address;
+			new_probes[probe].profile = profile;
+		}
+		if (!check_probes(new_probes, new_num))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		custom_parameters.probe_num = new_num;
+		memcpy(custom_parameters.probes, new_probes, new_num * sizeof(probe_s));
+		save_at_setting();
 	}
-	else if (param->argc >= 1)
+	else
 	{
 		return AT_PARAM_ERROR;
 	}
@@ -221,11 +404,31 @@ int status_handler(SERIAL_PORT port, char *cmd, stParam *param)
 		AT_PRINTF("Version: %s", api.system.firmwareVer.get().c_str());
 		AT_PRINTF("Send time: %d s", custom_parameters.send_interval / 1000);
 		AT_PRINTF("Power Up time: %d s", SENSOR_POWER_TIME / 1000);
+		if (custom_parameters.warmup_interval != 0)
+		{
+			AT_PRINTF("Warm-up read every %d s, tolerance %d %%", custom_parameters.warmup_interval, custom_parameters.warmup_tolerance);
+		}
+		if (custom_parameters.oversample_reads > 1)
+		{
+			AT_PRINTF("Oversampling %d reads, %s", custom_parameters.oversample_reads,
+					  custom_parameters.oversample_filter == OVERSAMPLE_MEDIAN ? "median" : "trimmed mean");
+		}
+		if (rbe_enabled())
+		{
+			AT_PRINTF("Report-by-exception, heartbeat %d min", custom_parameters.rbe_heartbeat);
+		}
+		print_battery();
+		if (custom_parameters.airtime_daily != 0)
+		{
+			print_airtime();
+		}
+		print_cycle_trace();
 		nw_mode = api.lorawan.nwm.get();
 		AT_PRINTF("Network mode %s", nwm_list[nw_mode]);
 		if (nw_mode == 1)
 		{
 			AT_PRINTF("Network %s", api.lorawan.njs.get() ? "joined" : "not joined");
+			AT_PRINTF("Backlog %d readings", backlog_count());
 			region_set = api.lorawan.band.get();
 			AT_PRINTF("Region: %d", region_set);
 			AT_PRINTF("Region: %s", regions_list[region_set]);
@@ -298,6 +501,7 @@ int status_handler(SERIAL_PORT port, char *cmd, stParam *param)
 bool get_at_setting(void)
 {
 	custom_param_s temp_params;
+	custom_param_s default_params;
 	uint8_t *flash_value = (uint8_t *)&temp_params.valid_flag;
 	if (!api.system.flash.get(0, flash_value, sizeof(custom_param_s)))
 	{
@@ -306,15 +510,96 @@ bool get_at_setting(void)
 	}
 	// MYLOG("AT_CMD", "Got flag: %02X", temp_params.valid_flag);
 	// MYLOG("AT_CMD", "Got send interval: %08X", temp_params.send_interval);
-	if (flash_value[0] != 0xAA)
+	if (flash_value[0] == SETTINGS_FLAG_V1)
+	{
+		// First layout, keep the send interval, everything else is new
+		// MYLOG("AT_CMD", "Old settings found, convert");
+		custom_parameters = default_params;
+		custom_parameters.send_interval = temp_params.send_interval;
+		save_at_setting();
+		return true;
+	}
+	if ((flash_value[0] != SETTINGS_FLAG) || (temp_params.param_size < offsetof(custom_param_s, send_interval) + sizeof(uint32_t)))
 	{
 		// MYLOG("AT_CMD", "No valid send interval found, set to default, read 0X%08X", temp_params.send_interval);
-		custom_parameters.valid_flag = 0xAA;
-		custom_parameters.send_interval = 0;
+		custom_parameters = default_params;
 		save_at_setting();
 		return false;
 	}
-	custom_parameters.send_interval = temp_params.send_interval;
+
+	// Take the saved fields, fields added by a newer firmware keep their default
+	uint16_t saved_size = temp_params.param_size;
+	if (saved_size > sizeof(custom_param_s))
+	{
+		saved_size = sizeof(custom_param_s);
+	}
+	custom_parameters = default_params;
+	memcpy(&custom_parameters, &temp_params, saved_size);
+	custom_parameters.param_size = sizeof(custom_param_s);
+	bool changed = saved_size != sizeof(custom_param_s);
+
+	// A corrupted probe list would index outside the profile table
+	if ((custom_parameters.probe_num < 1) || (custom_parameters.probe_num > MB_MAX_PROBES))
+	{
+		custom_parameters.probe_num = default_params.probe_num;
+		changed = true;
+	}
+	for (uint8_t probe = 0; probe < MB_MAX_PROBES; probe++)
+	{
+		if (custom_parameters.probes[probe].profile >= PROFILE_NUM)
+		{
+			custom_parameters.probes[probe] = default_params.probes[probe];
+			changed = true;
+		}
+	}
+	if ((custom_parameters.oversample_reads < 1) || (custom_parameters.oversample_reads > OVERSAMPLE_MAX) ||
+		(custom_parameters.oversample_filter > OVERSAMPLE_TRIMMED_MEAN) || (custom_parameters.oversample_spread > 1))
+	{
+		custom_parameters.oversample_reads = default_params.oversample_reads;
+		custom_parameters.oversample_filter = default_params.oversample_filter;
+		custom_parameters.oversample_spread = default_params.oversample_spread;
+		changed = true;
+	}
+	if ((custom_parameters.batt_low != 0) && ((custom_parameters.batt_low < 2000) || (custom_parameters.batt_low > 5000)))
+	{
+		custom_parameters.batt_low = default_params.batt_low;
+		changed = true;
+	}
+	if (custom_parameters.payload_format > PAYLOAD_COMPACT)
+	{
+		custom_parameters.payload_format = default_params.payload_format;
+		changed = true;
+	}
+	if (custom_parameters.batch_latency >= (1UL << BATCH_AGE_BITS))
+	{
+		custom_parameters.batch_latency = default_params.batch_latency;
+		changed = true;
+	}
+	if ((custom_parameters.backlog_interval < BACKLOG_MIN_INTERVAL) || (custom_parameters.backlog_interval > 3600))
+	{
+		custom_parameters.backlog_interval = default_params.backlog_interval;
+		changed = true;
+	}
+	if (custom_parameters.rbe_heartbeat > RBE_MAX_HEARTBEAT)
+	{
+		custom_parameters.rbe_heartbeat = default_params.rbe_heartbeat;
+		changed = true;
+	}
+	if (custom_parameters.dr_margin > 7)
+	{
+		custom_parameters.dr_margin = default_params.dr_margin;
+		changed = true;
+	}
+	if (custom_parameters.airtime_daily > AIRTIME_MAX_DAILY)
+	{
+		custom_parameters.airtime_daily = default_params.airtime_daily;
+		changed = true;
+	}
+
+	if (changed)
+	{
+		save_at_setting();
+	}
 
 	// MYLOG("AT_CMD", "Send interval found %ld", custom_parameters.send_interval);
 	return true;
@@ -0,0 +1,302 @@
+/**
+ * @file downlink.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Decoder of the AA 55 downlink commands, shared by LoRaWAN and LoRa P2P
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Size of the AA 55 <command> header */
+#define DL_HEADER_SIZE 3
+/** Largest number of coils of a write, one register holds 16 coils */
+#define DL_MAX_COILS (MB_WRITE_MAX_REGS * 16)
+
+/** Handler of a downlink command */
+struct dl_command_s
+{
+	/** Command byte after the AA 55 marker */
+	uint8_t command;
+	/** Smallest valid downlink size, including the header */
+	uint8_t min_size;
+	/**
+	 * Handler, called with the complete downlink, the data is only valid during the call
+	 * Returns false if the command is invalid
+	 */
+	bool (*handler)(const uint8_t *buffer, uint8_t size);
+};
+
+// Forward declarations
+bool dl_write_coil(const uint8_t *buffer, uint8_t size);
+bool dl_write_coils(const uint8_t *buffer, uint8_t size);
+bool dl_write_registers(const uint8_t *buffer, uint8_t size);
+bool dl_write_multiple(const uint8_t *buffer, uint8_t size);
+
+/** Supported downlink commands */
+const dl_command_s dl_commands[] = {
+	// command, min size, handler
+	{MB_FC_WRITE_COIL, 6, dl_write_coil},					 // AA 55 05 <address> <coil> <state>
+	{MB_FC_WRITE_REGISTER, 8, dl_write_registers},			 // AA 55 06 <address> <register> 01 <value>
+	{MB_FC_WRITE_MULTIPLE_COILS, 6, dl_write_coils},		 // AA 55 0F <address> <num> <state> ...
+	{MB_FC_WRITE_MULTIPLE_REGISTERS, 8, dl_write_registers}, // AA 55 10 <address> <register> <num> <value> ...
+	{DL_PROFILE_WRITE, 6, dl_profile_write},				 // AA 55 A0 <profile> <offset> <data>
+	{DL_PROFILE_SAVE, 4, dl_profile_save},					 // AA 55 A1 <profile>
+	{DL_PROBES, 5, dl_probes},								 // AA 55 A2 <address> <profile> ...
+	{DL_MB_WRITE, 9, dl_write_multiple},
+};
+
+/**
+ * @brief Check the slave address of a write
+ *
+ * @param dev_addr slave address
+ * @return true address of a slave, broadcasts are not answered and are not supported
+ * @return false invalid address
+ */
+bool dl_valid_address(uint8_t dev_addr)
+{
+	return (dev_addr > 0) && (dev_addr <= 247);
+}
+
+/**
+ * @brief Decode a downlink and queue the command
+ * 		The command is decoded in place from the radio buffer, all lengths are checked against the received size
+ *
+ * @param buffer received data
+ * @param size number of received bytes
+ */
+void downlink_decode(const uint8_t *buffer, uint8_t size)
+{
+	if ((size < DL_HEADER_SIZE) || (buffer[0] != 0xAA) || (buffer[1] != 0x55))
+	{
+		MYLOG("DL", "Wrong format");
+		return;
+	}
+	for (uint8_t idx = 0; idx < sizeof(dl_commands) / sizeof(dl_commands[0]); idx++)
+	{
+		const dl_command_s &entry = dl_commands[idx];
+		if (entry.command != buffer[2])
+		{
+			continue;
+		}
+		if ((size < entry.min_size) || !entry.handler(buffer, size))
+		{
+			MYLOG("DL", "Invalid command %02X, %d bytes", buffer[2], size);
+		}
+		return;
+	}
+	MYLOG("DL", "Wrong command %02X", buffer[2]);
+}
+
+/**
+ * @brief Decode a single coil write
+ * 		AA 55 05 <address> <coil> <state>, state 0 = off, else on
+ *
+ * @param buffer received data
+ * @param size number of received bytes
+ * @return true write is queued or rejected because the mailbox is full
+ * @return false invalid command
+ */
+bool dl_write_coil(const uint8_t *buffer, uint8_t size)
+{
+	if ((size != 6) || !dl_valid_address(buffer[3]))
+	{
+		return false;
+	}
+	if (!write_reserve(1))
+	{
+		return true;
+	}
+	write_cmd_s *cmd = write_slot(0);
+	cmd->dev_addr = buffer[3];
+	cmd->fct = MB_FC_WRITE_COIL;
+	cmd->start = buffer[4];
+	cmd->count = 1;
+	cmd->values[0] = buffer[5];
+	write_commit(1);
+	return true;
+}
+
+/**
+ * @brief Decode a write of several coils, starting at coil 0
+ * 		AA 55 0F <address> <num> <state 1> ... <state num>, one byte per coil, 0 = off, else on
+ *
+ * @param buffer received data
+ * @param size number of received bytes
+ * @return true write is queued or rejected because the mailbox is full
+ * @return false invalid command
+ */
+bool dl_write_coils(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t num = buffer[4];
+	if ((num == 0) || (num > DL_MAX_COILS) || (size != 5 + num) || !dl_valid_address(buffer[3]))
+	{
+		return false;
+	}
+	if (!write_reserve(1))
+	{
+		return true;
+	}
+	write_cmd_s *cmd = write_slot(0);
+	cmd->dev_addr = buffer[3];
+	cmd->fct = MB_FC_WRITE_MULTIPLE_COILS;
+	cmd->start = 0;
+	cmd->count = num;
+	// Coils are in 16 bit register in form of 7-0, 15-8
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		if (buffer[5 + idx] != 0)
+		{
+			cmd->values[idx / 16] |= 1 << ((idx + 8) % 16);
+		}
+	}
+	write_commit(1);
+	return true;
+}
+
+/**
+ * @brief Decode a write of one or several registers
+ * 		AA 55 <06|10> <address> <register> <num> <value 1 high> <value 1 low> ..., function code 06 writes one register
+ *
+ * @param buffer received data
+ * @param size number of received bytes
+ * @return true write is queued or rejected because the mailbox is full
+ * @return false invalid command
+ */
+bool dl_write_registers(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t num = buffer[5];
+	if ((num == 0) || (num > MB_WRITE_MAX_REGS) || ((buffer[2] == MB_FC_WRITE_REGISTER) && (num != 1)) ||
+		(size != 6 + num * 2) || !dl_valid_address(buffer[3]))
+	{
+		return false;
+	}
+	if (!write_reserve(1))
+	{
+		return true;
+	}
+	write_cmd_s *cmd = write_slot(0);
+	cmd->dev_addr = buffer[3];
+	cmd->fct = buffer[2];
+	cmd->start = buffer[4];
+	cmd->count = num;
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		cmd->values[idx] = ((uint16_t)buffer[6 + idx * 2] << 8) | buffer[7 + idx * 2];
+	}
+	write_commit(1);
+	return true;
+}
+
+/**
+ * @brief Decode an entry of the multiple write command
+ *
+ * @param entry entry <fc> <len> <address> <start hi> <start lo> <data>, its length is already checked
+ * @param cmd command to fill
+ * @return true entry is valid
+ * @return false invalid entry
+ */
+bool dl_write_entry(const uint8_t *entry, write_cmd_s *cmd)
+{
+	const uint8_t *data = &entry[5];
+	uint8_t data_len = entry[1] - 3;
+	cmd->fct = entry[0];
+	cmd->dev_addr = entry[2];
+	cmd->start = ((uint16_t)entry[3] << 8) | entry[4];
+
+	switch (cmd->fct)
+	{
+	case MB_FC_WRITE_COIL:
+		if (data_len == 1)
+		{
+			cmd->values[0] = data[0];
+			cmd->count = 1;
+		}
+		break;
+	case MB_FC_WRITE_REGISTER:
+		if (data_len == 2)
+		{
+			cmd->values[0] = ((uint16_t)data[0] << 8) | data[1];
+			cmd->count = 1;
+		}
+		break;
+	case MB_FC_WRITE_MULTIPLE_COILS:
+		// Number of coils, then the coils packed 8 per byte
+		if ((data[0] != 0) && (data[0] <= DL_MAX_COILS) && (data_len == 1 + (data[0] + 7) / 8))
+		{
+			for (uint8_t idx = 0; idx < data_len - 1; idx++)
+			{
+				cmd->values[idx / 2] |= (idx % 2) ? data[1 + idx] : (uint16_t)data[1 + idx] << 8;
+			}
+			cmd->count = data[0];
+		}
+		break;
+	case MB_FC_WRITE_MULTIPLE_REGISTERS:
+		if ((data_len >= 2) && (data_len <= MB_WRITE_MAX_REGS * 2) && ((data_len & 1) == 0))
+		{
+			for (uint8_t idx = 0; idx < data_len / 2; idx++)
+			{
+				cmd->values[idx] = ((uint16_t)data[idx * 2] << 8) | data[idx * 2 + 1];
+			}
+			cmd->count = data_len / 2;
+		}
+		break;
+	default:
+		break;
+	}
+	return (cmd->count != 0) && dl_valid_address(cmd->dev_addr);
+}
+
+/**
+ * @brief Decode the multiple write command
+ * 		AA 55 B0 followed by entries <fc> <len> <address> <start hi> <start lo> <data>, len is the number of bytes after len.
+ * 		The lengths of all entries are checked first, then the entries are decoded into the mailbox.
+ * 		The command is rejected as a whole if an entry is invalid
+ *
+ * @param buffer received data
+ * @param size number of received bytes
+ * @return true writes are queued or rejected because the mailbox is full
+ * @return false invalid command
+ */
+bool dl_write_multiple(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t num = 0;
+	uint16_t pos = DL_HEADER_SIZE;
+	while (pos < size)
+	{
+		// At least address, start and one data byte
+		if ((pos + 2 > size) || (buffer[pos + 1] < 4) || (pos + 2 + buffer[pos + 1] > size))
+		{
+			MYLOG("DL", "Entry at %d too short", pos);
+			return false;
+		}
+		pos += 2 + buffer[pos + 1];
+		num++;
+	}
+	if (num > MB_MAX_WRITES)
+	{
+		MYLOG("DL", "More than %d writes", MB_MAX_WRITES);
+		return false;
+	}
+	if (!write_reserve(num))
+	{
+		return true;
+	}
+
+	pos = DL_HEADER_SIZE;
+	for (uint8_t idx = 0; idx < num; idx++)
+	{
+		// Nothing is published before write_commit()
+		if (!dl_write_entry(&buffer[pos], write_slot(idx)))
+		{
+			MYLOG("DL", "Invalid write at %d", pos);
+			return false;
+		}
+		pos += 2 + buffer[pos + 1];
+	}
+	MYLOG("DL", "Received %d writes", num);
+	write_commit(num);
+	return true;
+}
@@ -1,7 +1,7 @@
 /**
  * @file dr_calculator.cpp
  * @author Bernd Giesecke (bernd@giesecke.tk)
- * @brief Calculate the required datarate from the payload size
+ * @brief Calculate the time on air and the best datarate for the payload size
  * @version 0.2
  * @date 2024-11-18
  *
@@ -10,44 +10,318 @@
  */
 #include "app.h"
 
-uint16_t in865_eu433_ru864_eu868_ps[16] = {51, 51, 51, 115, 242, 242, 242, 242, 0, 0, 0, 0, 0, 0, 0, 0};
-uint16_t au915_ps[16] = {51, 51, 51, 115, 242, 242, 242, 0, 53, 129, 242, 242, 242, 242, 0, 0};
-uint16_t cn470_kr920_ps[16] = {51, 51, 51, 115, 242, 242, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-uint16_t us915_ps[16] = {11, 53, 125, 242, 242, 0, 0, 0, 53, 129, 242, 242, 242, 242, 0, 0};
-uint16_t as923_ps[16] = {0, 0, 19, 61, 133, 250, 250, 250, 0, 0, 0, 0, 0, 0, 0, 0};
+/** Number of uplink datarates per region */
+#define DR_UPLINK_NUM 8
+/** Number of regions, same order as the RUI3 band setting */
+#define DR_REGION_NUM 13
+/** Spreading factor entry of a FSK datarate */
+#define DR_FSK 0
+/** LoRaWAN overhead of an uplink, MHDR 1, FHDR 7, FPort 1, MIC 4 bytes */
+#define DR_FRAME_OVERHEAD 13
+/** LoRa preamble symbols of an uplink */
+#define DR_PREAMBLE 8
+/** LoRa coding rate of an uplink, 1 = 4/5 */
+#define DR_CODING_RATE 1
+/** Symbol time from which the low datarate optimization is used in us */
+#define DR_LDRO_SYMBOL 16000
+/** FSK air time per byte at 50 kbps in us */
+#define DR_FSK_BYTE 160
+/** FSK overhead, 5 bytes preamble, 3 bytes sync word, 1 byte length, 2 bytes CRC */
+#define DR_FSK_OVERHEAD 11
 
-uint16_t *region_map[12] = {in865_eu433_ru864_eu868_ps, cn470_kr920_ps, in865_eu433_ru864_eu868_ps, in865_eu433_ru864_eu868_ps, in865_eu433_ru864_eu868_ps,
-							us915_ps, au915_ps, cn470_kr920_ps, as923_ps, as923_ps, as923_ps, as923_ps};
+/** Uplink datarate of a region */
+struct dr_desc_s
+{
+	/** Spreading factor, DR_FSK for FSK */
+	uint8_t sf;
+	/** Bandwidth in kHz / 125, 1 = 125 kHz, 2 = 250 kHz, 4 = 500 kHz */
+	uint8_t bw;
+	/** Maximum application payload size N, 0 = datarate not available for uplinks */
+	uint8_t max_size;
+};
+
+/** Uplink datarates of a region */
+struct dr_region_s
+{
+	/** Datarates 0 to 7 */
+	dr_desc_s dr[DR_UPLINK_NUM];
+	/** Maximum time on air of an uplink in ms, 0 = no dwell time limit */
+	uint16_t dwell_time;
+};
+
+/** EU868, EU433, RU864 */
+#define DR_EU868 {{12, 1, 51}, {11, 1, 51}, {10, 1, 51}, {9, 1, 115}, {8, 1, 222}, {7, 1, 222}, {7, 2, 222}, {DR_FSK, 0, 222}}
+/** IN865, no DR6 */
+#define DR_IN865 {{12, 1, 51}, {11, 1, 51}, {10, 1, 51}, {9, 1, 115}, {8, 1, 222}, {7, 1, 222}, {0, 0, 0}, {DR_FSK, 0, 222}}
+/** CN470, KR920 */
+#define DR_CN470 {{12, 1, 51}, {11, 1, 51}, {10, 1, 51}, {9, 1, 115}, {8, 1, 222}, {7, 1, 222}, {0, 0, 0}, {0, 0, 0}}
+/** US915 uplinks, DR5 and DR6 are LR-FHSS and not used */
+#define DR_US915 {{10, 1, 11}, {9, 1, 53}, {8, 1, 125}, {7, 1, 242}, {8, 4, 242}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}}
+/** AU915, LA915 without uplink dwell time, DR7 is LR-FHSS and not used */
+#define DR_AU915 {{12, 1, 51}, {11, 1, 51}, {10, 1, 51}, {9, 1, 115}, {8, 1, 222}, {7, 1, 222}, {8, 4, 222}, {0, 0, 0}}
+/** AS923 with uplink dwell time, DR0 and DR1 are not available */
+#define DR_AS923 {{0, 0, 0}, {0, 0, 0}, {10, 1, 11}, {9, 1, 53}, {8, 1, 125}, {7, 1, 242}, {7, 2, 242}, {DR_FSK, 0, 242}}
+
+/** Uplink datarates per region, LoRaWAN Regional Parameters RP002-1.0.3 */
+constexpr dr_region_s dr_regions[DR_REGION_NUM] = {
+	{DR_EU868, 0},	 // 0 EU433
+	{DR_CN470, 0},	 // 1 CN470
+	{DR_EU868, 0},	 // 2 RU864
+	{DR_IN865, 0},	 // 3 IN865
+	{DR_EU868, 0},	 // 4 EU868
+	{DR_US915, 400}, // 5 US915
+	{DR_AU915, 0},	 // 6 AU915
+	{DR_CN470, 0},	 // 7 KR920
+	{DR_AS923, 400}, // 8 AS923-1
+	{DR_AS923, 400}, // 9 AS923-2
+	{DR_AS923, 400}, // 10 AS923-3
+	{DR_AS923, 400}, // 11 AS923-4
+	{DR_AU915, 0},	 // 12 LA915
+};
+
+/** Datarate of the link, set by ADR or with AT+DR, lower datarates have more link margin */
+uint8_t dr_link = 0;
+/** Datarate last selected for an uplink, 0xFF = none yet */
+uint8_t dr_selected = 0xFF;
+/** Size of the last uplink */
+uint16_t dr_last_size = 0;
+
+// Forward declarations
+int dr_margin_handler(SERIAL_PORT port, char *cmd, stParam *param);
 
 /**
- * @brief Get the minimum datarate based on region and required payload size
+ * @brief Get the datarate descriptor
  *
  * @param region LoRaWAN region
  *               0 = EU433, 1 = CN470, 2 = RU864, 3 = IN865, 4 = EU868, 5 = US915,
- *               6 = AU915, 7 = KR920, 8 = AS923-1 , 9 = AS923-2 , 10 = AS923-3 , 11 = AS923-4)
- * @param payload_size required payload size
- * @return uint8_t datarate 0 to 15 or 16 if no matching DR could be found
- */
-uint8_t get_min_dr(uint16_t region, uint16_t payload_size)
-{
-	// MYLOG("DR_CALC", "Got region %d and payload size %d", region, payload_size);
-	// Get the datarate - payload size map
-	uint16_t *region_ps = region_map[region];
-	// MYLOG("DR_CALC", "Available packet sizes:");
-	// for (int idx = 0; idx < 15; idx++)
-	// {
-	// 	Serial.printf("DR %d max size %d\n", idx, region_ps[idx]);
-	// }
-	// Go through all payload sizes
-	for (uint8_t idx = 0; idx < 16; idx++)
-	{
-		// Check if dr payload size is larger than requested payload size
-		if (payload_size < region_ps[idx])
+ *               6 = AU915, 7 = KR920, 8 = AS923-1 , 9 = AS923-2 , 10 = AS923-3 , 11 = AS923-4, 12 = LA915
+ * @param datarate datarate
+ * @return const dr_desc_s* datarate descriptor, NULL if the datarate is not available for uplinks
+ */
+const dr_desc_s *get_dr_desc(uint16_t region, uint8_t datarate)
+{
+	if ((region >= DR_REGION_NUM) || (datarate >= DR_UPLINK_NUM) || (dr_regions[region].dr[datarate].max_size == 0))
+	{
+		return NULL;
+	}
+	return &dr_regions[region].dr[datarate];
+}
+
+/**
+ * @brief Calculate the time on air of a LoRa packet, Semtech AN1200.13
+ * 		Explicit header, CRC on, coding rate 4/5, 8 preamble symbols as used for LoRaWAN uplinks
+ *
+ * @param sf spreading factor 7 to 12
+ * @param bw bandwidth in kHz / 125
+ * @param phy_size size of the PHY payload
+ * @return uint32_t time on air in us
+ */
+uint32_t get_lora_toa(uint8_t sf, uint8_t bw, uint16_t phy_size)
+{
+	// Symbol time is 2^SF / BW, always an integer number of us for 125, 250 and 500 kHz
+	uint32_t symbol = (1UL << sf) * 8 / bw;
+	int32_t ldro = (symbol >= DR_LDRO_SYMBOL) ? 1 : 0;
+	int32_t bits = 8 * phy_size - 4 * sf + 28 + 16;
+	int32_t den = 4 * (sf - 2 * ldro);
+	int32_t blocks = (bits > 0) ? (bits + den - 1) / den : 0;
+	uint32_t payload_symbols = 8 + blocks * (DR_CODING_RATE + 4);
+	// Preamble has DR_PREAMBLE + 4.25 symbols
+	return (DR_PREAMBLE * 4 + 17) * symbol / 4 + payload_symbols * symbol;
+}
+
+/**
+ * @brief Calculate the time on air of an uplink
+ *
+ * @param region LoRaWAN region, same as for get_dr_desc()
+ * @param datarate datarate
+ * @param payload_size application payload size
+ * @return uint32_t time on air in us, 0 if the datarate is not available
+ */
+uint32_t get_uplink_toa(uint16_t region, uint8_t datarate, uint16_t payload_size)
+{
+	const dr_desc_s *desc = get_dr_desc(region, datarate);
+	if (desc == NULL)
+	{
+		return 0;
+	}
+	uint16_t phy_size = payload_size + DR_FRAME_OVERHEAD;
+	if (desc->sf == DR_FSK)
+	{
+		return (phy_size + DR_FSK_OVERHEAD) * DR_FSK_BYTE;
+	}
+	return get_lora_toa(desc->sf, desc->bw, phy_size);
+}
+
+/**
+ * @brief Check if a datarate can carry the payload
+ *
+ * @param region LoRaWAN region, same as for get_dr_desc()
+ * @param datarate datarate
+ * @param payload_size application payload size
+ * @return true payload fits and the time on air is within the dwell time of the region
+ * @return false datarate can not be used
+ */
+bool dr_fits(uint16_t region, uint8_t datarate, uint16_t payload_size)
+{
+	const dr_desc_s *desc = get_dr_desc(region, datarate);
+	if ((desc == NULL) || (payload_size > desc->max_size))
+	{
+		return false;
+	}
+	uint16_t dwell_time = dr_regions[region].dwell_time;
+	return (dwell_time == 0) || (get_uplink_toa(region, datarate, payload_size) <= (uint32_t)dwell_time * 1000);
+}
+
+/**
+ * @brief Get the datarate with the lowest time on air that keeps the link margin
+ * 		Only datarates up to the link datarate - margin are used. If none of them can carry the payload,
+ * 		the lowest faster datarate that can carry it is used.
+ *
+ * @param region LoRaWAN region, same as for get_dr_desc()
+ * @param payload_size application payload size
+ * @param max_dr highest datarate that keeps the link margin
+ * @return uint8_t datarate 0 to 7 or 16 if no matching DR could be found
+ */
+uint8_t get_best_dr(uint16_t region, uint16_t payload_size, uint8_t max_dr)
+{
+	uint8_t best = 16;
+	uint32_t best_toa = 0;
+	for (uint8_t datarate = 0; (datarate <= max_dr) && (datarate < DR_UPLINK_NUM); datarate++)
+	{
+		if (!dr_fits(region, datarate, payload_size))
+		{
+			continue;
+		}
+		uint32_t toa = get_uplink_toa(region, datarate, payload_size);
+		if ((best == 16) || (toa < best_toa))
+		{
+			best = datarate;
+			best_toa = toa;
+		}
+	}
+	for (uint8_t datarate = max_dr + 1; (best == 16) && (datarate < DR_UPLINK_NUM); datarate++)
+	{
+		if (dr_fits(region, datarate, payload_size))
+		{
+			best = datarate;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Select the datarate for an uplink in the current region
+ * 		A datarate that was not set by this function was set by ADR or the user and is taken as the link datarate
+ *
+ * @param payload_size application payload size
+ * @return uint8_t datarate 0 to 7 or 16 if no matching DR could be found, then the datarate is not changed
+ */
+uint8_t set_uplink_dr(uint16_t payload_size)
+{
+	uint16_t region = api.lorawan.band.get();
+	uint8_t current = api.lorawan.dr.get();
+	if (current != dr_selected)
+	{
+		dr_link = current;
+	}
+	uint8_t margin = custom_parameters.dr_margin;
+	uint8_t datarate = get_best_dr(region, payload_size, dr_link > margin ? dr_link - margin : 0);
+	dr_last_size = payload_size;
+	if (datarate == 16)
+	{
+		MYLOG("DR_CALC", "No matching DR found for %d bytes", payload_size);
+		dr_selected = current;
+		return datarate;
+	}
+	MYLOG("DR_CALC", "Link DR %d, margin %d, %d bytes, DR %d, time on air %ld us", dr_link, margin, payload_size, datarate,
+		  get_uplink_toa(region, datarate, payload_size));
+	if (datarate != current)
+	{
+		api.lorawan.dr.set(datarate);
+	}
+	dr_selected = datarate;
+	return datarate;
+}
+
+/**
+ * @brief Get the largest payload size for a datarate
+ *
+ * @param region LoRaWAN region, same as for get_dr_desc()
+ * @param datarate datarate 0 to 15
+ * @return uint16_t payload size in bytes, 0 if the datarate is not available for uplinks in the region
+ */
+uint16_t get_max_payload(uint16_t region, uint8_t datarate)
+{
+	const dr_desc_s *desc = get_dr_desc(region, datarate);
+	return (desc != NULL) ? desc->max_size : 0;
+}
+
+/**
+ * @brief Add datarate margin AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_dr_margin_at(void)
+{
+	return api.system.atMode.add((char *)"DRMARGIN",
+								 (char *)"Set/Get the number of datarates below the link datarate kept as link margin",
+								 (char *)"Datarate Margin", dr_margin_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for datarate margin AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int dr_margin_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d", cmd, custom_parameters.dr_margin);
+		if (api.lorawan.nwm.get() == 1)
+		{
+			uint16_t region = api.lorawan.band.get();
+			AT_PRINTF("Link DR %d, time on air of %d bytes:", dr_link, dr_last_size);
+			for (uint8_t datarate = 0; datarate < DR_UPLINK_NUM; datarate++)
+			{
+				if (dr_fits(region, datarate, dr_last_size))
+				{
+					uint32_t toa = get_uplink_toa(region, datarate, dr_last_size);
+					AT_PRINTF("DR %d: %ld.%ld ms", datarate, toa / 1000, (toa % 1000) / 100);
+				}
+			}
+		}
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
 		{
-			// Found a datarate that can carry the payload size
-			return idx;
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				return AT_PARAM_ERROR;
+			}
 		}
+		uint32_t new_margin = strtoul(param->argv[0], NULL, 10);
+		if (new_margin >= DR_UPLINK_NUM)
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (new_margin != custom_parameters.dr_margin)
+		{
+			custom_parameters.dr_margin = new_margin;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
 	}
-	// No matching datarate for the payload size found
-	return 16;
+	return AT_OK;
 }
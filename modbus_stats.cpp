@@ -0,0 +1,140 @@
+/**
+ * @file modbus_stats.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Report the Modbus bus statistics over AT commands and uplink
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+static_assert(MB_HIST_BUCKETS == LPP_MB_HIST_SIZE, "Histogram uplink needs one byte per bucket");
+
+/** Bus totals at the time of the last uplink, the uplink reports the changes since then */
+modbus_stats_t last_reported;
+
+/**
+ * @brief Sum up the statistics of all slaves and function codes
+ *
+ * @param total structure for the sums
+ * @return uint16_t largest smoothed response time of all slaves in ms
+ */
+uint16_t sum_bus_stats(modbus_stats_t &total)
+{
+	uint16_t response_time = 0;
+	memset(&total, 0, sizeof(modbus_stats_t));
+	for (uint8_t idx = 0; idx < MB_RTT_SLOTS; idx++)
+	{
+		const modbus_slot_t *slot = master.getSlot(idx);
+		if (slot == NULL)
+		{
+			continue;
+		}
+		total.u32requests += slot->stats.u32requests;
+		total.u32answers += slot->stats.u32answers;
+		total.u32timeouts += slot->stats.u32timeouts;
+		total.u32crcErrors += slot->stats.u32crcErrors;
+		total.u32exceptions += slot->stats.u32exceptions;
+		total.u32overflows += slot->stats.u32overflows;
+		for (uint8_t bucket = 0; bucket < MB_HIST_BUCKETS; bucket++)
+		{
+			total.au32latency[bucket] += slot->stats.au32latency[bucket];
+		}
+		if ((slot->rtt.u16ewma >> 3) > response_time)
+		{
+			response_time = slot->rtt.u16ewma >> 3;
+		}
+	}
+	return response_time;
+}
+
+/**
+ * @brief Get the change of a counter since the last report
+ *
+ * @param now current counter value
+ * @param last counter value at the last report
+ * @return uint32_t change, the current value if the counters were reset in between
+ */
+uint32_t stats_delta(uint32_t now, uint32_t last)
+{
+	return (now >= last) ? (now - last) : now;
+}
+
+/**
+ * @brief Print the statistics of all slaves and function codes
+ *
+ */
+void print_bus_stats(void)
+{
+	AT_PRINTF("Frames out %ld, in %ld, errors %ld, slot evictions %ld", master.getOutCnt(), master.getInCnt(), master.getErrCnt(),
+			  master.getSlotEvictions());
+	for (uint8_t idx = 0; idx < MB_RTT_SLOTS; idx++)
+	{
+		const modbus_slot_t *slot = master.getSlot(idx);
+		if (slot == NULL)
+		{
+			continue;
+		}
+		AT_PRINTF("Slave %d FC %d: req %ld ok %ld tout %ld crc %ld exc %ld ovf %ld",
+				  slot->u8id, slot->u8fct,
+				  slot->stats.u32requests, slot->stats.u32answers, slot->stats.u32timeouts,
+				  slot->stats.u32crcErrors, slot->stats.u32exceptions, slot->stats.u32overflows);
+		AT_PRINTF("  RTT avg %d ms, worst %d ms, time-out %d ms",
+				  slot->rtt.u16ewma >> 3, slot->rtt.u16worst, master.getAdaptiveTimeOut(slot->u8id, slot->u8fct));
+		AT_PRINTF("  <%d:%ld <%d:%ld <%d:%ld <%d:%ld <%d:%ld <%d:%ld <%d:%ld >=%d:%ld",
+				  MB_HIST_FIRST, slot->stats.au32latency[0],
+				  MB_HIST_FIRST << 1, slot->stats.au32latency[1],
+				  MB_HIST_FIRST << 2, slot->stats.au32latency[2],
+				  MB_HIST_FIRST << 3, slot->stats.au32latency[3],
+				  MB_HIST_FIRST << 4, slot->stats.au32latency[4],
+				  MB_HIST_FIRST << 5, slot->stats.au32latency[5],
+				  MB_HIST_FIRST << 6, slot->stats.au32latency[6],
+				  MB_HIST_FIRST << 6, slot->stats.au32latency[7]);
+	}
+}
+
+/**
+ * @brief Add the bus statistics since the last uplink to the payload
+ *
+ * @param mode 1 = counters, 2 = counters and response time histogram
+ */
+void add_bus_stats(uint8_t mode)
+{
+	modbus_stats_t total;
+	uint16_t response_time = sum_bus_stats(total);
+
+	uint32_t requests = stats_delta(total.u32requests, last_reported.u32requests);
+	uint32_t timeouts = stats_delta(total.u32timeouts, last_reported.u32timeouts);
+	uint32_t crc_errors = stats_delta(total.u32crcErrors, last_reported.u32crcErrors);
+	uint32_t exceptions = stats_delta(total.u32exceptions, last_reported.u32exceptions);
+	uint32_t overflows = stats_delta(total.u32overflows, last_reported.u32overflows);
+
+	g_solution_data.addModbusStats(LPP_CHANNEL_MB_STATS,
+								   requests > 0xFFFF ? 0xFFFF : requests,
+								   timeouts > 0xFFFF ? 0xFFFF : timeouts,
+								   crc_errors > 0xFFFF ? 0xFFFF : crc_errors,
+								   exceptions > 0xFF ? 0xFF : exceptions,
+								   overflows > 0xFF ? 0xFF : overflows,
+								   response_time);
+
+	if (mode > 1)
+	{
+		uint32_t delta[MB_HIST_BUCKETS];
+		uint32_t samples = 0;
+		for (uint8_t bucket = 0; bucket < MB_HIST_BUCKETS; bucket++)
+		{
+			delta[bucket] = stats_delta(total.au32latency[bucket], last_reported.au32latency[bucket]);
+			samples += delta[bucket];
+		}
+		uint8_t shares[MB_HIST_BUCKETS];
+		for (uint8_t bucket = 0; bucket < MB_HIST_BUCKETS; bucket++)
+		{
+			shares[bucket] = (samples == 0) ? 0 : (uint8_t)((delta[bucket] * 100 + samples / 2) / samples);
+		}
+		g_solution_data.addModbusHistogram(LPP_CHANNEL_MB_HIST, shares);
+	}
+
+	last_reported = total;
+}
@@ -0,0 +1,230 @@
+/**
+ * @file modbus_write.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Coil and register writes from downlinks, several writes are executed in one bus session
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Number of commands the mailbox can hold, must be a power of 2 */
+#define WRITE_MAILBOX_SIZE 16
+
+static_assert((WRITE_MAILBOX_SIZE & (WRITE_MAILBOX_SIZE - 1)) == 0, "Mailbox size must be a power of 2");
+static_assert(MB_MAX_WRITES <= 8, "Write result has one bit per write");
+
+/**
+ * Mailbox between the radio callbacks and the Modbus worker.
+ * The callbacks are the only producer and write only write_head, the worker is the only consumer and writes only write_tail.
+ * The indexes run freely, the number of commands in the mailbox is write_head - write_tail.
+ */
+write_cmd_s write_mailbox[WRITE_MAILBOX_SIZE];
+/** Index of the next free command, written by the callbacks */
+volatile uint8_t write_head = 0;
+/** Index of the next command for the worker, written by the worker */
+volatile uint8_t write_tail = 0;
+/** Number of commands rejected because the mailbox was full, runs freely, written by the callbacks */
+volatile uint8_t write_rejected = 0;
+/** Number of rejected commands that were reported */
+uint8_t write_rejected_reported = 0;
+
+/** Writes of the running session, executed in the order they were received */
+modbus_transaction_t write_transactions[MB_MAX_WRITES];
+/** Data of each write */
+int16_t write_values[MB_MAX_WRITES][MB_WRITE_MAX_REGS];
+/** Number of writes in the session */
+uint8_t write_num = 0;
+/** Number of writes since the last uplink, 0 = no result to send */
+uint8_t write_result_num = 0;
+/** Results since the last uplink, bit n is set if write n was acknowledged */
+uint8_t write_result_ok = 0;
+
+/**
+ * @brief Get the number of registers of a write
+ *
+ * @param cmd write command
+ * @return uint16_t number of registers, coils are packed 16 per register
+ */
+uint16_t write_regs_num(const write_cmd_s &cmd)
+{
+	switch (cmd.fct)
+	{
+	case MB_FC_WRITE_MULTIPLE_COILS:
+		return (cmd.count + 15) / 16;
+	case MB_FC_WRITE_COIL:
+	case MB_FC_WRITE_REGISTER:
+		return 1;
+	default:
+		return cmd.count;
+	}
+}
+
+/**
+ * @brief Reserve room for commands in the mailbox, called from the radio callbacks
+ * 		The commands are decoded directly into the slots from write_slot() and published with write_commit()
+ *
+ * @param num number of commands
+ * @return true slots are free
+ * @return false mailbox is full, the commands are rejected
+ */
+bool write_reserve(uint8_t num)
+{
+	if ((uint8_t)(write_head - write_tail) + num > WRITE_MAILBOX_SIZE)
+	{
+		write_rejected = write_rejected + num;
+		MYLOG("MODW", "Mailbox full, %d writes rejected", num);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Get a reserved slot of the mailbox
+ *
+ * @param idx index of the command after the last published one
+ * @return write_cmd_s* cleared slot
+ */
+write_cmd_s *write_slot(uint8_t idx)
+{
+	write_cmd_s *cmd = &write_mailbox[(uint8_t)(write_head + idx) & (WRITE_MAILBOX_SIZE - 1)];
+	memset(cmd, 0, sizeof(write_cmd_s));
+	return cmd;
+}
+
+/**
+ * @brief Publish the commands decoded into the reserved slots to the worker
+ *
+ * @param num number of commands
+ */
+void write_commit(uint8_t num)
+{
+	// The commands must be complete before the worker can see them
+	__sync_synchronize();
+	write_head = write_head + num;
+
+	// A running worker takes them into its session
+	if (!write_active)
+	{
+		// Start a timer to handle the write request.
+		api.system.timer.start(RAK_TIMER_1, 100, NULL);
+	}
+}
+
+/**
+ * @brief Check if commands are waiting in the mailbox
+ *
+ * @return true commands are waiting
+ * @return false mailbox is empty
+ */
+bool write_pending(void)
+{
+	return write_head != write_tail;
+}
+
+/**
+ * @brief Remove all writes from the session
+ *
+ */
+void write_clear(void)
+{
+	write_num = 0;
+}
+
+/**
+ * @brief Move the commands from the mailbox into the session, called from the worker
+ *
+ * @return uint8_t number of writes added to the session
+ */
+uint8_t write_collect(void)
+{
+	uint8_t tail = write_tail;
+	uint8_t head = write_head;
+	// The commands must not be read before the head
+	__sync_synchronize();
+	uint8_t added = 0;
+	while ((tail != head) && (write_num < MB_MAX_WRITES))
+	{
+		const write_cmd_s &cmd = write_mailbox[tail & (WRITE_MAILBOX_SIZE - 1)];
+		modbus_transaction_t &transaction = write_transactions[write_num];
+		memcpy(write_values[write_num], cmd.values, write_regs_num(cmd) * sizeof(int16_t));
+		transaction.telegram.u8id = cmd.dev_addr;
+		transaction.telegram.u8fct = cmd.fct;
+		transaction.telegram.u16RegAdd = cmd.start;
+		transaction.telegram.u16CoilsNo = cmd.count;
+		transaction.telegram.au16reg = write_values[write_num];
+		transaction.u16timeOut = 0; // use master time-out
+		write_num++;
+		added++;
+		tail++;
+	}
+	// The commands must be copied before the callbacks can reuse their slots
+	__sync_synchronize();
+	write_tail = tail;
+	return added;
+}
+
+/**
+ * @brief Get the number of writes of a batch with the same baud rate
+ *
+ * @param first index of the first write of the batch
+ * @param baud baud rate of the slave of the first write
+ * @return uint8_t number of consecutive writes to slaves with this baud rate
+ */
+uint8_t write_batch(uint8_t first, uint32_t baud)
+{
+	uint8_t count = 1;
+	while ((first + count < write_num) && (write_baud(write_transactions[first + count].telegram.u8id) == baud))
+	{
+		count++;
+	}
+	return count;
+}
+
+/**
+ * @brief Record the results of the finished writes for the next uplink and clear the session
+ * 		The results of the first MB_MAX_WRITES writes since the last uplink are kept
+ *
+ */
+void write_finished(void)
+{
+	if (write_num == 0)
+	{
+		return;
+	}
+	for (uint8_t idx = 0; idx < write_num; idx++)
+	{
+		const modbus_transaction_t &transaction = write_transactions[idx];
+		if (transaction.u8result != MB_TR_OK)
+		{
+			MYLOG("MODW", "Write %d to slave %d failed, result %d", idx, transaction.telegram.u8id, transaction.u8result);
+		}
+		else if (write_result_num + idx < MB_MAX_WRITES)
+		{
+			write_result_ok |= 1 << (write_result_num + idx);
+		}
+	}
+	MYLOG("MODW", "%d writes done", write_num);
+	write_result_num = (write_result_num + write_num > 0xFF) ? 0xFF : write_result_num + write_num;
+	write_clear();
+}
+
+/**
+ * @brief Add the results of the writes and the rejected writes since the last uplink to the payload
+ * 		The results are sent once, with the compact payload they wait for the next Cayenne LPP uplink
+ *
+ */
+void add_write_result(void)
+{
+	uint8_t rejected = write_rejected;
+	if ((write_result_num == 0) && (rejected == write_rejected_reported))
+	{
+		return;
+	}
+	g_solution_data.addModbusWrite(LPP_CHANNEL_MB_WRITE, write_result_num, write_result_ok, (uint8_t)(rejected - write_rejected_reported));
+	write_result_num = 0;
+	write_result_ok = 0;
+	write_rejected_reported = rejected;
+}
@@ -0,0 +1,222 @@
+/**
+ * @file oversampling.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Several sensor reads within one power up, filtered with median or trimmed mean
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+static_assert(MB_MAX_PROBES * PROBE_CHANNEL_STEP <= SPREAD_CHANNEL_OFFSET, "Spread channels overlap the value channels of the probes");
+
+/** Raw values of each read of the current probe, in the order of soil_field_e */
+int32_t samples[OVERSAMPLE_MAX][SOIL_FIELD_NUM];
+/** Bit mask of the received register map entries of each read */
+uint32_t samples_valid[OVERSAMPLE_MAX];
+/** Number of reads of the current probe */
+uint8_t samples_num = 0;
+
+// Forward declarations
+int oversample_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Start collecting the reads of the next probe
+ *
+ */
+void oversample_reset(void)
+{
+	samples_num = 0;
+}
+
+/**
+ * @brief Store the decoded values of one read
+ *
+ * @param data decoded values of the current probe
+ * @return true read stored
+ * @return false buffer is full
+ */
+bool oversample_add(const soil_data_s &data)
+{
+	if (samples_num >= OVERSAMPLE_MAX)
+	{
+		return false;
+	}
+	for (uint8_t field = 0; field < SOIL_FIELD_NUM; field++)
+	{
+		samples[samples_num][field] = data.*(soil_data_s::fields[field]);
+	}
+	samples_valid[samples_num] = data.valid;
+	samples_num++;
+	return true;
+}
+
+/**
+ * @brief Divide with rounding to the nearest integer
+ *
+ * @param sum dividend
+ * @param count divisor, must be > 0
+ * @return int32_t rounded quotient
+ */
+int32_t div_round(int64_t sum, uint8_t count)
+{
+	return (int32_t)(sum >= 0 ? (sum + count / 2) / count : (sum - count / 2) / count);
+}
+
+/**
+ * @brief Filter the values of one field
+ * 		The values are sorted, then the median or the mean without the lowest
+ * 		and highest quarter is calculated. The spread is the range of the values
+ * 		left after trimming, outliers do not increase it.
+ *
+ * @param values values of the reads, sorted by this function
+ * @param count number of values, must be > 0
+ * @param filter OVERSAMPLE_MEDIAN or OVERSAMPLE_TRIMMED_MEAN
+ * @param spread range of the values without the trimmed ones
+ * @return int32_t filtered value
+ */
+int32_t filter_samples(int32_t *values, uint8_t count, uint8_t filter, int32_t &spread)
+{
+	// Insertion sort, there are never more than OVERSAMPLE_MAX values
+	for (uint8_t idx = 1; idx < count; idx++)
+	{
+		int32_t value = values[idx];
+		uint8_t pos = idx;
+		while ((pos > 0) && (values[pos - 1] > value))
+		{
+			values[pos] = values[pos - 1];
+			pos--;
+		}
+		values[pos] = value;
+	}
+
+	// Drop a quarter of the values on each side, at least one if there are 3 or more
+	uint8_t trim = count / 4;
+	if ((trim == 0) && (count >= 3))
+	{
+		trim = 1;
+	}
+	spread = values[count - 1 - trim] - values[trim];
+
+	if (filter == OVERSAMPLE_TRIMMED_MEAN)
+	{
+		int64_t sum = 0;
+		for (uint8_t idx = trim; idx < count - trim; idx++)
+		{
+			sum += values[idx];
+		}
+		return div_round(sum, count - 2 * trim);
+	}
+
+	uint8_t mid = count / 2;
+	if ((count & 1) != 0)
+	{
+		return values[mid];
+	}
+	return div_round((int64_t)values[mid - 1] + values[mid], 2);
+}
+
+/**
+ * @brief Calculate the filtered values of the current probe from all stored reads
+ * 		A value is valid if it was received in more than half of the reads
+ *
+ * @param profile sensor profile of the probe
+ * @param data filtered values and their valid mask
+ * @param spread range of each value after trimming, in register units, same valid mask as data
+ */
+void oversample_filter(const sensor_profile_s *profile, soil_data_s &data, soil_data_s &spread)
+{
+	data.valid = 0;
+	spread.valid = 0;
+	for (uint8_t idx = 0; idx < profile->map_size; idx++)
+	{
+		uint8_t field = profile->map[idx].field;
+		int32_t values[OVERSAMPLE_MAX];
+		uint8_t count = 0;
+		for (uint8_t sample = 0; sample < samples_num; sample++)
+		{
+			if ((samples_valid[sample] & (1UL << idx)) != 0)
+			{
+				values[count++] = samples[sample][field];
+			}
+		}
+		if (count * 2 <= samples_num)
+		{
+			continue;
+		}
+		int32_t range;
+		data.*(soil_data_s::fields[field]) = filter_samples(values, count, custom_parameters.oversample_filter, range);
+		spread.*(soil_data_s::fields[field]) = range;
+		data.valid |= (1UL << idx);
+	}
+	spread.valid = data.valid;
+}
+
+/**
+ * @brief Add oversampling AT command
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_oversample_at(void)
+{
+	return api.system.atMode.add((char *)"OVERSAMPLE",
+								 (char *)"Set/Get reads per sensor read (1 = off, max 9), filter (0 = median, 1 = trimmed mean) and spread uplink (0 = off, 1 = on), e.g. 5:0:1",
+								 (char *)"Sensor Oversampling", oversample_handler,
+								 RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+}
+
+/**
+ * @brief Handler for oversampling AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int oversample_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d:%d:%d", cmd, custom_parameters.oversample_reads, custom_parameters.oversample_filter, custom_parameters.oversample_spread);
+	}
+	else if (param->argc == 3)
+	{
+		if (sensor_active)
+		{
+			return AT_BUSY_ERROR;
+		}
+		for (int arg = 0; arg < 3; arg++)
+		{
+			if ((strlen(param->argv[arg]) != 1) || !isdigit(param->argv[arg][0]))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+
+		uint8_t new_reads = param->argv[0][0] - '0';
+		uint8_t new_filter = param->argv[1][0] - '0';
+		uint8_t new_spread = param->argv[2][0] - '0';
+		if ((new_reads < 1) || (new_reads > OVERSAMPLE_MAX) || (new_filter > OVERSAMPLE_TRIMMED_MEAN) || (new_spread > 1))
+		{
+			return AT_PARAM_ERROR;
+		}
+
+		if ((new_reads != custom_parameters.oversample_reads) || (new_filter != custom_parameters.oversample_filter) || (new_spread != custom_parameters.oversample_spread))
+		{
+			custom_parameters.oversample_reads = new_reads;
+			custom_parameters.oversample_filter = new_filter;
+			custom_parameters.oversample_spread = new_spread;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
@@ -0,0 +1,265 @@
+/**
+ * @file report_exception.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Report-by-exception, a reading is only sent if a value moved beyond its deadband or the heartbeat is due
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+static_assert(RBE_FIELDS == SOIL_FIELD_NUM, "Deadband settings do not match the soil sensor values");
+
+/** Values of each probe in the last sent reading */
+soil_data_s rbe_last[MB_MAX_PROBES];
+/** Sensor profile of each probe in the last sent reading */
+uint8_t rbe_last_profile[MB_MAX_PROBES];
+/** Error mask of the last sent reading */
+uint8_t rbe_last_errors = 0;
+/** Number of probes in the last sent reading, 0 = nothing sent yet */
+uint8_t rbe_last_probes = 0;
+/** millis() of the last sent reading */
+uint32_t rbe_last_time = 0;
+/** Number of readings not sent since the last sent reading */
+uint16_t rbe_suppressed = 0;
+
+extern const char *soil_field_names[SOIL_FIELD_NUM];
+
+// Forward declarations
+int rbe_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int deadband_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Check if readings are only sent on a change
+ *
+ * @return true report-by-exception is enabled
+ * @return false each reading is sent
+ */
+bool rbe_enabled(void)
+{
+	return (custom_parameters.rbe_heartbeat != 0) && (custom_parameters.send_interval != 0);
+}
+
+/**
+ * @brief Check if a value of a probe moved beyond its deadband since the last sent reading
+ * 		A value that was received now but not in the last sent reading, or the other way round, is a change
+ *
+ * @param profile sensor profile of the probe
+ * @param entry index of the value in the register map
+ * @param data current values of the probe
+ * @param last values of the probe in the last sent reading
+ * @return true value changed
+ * @return false value within the deadband, or the deadband of the value is 0
+ */
+bool rbe_value_changed(const sensor_profile_s *profile, uint8_t entry, const soil_data_s &data, const soil_data_s &last)
+{
+	const reg_desc_s &desc = profile->map[entry];
+	uint16_t deadband = custom_parameters.deadband[desc.field];
+	bool valid = (data.valid & (1UL << entry)) != 0;
+	bool last_valid = (last.valid & (1UL << entry)) != 0;
+	if ((deadband == 0) || (!valid && !last_valid))
+	{
+		return false;
+	}
+	if (valid != last_valid)
+	{
+		return true;
+	}
+	// Deadband is in 1/10 of the LPP unit, raw values are LPP unit * divisor
+	int64_t diff = (int64_t)(data.*(soil_data_s::fields[desc.field])) - last.*(soil_data_s::fields[desc.field]);
+	if (diff < 0)
+	{
+		diff = -diff;
+	}
+	return diff * 10 > (int64_t)deadband * desc.divisor;
+}
+
+/**
+ * @brief Check if the current reading is sent and remember it as the last sent reading
+ * 		It is sent if a value moved beyond its deadband, the errors or probes changed,
+ * 		or the heartbeat would be missed by waiting for the next reading
+ *
+ * @param data current values of the probes
+ * @param errors bit n is set if not all values of probe n were received
+ * @param next_reading time until the next reading in ms
+ * @return true send the reading
+ * @return false reading is not sent
+ */
+bool rbe_report(const soil_data_s *data, uint8_t errors, uint32_t next_reading)
+{
+	if (!rbe_enabled())
+	{
+		rbe_last_probes = 0;
+		return true;
+	}
+
+	bool report = false;
+	if ((rbe_last_probes != custom_parameters.probe_num) || (errors != rbe_last_errors))
+	{
+		MYLOG("RBE", "Probes or errors changed");
+		report = true;
+	}
+	else if ((millis() - rbe_last_time) + next_reading / 2 >= (uint32_t)custom_parameters.rbe_heartbeat * 60000)
+	{
+		// Half the reading interval as tolerance, the interval between two readings jitters by some ms
+		MYLOG("RBE", "Heartbeat");
+		report = true;
+	}
+	for (uint8_t probe = 0; !report && (probe < custom_parameters.probe_num); probe++)
+	{
+		const sensor_profile_s *profile = probe_profile(probe);
+		if (custom_parameters.probes[probe].profile != rbe_last_profile[probe])
+		{
+			report = true;
+			break;
+		}
+		for (uint8_t entry = 0; entry < profile->map_size; entry++)
+		{
+			if (rbe_value_changed(profile, entry, data[probe], rbe_last[probe]))
+			{
+				MYLOG("RBE", "Probe %d %s changed", probe, soil_field_names[profile->map[entry].field]);
+				report = true;
+				break;
+			}
+		}
+	}
+
+	if (!report)
+	{
+		rbe_suppressed++;
+		MYLOG("RBE", "No change, reading not sent (%d since last uplink)", rbe_suppressed);
+		return false;
+	}
+
+	for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
+	{
+		rbe_last[probe] = data[probe];
+		rbe_last_profile[probe] = custom_parameters.probes[probe].profile;
+	}
+	rbe_last_errors = errors;
+	rbe_last_probes = custom_parameters.probe_num;
+	rbe_last_time = millis();
+	rbe_suppressed = 0;
+	return true;
+}
+
+/**
+ * @brief Add report-by-exception AT commands
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_rbe_at(void)
+{
+	bool result = api.system.atMode.add((char *)"RBE",
+										(char *)"Set/Get the heartbeat of report-by-exception in minutes, 0 = send each reading",
+										(char *)"Report-by-exception", rbe_handler,
+										RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+	result &= api.system.atMode.add((char *)"DEADBAND",
+									(char *)"Set/Get the deadband of a value in 1/10 of its unit, <field>:<deadband>, 0 = changes are not sent",
+									(char *)"Deadband", deadband_handler,
+									RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+	return result;
+}
+
+/**
+ * @brief Handler for report-by-exception AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int rbe_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d", cmd, custom_parameters.rbe_heartbeat);
+		AT_PRINTF("Report-by-exception %s, %d readings not sent since the last uplink", rbe_enabled() ? "active" : "inactive",
+				  rbe_suppressed);
+	}
+	else if (param->argc == 1)
+	{
+		for (int i = 0; i < strlen(param->argv[0]); i++)
+		{
+			if (!isdigit(*(param->argv[0] + i)))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		uint32_t new_heartbeat = strtoul(param->argv[0], NULL, 10);
+		if (new_heartbeat > RBE_MAX_HEARTBEAT)
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (new_heartbeat != custom_parameters.rbe_heartbeat)
+		{
+			custom_parameters.rbe_heartbeat = new_heartbeat;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for deadband AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int deadband_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		AT_PRINTF("%s=%d:%d:%d:%d:%d:%d:%d:%d:%d", cmd, custom_parameters.deadband[0], custom_parameters.deadband[1],
+				  custom_parameters.deadband[2], custom_parameters.deadband[3], custom_parameters.deadband[4],
+				  custom_parameters.deadband[5], custom_parameters.deadband[6], custom_parameters.deadband[7],
+				  custom_parameters.deadband[8]);
+		for (uint8_t field = 0; field < SOIL_FIELD_NUM; field++)
+		{
+			AT_PRINTF("%d %s: %d.%d", field, soil_field_names[field], custom_parameters.deadband[field] / 10,
+					  custom_parameters.deadband[field] % 10);
+		}
+	}
+	else if (param->argc == 2)
+	{
+		for (uint8_t arg = 0; arg < 2; arg++)
+		{
+			for (int i = 0; i < strlen(param->argv[arg]); i++)
+			{
+				if (!isdigit(*(param->argv[arg] + i)))
+				{
+					return AT_PARAM_ERROR;
+				}
+			}
+		}
+		uint32_t field = strtoul(param->argv[0], NULL, 10);
+		uint32_t new_deadband = strtoul(param->argv[1], NULL, 10);
+		if ((field >= SOIL_FIELD_NUM) || (new_deadband > 0xFFFF))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (new_deadband != custom_parameters.deadband[field])
+		{
+			custom_parameters.deadband[field] = new_deadband;
+			save_at_setting();
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+	return AT_OK;
+}
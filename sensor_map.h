@@ -0,0 +1,238 @@
+/**
+ * @file sensor_map.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Typed register maps for Modbus sensors
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#ifndef SENSOR_MAP_H
+#define SENSOR_MAP_H
+
+#include <Arduino.h>
+#include "wisblock_cayenne.h"
+#include "RUI3_ModbusPlanner.h"
+
+/** Index of the soil sensor values, used as field number in the register maps */
+enum soil_field_e
+{
+	SOIL_MOISTURE = 0,
+	SOIL_TEMPERATURE,
+	SOIL_CONDUCTIVITY,
+	SOIL_PH,
+	SOIL_NITROGEN,
+	SOIL_PHOSPHORUS,
+	SOIL_POTASSIUM,
+	SOIL_SALINITY,
+	SOIL_TDS,
+	SOIL_FIELD_NUM
+};
+
+/** Soil sensor values, raw values in the unit of the sensor register */
+struct soil_data_s
+{
+	int32_t moisture = 0;
+	int32_t temperature = 0;
+	int32_t conductivity = 0;
+	int32_t ph = 0;
+	int32_t nitrogen = 0;
+	int32_t phosphorus = 0;
+	int32_t potassium = 0;
+	int32_t salinity = 0;
+	int32_t tds = 0;
+	/** Bit mask of the register map entries that were received */
+	uint32_t valid = 0;
+	/** Fields in the order of soil_field_e */
+	static int32_t soil_data_s::*const fields[SOIL_FIELD_NUM];
+};
+
+/**
+ * @brief Register descriptor, one entry per value of a sensor
+ * 		The layout is part of the binary profile format, multi-byte values are little endian
+ */
+struct reg_desc_s
+{
+	/** Register address */
+	uint16_t address;
+	/** Divisor to get the value in the LPP unit */
+	uint16_t divisor;
+	/** Offset added to the register value before scaling, in register units */
+	int16_t offset;
+	/** Number of registers, 1 = 16 bit value, 2 = 32 bit value (high word first) */
+	uint8_t width;
+	/** Register content is signed */
+	uint8_t is_signed;
+	/** Cayenne LPP channel */
+	uint8_t lpp_channel;
+	/** Cayenne LPP data type */
+	uint8_t lpp_type;
+	/** Index of the value in the destination structure, T::fields[field] */
+	uint8_t field;
+	uint8_t reserved;
+};
+
+/**
+ * @brief Get the register addresses to read for a register map
+ *
+ * @param map register map
+ * @param map_size number of entries in the map
+ * @param addresses array for the addresses, 2 entries per 32 bit value
+ * @param max_addresses size of the address array
+ * @return uint8_t number of addresses, 0 if the array is too small
+ */
+inline uint8_t reg_map_addresses(const reg_desc_s *map, uint8_t map_size, uint16_t *addresses, uint8_t max_addresses)
+{
+	uint8_t count = 0;
+	for (uint8_t idx = 0; idx < map_size; idx++)
+	{
+		for (uint8_t word = 0; word < map[idx].width; word++)
+		{
+			if (count >= max_addresses)
+			{
+				return 0;
+			}
+			addresses[count++] = map[idx].address + word;
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Decode received registers into the destination structure
+ *
+ * @param map register map
+ * @param map_size number of entries in the map
+ * @param regs received registers in the order of reg_map_addresses()
+ * @param received bit mask of the received registers
+ * @param data destination structure, valid is set to the decoded map entries.
+ * 		The offset of the map entry is added to the register value.
+ */
+template <typename T>
+void reg_map_decode(const reg_desc_s *map, uint8_t map_size, const int16_t *regs, uint32_t received, T &data)
+{
+	uint8_t reg_idx = 0;
+	data.valid = 0;
+	for (uint8_t idx = 0; idx < map_size; idx++)
+	{
+		const reg_desc_s &desc = map[idx];
+		uint32_t mask = ((1UL << desc.width) - 1) << reg_idx;
+		if ((received & mask) == mask)
+		{
+			if (desc.width == 2)
+			{
+				uint32_t raw = ((uint32_t)(uint16_t)regs[reg_idx] << 16) | (uint16_t)regs[reg_idx + 1];
+				data.*(T::fields[desc.field]) = (int32_t)raw + desc.offset;
+			}
+			else
+			{
+				data.*(T::fields[desc.field]) = (desc.is_signed ? (int32_t)regs[reg_idx] : (int32_t)(uint16_t)regs[reg_idx]) + desc.offset;
+			}
+			data.valid |= (1UL << idx);
+		}
+		reg_idx += desc.width;
+	}
+}
+
+/**
+ * @brief Get a value in the LPP unit
+ *
+ * @param map register map
+ * @param map_size number of entries in the map
+ * @param data decoded structure
+ * @param field requested field
+ * @return float scaled value, 0.0 if the field is not in the map
+ */
+template <typename T>
+float reg_map_value(const reg_desc_s *map, uint8_t map_size, const T &data, int32_t T::*field)
+{
+	for (uint8_t idx = 0; idx < map_size; idx++)
+	{
+		if (T::fields[map[idx].field] == field)
+		{
+			return (float)(data.*field) / map[idx].divisor;
+		}
+	}
+	return 0.0;
+}
+
+/**
+ * @brief Add the valid values of the structure to the payload
+ * 		The raw value is scaled by the divisor of the map entry and rounded to the step of the LPP type
+ *
+ * @param map register map
+ * @param map_size number of entries in the map
+ * @param data decoded structure
+ * @param payload Cayenne LPP payload
+ * @param channel_offset added to the LPP channel of the map, to separate several sensors of the same type
+ * @return uint8_t number of values added
+ */
+template <typename T>
+uint8_t reg_map_encode(const reg_desc_s *map, uint8_t map_size, const T &data, WisCayenne &payload, uint8_t channel_offset = 0)
+{
+	uint8_t added = 0;
+	for (uint8_t idx = 0; idx < map_size; idx++)
+	{
+		const reg_desc_s &desc = map[idx];
+		if ((data.valid & (1UL << idx)) == 0)
+		{
+			continue;
+		}
+		// Integer scaling, no float arithmetic between the register and the payload bytes
+		if (payload.addFixed(desc.lpp_channel + channel_offset, desc.lpp_type, data.*(T::fields[desc.field]), desc.divisor) == 0)
+		{
+			continue;
+		}
+		added++;
+	}
+	return added;
+}
+
+/** Number of entries of a register map array */
+#define REG_MAP_SIZE(map) (sizeof(map) / sizeof(map[0]))
+
+/** Marks a valid sensor profile */
+#define PROFILE_MAGIC 0x5A
+/** Maximum number of values in a sensor profile */
+#define PROFILE_MAX_FIELDS 12
+/** Maximum length of a profile name */
+#define PROFILE_NAME_LEN 8
+
+/** UART parity of a sensor profile */
+enum profile_parity_e
+{
+	PROFILE_PARITY_NONE = 0,
+	PROFILE_PARITY_ODD = 1,
+	PROFILE_PARITY_EVEN = 2
+};
+
+/**
+ * @brief Sensor profile, everything needed to read one sensor type
+ * 		This is the binary profile format stored in flash and sent by downlink,
+ * 		multi-byte values are little endian
+ */
+struct sensor_profile_s
+{
+	/** PROFILE_MAGIC if the profile is valid */
+	uint8_t magic;
+	/** Number of entries in the register map */
+	uint8_t map_size;
+	/** Function code to read the registers, MB_FC_READ_REGISTERS or MB_FC_READ_INPUT_REGISTER */
+	uint8_t fct;
+	/** UART parity, one of profile_parity_e */
+	uint8_t parity;
+	/** Baud rate of the sensor */
+	uint32_t baud;
+	/** Slave address, used for probes without own address */
+	uint8_t address;
+	uint8_t reserved;
+	/** How register reads may be combined */
+	modbus_read_policy_t policy;
+	/** Sensor name, zero terminated if shorter than PROFILE_NAME_LEN */
+	char name[PROFILE_NAME_LEN];
+	/** Register map */
+	reg_desc_s map[PROFILE_MAX_FIELDS];
+};
+
+#endif // SENSOR_MAP_H
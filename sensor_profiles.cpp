@@ -0,0 +1,602 @@
+/**
+ * @file sensor_profiles.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Built-in and flash stored sensor profiles, AT commands and downlinks to change them
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+/** Number of profile bytes per line of the downlink hex dump */
+#define PROFILE_DUMP_CHUNK 24
+/** Value of received_id if nothing was received, never a valid profile number */
+#define PROFILE_NONE 0xFF
+
+static_assert(sizeof(sensor_profile_s) <= PROFILE_FLASH_SIZE, "Sensor profile does not fit into its flash space");
+static_assert(PROFILE_FLASH_OFFSET >= sizeof(custom_param_s), "Sensor profiles overlap the custom flash parameters");
+static_assert(PROFILE_MAX_FIELDS * 2 <= MB_PLAN_MAX_WANTED, "Sensor profile can have more registers than the read planner");
+
+/** Fields of the soil sensor values in the order of soil_field_e */
+int32_t soil_data_s::*const soil_data_s::fields[SOIL_FIELD_NUM] = {
+	&soil_data_s::moisture,
+	&soil_data_s::temperature,
+	&soil_data_s::conductivity,
+	&soil_data_s::ph,
+	&soil_data_s::nitrogen,
+	&soil_data_s::phosphorus,
+	&soil_data_s::potassium,
+	&soil_data_s::salinity,
+	&soil_data_s::tds,
+};
+
+/** Names of the soil sensor values in the order of soil_field_e */
+const char *soil_field_names[SOIL_FIELD_NUM] = {"moisture", "temperature", "conductivity", "pH", "nitrogen", "phosphorus", "potassium", "salinity", "TDS"};
+
+/** Built-in sensor profiles */
+const sensor_profile_s builtin_profiles[PROFILE_BUILTIN] = {
+	// VEM SEE SN-3002-TR-ECTHNPKKPH-N01
+	// Join registers with up to 4 unused registers between them, max 32 registers per request
+	{PROFILE_MAGIC, 9, MB_FC_READ_REGISTERS, PROFILE_PARITY_NONE, 4800, 1, 0, {4, 32}, "VEMSEE",
+	 {
+		 // address, divisor, offset, width, signed, LPP channel, LPP type, field
+		 {0x01, 10, 0, 1, 1, LPP_CHANNEL_TEMP, LPP_TEMPERATURE, SOIL_TEMPERATURE, 0},
+		 {0x00, 10, 0, 1, 0, LPP_CHANNEL_MOIST, LPP_RELATIVE_HUMIDITY, SOIL_MOISTURE, 0},
+		 {0x02, 1, 0, 1, 0, LPP_CHANNEL_COND, LPP_CONCENTRATION, SOIL_CONDUCTIVITY, 0},
+		 {0x03, 10, 0, 1, 0, LPP_CHANNEL_PH, LPP_ANALOG_OUTPUT, SOIL_PH, 0},
+		 {0x04, 1, 0, 1, 0, LPP_CHANNEL_NITRO, LPP_CONCENTRATION, SOIL_NITROGEN, 0},
+		 {0x05, 1, 0, 1, 0, LPP_CHANNEL_PHOS, LPP_CONCENTRATION, SOIL_PHOSPHORUS, 0},
+		 {0x06, 1, 0, 1, 0, LPP_CHANNEL_POTA, LPP_CONCENTRATION, SOIL_POTASSIUM, 0},
+		 {0x07, 1, 0, 1, 0, LPP_CHANNEL_SALIN, LPP_CONCENTRATION, SOIL_SALINITY, 0},
+		 {0x08, 1, 0, 1, 0, LPP_CHANNEL_TDS, LPP_CONCENTRATION, SOIL_TDS, 0},
+	 }},
+	// GEMHO 7in1 Soil Sensor with RS485
+	// Join registers with up to 8 unused registers between them, max 32 registers per request
+	{PROFILE_MAGIC, 7, MB_FC_READ_REGISTERS, PROFILE_PARITY_NONE, 9600, 1, 0, {8, 32}, "GEMHO",
+	 {
+		 // address, divisor, offset, width, signed, LPP channel, LPP type, field
+		 {0x06, 100, 0, 1, 1, LPP_CHANNEL_TEMP, LPP_TEMPERATURE, SOIL_TEMPERATURE, 0},
+		 {0x07, 100, 0, 1, 0, LPP_CHANNEL_MOIST, LPP_RELATIVE_HUMIDITY, SOIL_MOISTURE, 0},
+		 {0x08, 1, 0, 1, 0, LPP_CHANNEL_COND, LPP_CONCENTRATION, SOIL_CONDUCTIVITY, 0},
+		 {0x09, 100, 0, 1, 0, LPP_CHANNEL_PH, LPP_ANALOG_OUTPUT, SOIL_PH, 0},
+		 {0x1E, 1, 0, 1, 0, LPP_CHANNEL_NITRO, LPP_CONCENTRATION, SOIL_NITROGEN, 0},
+		 {0x1F, 1, 0, 1, 0, LPP_CHANNEL_PHOS, LPP_CONCENTRATION, SOIL_PHOSPHORUS, 0},
+		 {0x20, 1, 0, 1, 0, LPP_CHANNEL_POTA, LPP_CONCENTRATION, SOIL_POTASSIUM, 0},
+	 }},
+};
+
+/** Sensor profiles in flash */
+sensor_profile_s flash_profiles[PROFILE_FLASH_SLOTS];
+
+/** Receive buffer for a profile sent by downlink */
+sensor_profile_s received_profile;
+/** Profile number the receive buffer is for, PROFILE_NONE = nothing received */
+uint8_t received_id = PROFILE_NONE;
+
+// Forward declarations
+int profile_handler(SERIAL_PORT port, char *cmd, stParam *param);
+int pfield_handler(SERIAL_PORT port, char *cmd, stParam *param);
+
+/**
+ * @brief Get a sensor profile
+ *
+ * @param id profile number, built-in profiles first, then the flash profiles
+ * @return const sensor_profile_s* profile, NULL if the profile does not exist or has no values
+ */
+const sensor_profile_s *get_profile(uint8_t id)
+{
+	if (id < PROFILE_BUILTIN)
+	{
+		return &builtin_profiles[id];
+	}
+	if (id >= PROFILE_NUM)
+	{
+		return NULL;
+	}
+	const sensor_profile_s *profile = &flash_profiles[id - PROFILE_BUILTIN];
+	if ((profile->magic != PROFILE_MAGIC) || (profile->map_size == 0))
+	{
+		return NULL;
+	}
+	return profile;
+}
+
+/**
+ * @brief Check a profile before it is stored or used
+ *
+ * @param profile profile to check
+ * @return true profile can be used
+ * @return false profile has invalid entries
+ */
+bool check_profile(const sensor_profile_s &profile)
+{
+	if ((profile.magic != PROFILE_MAGIC) || (profile.map_size > PROFILE_MAX_FIELDS) || (profile.parity > PROFILE_PARITY_EVEN))
+	{
+		return false;
+	}
+	if ((profile.fct != MB_FC_READ_REGISTERS) && (profile.fct != MB_FC_READ_INPUT_REGISTER))
+	{
+		return false;
+	}
+	if ((profile.baud < 1200) || (profile.baud > 115200) || (profile.address > 247))
+	{
+		return false;
+	}
+	if ((profile.policy.u8maxRegs == 0) || (profile.policy.u8maxRegs > MB_MAX_READ_REGS))
+	{
+		return false;
+	}
+	for (uint8_t idx = 0; idx < profile.map_size; idx++)
+	{
+		const reg_desc_s &desc = profile.map[idx];
+		if ((desc.field >= SOIL_FIELD_NUM) || (desc.divisor == 0) || (desc.width < 1) || (desc.width > 2))
+		{
+			return false;
+		}
+		if ((desc.lpp_type != LPP_TEMPERATURE) && (desc.lpp_type != LPP_RELATIVE_HUMIDITY) &&
+			(desc.lpp_type != LPP_ANALOG_OUTPUT) && (desc.lpp_type != LPP_CONCENTRATION))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Read the sensor profiles from flash, invalid profiles are cleared
+ *
+ */
+void load_profiles(void)
+{
+	for (uint8_t slot = 0; slot < PROFILE_FLASH_SLOTS; slot++)
+	{
+		sensor_profile_s &profile = flash_profiles[slot];
+		if (!api.system.flash.get(PROFILE_FLASH_OFFSET + slot * PROFILE_FLASH_SIZE, (uint8_t *)&profile, sizeof(sensor_profile_s)) ||
+			!check_profile(profile))
+		{
+			memset(&profile, 0, sizeof(sensor_profile_s));
+		}
+	}
+}
+
+/**
+ * @brief Save a flash profile
+ *
+ * @param id profile number, PROFILE_BUILTIN or higher
+ * @return true write to flash was successful
+ * @return false write to flash failed
+ */
+bool save_profile(uint8_t id)
+{
+	uint8_t slot = id - PROFILE_BUILTIN;
+	uint8_t *flash_value = (uint8_t *)&flash_profiles[slot];
+	if (!api.system.flash.set(PROFILE_FLASH_OFFSET + slot * PROFILE_FLASH_SIZE, flash_value, sizeof(sensor_profile_s)))
+	{
+		// Retry
+		return api.system.flash.set(PROFILE_FLASH_OFFSET + slot * PROFILE_FLASH_SIZE, flash_value, sizeof(sensor_profile_s));
+	}
+	return true;
+}
+
+/**
+ * @brief Check a probe list before it is used, shared by ATC+PROBES and the probe downlink
+ *
+ * @param probes probes to check
+ * @param num number of probes
+ * @return true probes can be used
+ * @return false invalid number of probes, address or profile, or two probes with the same slave address
+ */
+bool check_probes(const probe_s *probes, uint8_t num)
+{
+	if ((num == 0) || (num > MB_MAX_PROBES))
+	{
+		return false;
+	}
+	for (uint8_t probe = 0; probe < num; probe++)
+	{
+		if ((probes[probe].address > 247) || (get_profile(probes[probe].profile) == NULL))
+		{
+			return false;
+		}
+		for (uint8_t other = 0; other < probe; other++)
+		{
+			if ((probes[probe].address != 0) && (probes[other].address == probes[probe].address))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Check if a profile is used by a probe
+ *
+ * @param id profile number
+ * @return true at least one probe uses the profile
+ * @return false profile is not used
+ */
+bool profile_in_use(uint8_t id)
+{
+	for (uint8_t probe = 0; probe < custom_parameters.probe_num; probe++)
+	{
+		if (custom_parameters.probes[probe].profile == id)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Parse a decimal number from an AT command parameter
+ *
+ * @param text parameter
+ * @param value parsed number
+ * @return true parameter is a number
+ * @return false parameter is empty or has other characters
+ */
+bool parse_number(const char *text, int32_t &value)
+{
+	char *end;
+	if (*text == 0)
+	{
+		return false;
+	}
+	value = strtol(text, &end, 10);
+	return *end == 0;
+}
+
+/**
+ * @brief Print a sensor profile
+ *
+ * @param id profile number
+ * @param details true = print the register map and the profile as downlink hex dump
+ */
+void print_profile(uint8_t id, bool details)
+{
+	const sensor_profile_s *profile = (id < PROFILE_BUILTIN) ? &builtin_profiles[id] : &flash_profiles[id - PROFILE_BUILTIN];
+	if (profile->magic != PROFILE_MAGIC)
+	{
+		AT_PRINTF("Profile %d: empty", id);
+		return;
+	}
+	AT_PRINTF("Profile %d: %.*s, %ld baud, parity %s, FC %d, address %d, %d values%s", id, PROFILE_NAME_LEN, profile->name,
+			  profile->baud, profile->parity == PROFILE_PARITY_NONE ? "none" : (profile->parity == PROFILE_PARITY_ODD ? "odd" : "even"),
+			  profile->fct, profile->address, profile->map_size, id < PROFILE_BUILTIN ? ", built-in" : "");
+	if (!details)
+	{
+		return;
+	}
+	AT_PRINTF("Join gap %d, max %d registers per request", profile->policy.u8maxGap, profile->policy.u8maxRegs);
+	for (uint8_t idx = 0; idx < profile->map_size; idx++)
+	{
+		const reg_desc_s &desc = profile->map[idx];
+		AT_PRINTF("  %s: register 0x%04X, width %d, %s, divisor %d, offset %d, LPP channel %d, type %d",
+				  soil_field_names[desc.field], desc.address, desc.width, desc.is_signed ? "signed" : "unsigned",
+				  desc.divisor, desc.offset, desc.lpp_channel, desc.lpp_type);
+	}
+
+	// The profile as downlinks, to copy it to other devices
+	uint16_t size = offsetof(sensor_profile_s, map) + profile->map_size * sizeof(reg_desc_s);
+	const uint8_t *data = (const uint8_t *)profile;
+	for (uint16_t offset = 0; offset < size; offset += PROFILE_DUMP_CHUNK)
+	{
+		char hex[PROFILE_DUMP_CHUNK * 2 + 1];
+		uint16_t chunk = (size - offset < PROFILE_DUMP_CHUNK) ? (size - offset) : PROFILE_DUMP_CHUNK;
+		for (uint16_t byte = 0; byte < chunk; byte++)
+		{
+			sprintf(&hex[byte * 2], "%02X", data[offset + byte]);
+		}
+		AT_PRINTF("Downlink AA55%02X%02X%02X%s", DL_PROFILE_WRITE, id, offset, hex);
+	}
+	AT_PRINTF("Downlink AA55%02X%02X", DL_PROFILE_SAVE, id);
+}
+
+/**
+ * @brief Add sensor profile AT commands
+ *
+ * @return true if success
+ * @return false if failed
+ */
+bool init_profile_at(void)
+{
+	bool result = api.system.atMode.add((char *)"PROFILE",
+										(char *)"Get sensor profiles, show profile <id>:?, set profile <id>:<name>:<baud>:<parity>:<FC>:<address>:<max gap>:<max regs>, <id>:COPY:<from>, <id>:DEL",
+										(char *)"Sensor Profiles", profile_handler,
+										RAK_ATCMD_PERM_WRITE | RAK_ATCMD_PERM_READ);
+	result &= api.system.atMode.add((char *)"PFIELD",
+									(char *)"Set profile value <id>:<field>:<register>:<width>:<signed>:<divisor>:<offset>:<LPP channel>:<LPP type>, remove <id>:<field>:DEL",
+									(char *)"Sensor Profile Value", pfield_handler,
+									RAK_ATCMD_PERM_WRITE);
+	return result;
+}
+
+/**
+ * @brief Handler for sensor profile AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int profile_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	if ((param->argc == 1 && !strcmp(param->argv[0], "?")) || (param->argc == 0))
+	{
+		for (uint8_t id = 0; id < PROFILE_NUM; id++)
+		{
+			print_profile(id, false);
+		}
+		return AT_OK;
+	}
+
+	int32_t id;
+	if ((param->argc < 2) || !parse_number(param->argv[0], id) || (id < 0) || (id >= PROFILE_NUM))
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	if ((param->argc == 2) && !strcmp(param->argv[1], "?"))
+	{
+		print_profile(id, true);
+		return AT_OK;
+	}
+
+	// Only the flash profiles can be changed, and not while the sensor is read
+	if (id < PROFILE_BUILTIN)
+	{
+		return AT_PARAM_ERROR;
+	}
+	if (sensor_active)
+	{
+		return AT_BUSY_ERROR;
+	}
+	sensor_profile_s profile = flash_profiles[id - PROFILE_BUILTIN];
+
+	if ((param->argc == 2) && !strcmp(param->argv[1], "DEL"))
+	{
+		if (profile_in_use(id))
+		{
+			return AT_PARAM_ERROR;
+		}
+		memset(&profile, 0, sizeof(sensor_profile_s));
+	}
+	else if ((param->argc == 3) && !strcmp(param->argv[1], "COPY"))
+	{
+		int32_t from;
+		if (!parse_number(param->argv[2], from) || (from < 0) || (from >= PROFILE_NUM) || (get_profile(from) == NULL))
+		{
+			return AT_PARAM_ERROR;
+		}
+		profile = *get_profile(from);
+	}
+	else if (param->argc == 8)
+	{
+		int32_t values[6];
+		for (uint8_t arg = 0; arg < 6; arg++)
+		{
+			if (!parse_number(param->argv[arg + 2], values[arg]) || (values[arg] < 0))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		if ((strlen(param->argv[1]) == 0) || (values[1] > 255) || (values[2] > 255) || (values[3] > 255) || (values[4] > 255) ||
+			(values[5] > 255))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (profile.magic != PROFILE_MAGIC)
+		{
+			// New profile, start without values
+			memset(&profile, 0, sizeof(sensor_profile_s));
+			profile.magic = PROFILE_MAGIC;
+		}
+		strncpy(profile.name, param->argv[1], PROFILE_NAME_LEN);
+		profile.baud = values[0];
+		profile.parity = values[1];
+		profile.fct = values[2];
+		profile.address = values[3];
+		profile.policy.u8maxGap = values[4];
+		profile.policy.u8maxRegs = values[5];
+		if (!check_profile(profile))
+		{
+			return AT_PARAM_ERROR;
+		}
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	flash_profiles[id - PROFILE_BUILTIN] = profile;
+	save_profile(id);
+	return AT_OK;
+}
+
+/**
+ * @brief Handler for sensor profile value AT commands
+ *
+ * @param port Serial port used
+ * @param cmd char array with the received AT command
+ * @param param char array with the received AT command parameters
+ * @return int result of command parsing
+ * 			AT_OK AT command & parameters valid
+ * 			AT_PARAM_ERROR command or parameters invalid
+ */
+int pfield_handler(SERIAL_PORT port, char *cmd, stParam *param)
+{
+	int32_t id;
+	int32_t field;
+	if ((param->argc < 2) || !parse_number(param->argv[0], id) || (id < PROFILE_BUILTIN) || (id >= PROFILE_NUM))
+	{
+		return AT_PARAM_ERROR;
+	}
+	if (!parse_number(param->argv[1], field) || (field < 0) || (field >= SOIL_FIELD_NUM))
+	{
+		return AT_PARAM_ERROR;
+	}
+	if (sensor_active)
+	{
+		return AT_BUSY_ERROR;
+	}
+
+	sensor_profile_s profile = flash_profiles[id - PROFILE_BUILTIN];
+	if (profile.magic != PROFILE_MAGIC)
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	// Find the entry of the value
+	uint8_t idx = 0;
+	while ((idx < profile.map_size) && (profile.map[idx].field != field))
+	{
+		idx++;
+	}
+
+	if ((param->argc == 3) && !strcmp(param->argv[2], "DEL"))
+	{
+		if (idx == profile.map_size)
+		{
+			return AT_PARAM_ERROR;
+		}
+		memmove(&profile.map[idx], &profile.map[idx + 1], (profile.map_size - idx - 1) * sizeof(reg_desc_s));
+		profile.map_size--;
+	}
+	else if (param->argc == 9)
+	{
+		int32_t values[7];
+		for (uint8_t arg = 0; arg < 7; arg++)
+		{
+			if (!parse_number(param->argv[arg + 2], values[arg]))
+			{
+				return AT_PARAM_ERROR;
+			}
+		}
+		if ((values[0] < 0) || (values[0] > 0xFFFF) || (values[3] < 1) || (values[3] > 0xFFFF) ||
+			(values[4] < -32768) || (values[4] > 32767) || (values[5] < 0) || (values[5] > 255) || (values[6] < 0) || (values[6] > 255))
+		{
+			return AT_PARAM_ERROR;
+		}
+		if (idx == profile.map_size)
+		{
+			if (profile.map_size >= PROFILE_MAX_FIELDS)
+			{
+				return AT_PARAM_ERROR;
+			}
+			profile.map_size++;
+		}
+		reg_desc_s &desc = profile.map[idx];
+		desc.field = field;
+		desc.address = values[0];
+		desc.width = values[1];
+		desc.is_signed = (values[2] != 0) ? 1 : 0;
+		desc.divisor = values[3];
+		desc.offset = values[4];
+		desc.lpp_channel = values[5];
+		desc.lpp_type = values[6];
+		desc.reserved = 0;
+	}
+	else
+	{
+		return AT_PARAM_ERROR;
+	}
+
+	if (!check_profile(profile) || ((profile.map_size == 0) && profile_in_use(id)))
+	{
+		return AT_PARAM_ERROR;
+	}
+	flash_profiles[id - PROFILE_BUILTIN] = profile;
+	save_profile(id);
+	return AT_OK;
+}
+
+/**
+ * @brief Write a part of a profile into the receive buffer, called from the downlink decoder
+ * 		AA 55 A0 <profile> <offset> <data>, offset 0 starts a new profile
+ *
+ * @param buffer received data, starting with AA 55
+ * @param size number of received bytes
+ * @return true data is stored in the receive buffer
+ * @return false invalid command
+ */
+bool dl_profile_write(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t id = buffer[3];
+	if ((id < PROFILE_BUILTIN) || (id >= PROFILE_NUM) || (buffer[4] + size - 5 > sizeof(sensor_profile_s)))
+	{
+		return false;
+	}
+	if ((buffer[4] == 0) || (received_id != id))
+	{
+		// Start of a new profile
+		memset(&received_profile, 0, sizeof(sensor_profile_s));
+		received_id = id;
+	}
+	memcpy((uint8_t *)&received_profile + buffer[4], &buffer[5], size - 5);
+	MYLOG("PROFILE", "Received %d bytes at %d for profile %d", size - 5, buffer[4], id);
+	return true;
+}
+
+/**
+ * @brief Check the received profile and save it to flash, called from the downlink decoder
+ * 		AA 55 A1 <profile>
+ *
+ * @param buffer received data, starting with AA 55
+ * @param size number of received bytes
+ * @return true profile is saved
+ * @return false invalid command or profile, or the sensor is being read
+ */
+bool dl_profile_save(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t id = buffer[3];
+	if ((size != 4) || (id < PROFILE_BUILTIN) || (id >= PROFILE_NUM) || (id != received_id) || sensor_active ||
+		!check_profile(received_profile) || ((received_profile.map_size == 0) && profile_in_use(id)))
+	{
+		MYLOG("PROFILE", "Profile %d not saved", id);
+		return false;
+	}
+	flash_profiles[id - PROFILE_BUILTIN] = received_profile;
+	save_profile(id);
+	memset(&received_profile, 0, sizeof(sensor_profile_s));
+	received_id = PROFILE_NONE;
+	MYLOG("PROFILE", "Profile %d saved", id);
+	return true;
+}
+
+/**
+ * @brief Set the probes, called from the downlink decoder
+ * 		AA 55 A2 <address> <profile> [<address> <profile> ...]
+ *
+ * @param buffer received data, starting with AA 55
+ * @param size number of received bytes
+ * @return true probes are set
+ * @return false invalid probe list, or the sensor is being read
+ */
+bool dl_probes(const uint8_t *buffer, uint8_t size)
+{
+	uint8_t new_num = (size - 3) / 2;
+	if ((new_num > MB_MAX_PROBES) || ((size - 3) & 1) || sensor_active)
+	{
+		return false;
+	}
+	probe_s new_probes[MB_MAX_PROBES];
+	for (uint8_t probe = 0; probe < new_num; probe++)
+	{
+		new_probes[probe].address = buffer[3 + probe * 2];
+		new_probes[probe].profile = buffer[4 + probe * 2];
+	}
+	if (!check_probes(new_probes, new_num))
+	{
+		return false;
+	}
+	memcpy(custom_parameters.probes, new_probes, new_num * sizeof(probe_s));
+	custom_parameters.probe_num = new_num;
+	save_at_setting();
+	MYLOG("PROFILE", "%d probes set", new_num);
+	return true;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file dr_calculator_test.cpp
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Host test of the time on air and datarate selection of dr_calculator.cpp
+ * 		Build and run from the sketch folder:
+ * 		g++ -std=gnu++11 -Itest/stub -I. -o dr_calculator_test test/dr_calculator_test.cpp dr_calculator.cpp && ./dr_calculator_test
+ * 		Reference values are from the Semtech LoRa calculator, CR 4/5, CRC on, explicit header, 8 symbols preamble
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "app.h"
+
+HardwareSerial Serial, Serial1, Serial6;
+rak_api api;
+custom_param_s custom_parameters;
+
+bool save_at_setting(void)
+{
+	return true;
+}
+
+// Forward declarations, internal to dr_calculator.cpp
+uint32_t get_lora_toa(uint8_t sf, uint8_t bw, uint16_t phy_size);
+bool dr_fits(uint16_t region, uint8_t datarate, uint16_t payload_size);
+uint8_t get_best_dr(uint16_t region, uint16_t payload_size, uint8_t max_dr);
+
+/** Regions as used by api.lorawan.band */
+#define REGION_EU868 4
+#define REGION_US915 5
+#define REGION_AS923_1 8
+#define REGION_LA915 12
+
+/** Number of failed checks */
+int failed = 0;
+
+/**
+ * @brief Compare a result with the expected value
+ *
+ * @param line source line of the check
+ * @param result result of the tested function
+ * @param expected expected result
+ */
+void check(int line, uint32_t result, uint32_t expected)
+{
+	if (result != expected)
+	{
+		printf("Line %d: got %u, expected %u\n", line, result, expected);
+		failed++;
+	}
+}
+
+#define CHECK(result, expected) check(__LINE__, (result), (expected))
+
+int main(void)
+{
+	// Time on air of a LoRaWAN packet, 13 bytes MAC overhead
+	CHECK(get_lora_toa(7, 1, 10 + 13), 61696);	   // SF7 BW125 10 bytes = 61.696 ms
+	CHECK(get_lora_toa(12, 1, 51 + 13), 2793472); // SF12 BW125 51 bytes = 2793.472 ms
+	CHECK(get_lora_toa(10, 1, 11 + 13), 370688);  // SF10 BW125 11 bytes = 370.688 ms
+	CHECK(get_lora_toa(8, 4, 10 + 13), 28288);	   // SF8 BW500 10 bytes = 28.288 ms
+	CHECK(get_uplink_toa(REGION_EU868, 5, 10), 61696);
+
+	// 400 ms dwell time, SF10 BW125 carries 11 bytes, not 12
+	CHECK(dr_fits(REGION_US915, 0, 11), true);
+	CHECK(dr_fits(REGION_US915, 0, 12), false);
+	CHECK(dr_fits(REGION_AS923_1, 2, 11), true);
+	CHECK(dr_fits(REGION_AS923_1, 2, 12), false);
+	// No dwell time in EU868
+	CHECK(dr_fits(REGION_EU868, 2, 12), true);
+	// AS923 DR0 and DR1 can not carry anything within the dwell time
+	CHECK(get_best_dr(REGION_AS923_1, 10, 0), 2);
+	CHECK(get_best_dr(REGION_AS923_1, 12, 2), 3);
+
+	// Lowest datarate within the margin, else the lowest faster one
+	CHECK(get_best_dr(REGION_EU868, 25, 5), 5);
+	CHECK(get_best_dr(REGION_EU868, 100, 0), 3);
+	CHECK(get_best_dr(REGION_US915, 20, 4), 4);
+
+	// LA915 resolves, unknown regions do not
+	CHECK(get_best_dr(REGION_LA915, 20, 6), 6);
+	CHECK(get_max_payload(REGION_LA915, 6), 222);
+	CHECK(get_best_dr(13, 20, 6), 16);
+
+	// Datarate selection with margin, follows the datarate set by ADR
+	api.lorawan.band.set(REGION_EU868);
+	api.lorawan.dr.set(5);
+	custom_parameters.dr_margin = 1;
+	CHECK(set_uplink_dr(20), 4);
+	CHECK(api.lorawan.dr.get(), 4);
+	CHECK(set_uplink_dr(20), 4);
+	api.lorawan.dr.set(2);
+	CHECK(set_uplink_dr(20), 1);
+	CHECK(set_uplink_dr(60), 3);
+	CHECK(set_uplink_dr(20), 1);
+
+	printf("%s, %d checks failed\n", failed ? "FAIL" : "PASS", failed);
+	return failed ? 1 : 0;
+}
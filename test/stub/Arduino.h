@@ -0,0 +1,193 @@
+/**
+ * @file Arduino.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Minimal host stand-in for the RUI3 core, only what the host tests need to compile the sketch modules
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <math.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define LED_GREEN 1
+#define LED_BLUE 2
+#define WB_IO2 3
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+inline unsigned long millis(void) { return 0; }
+inline unsigned long micros(void) { return 0; }
+inline void delay(unsigned long) {}
+inline void delayMicroseconds(unsigned int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return 0; }
+inline void pinMode(int, int) {}
+
+class String
+{
+public:
+	String(const char *s = "") : text(s) {}
+	const char *c_str() const { return text; }
+	unsigned int length() const { return strlen(text); }
+
+private:
+	const char *text;
+};
+
+/** All output goes to stdout */
+class Print
+{
+public:
+	size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+	size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+	size_t print(const char *text) { return printf("%s", text); }
+	size_t println(const char *text) { return printf("%s\r\n", text); }
+	size_t printf(const char *format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		int len = vprintf(format, args);
+		va_end(args);
+		return len;
+	}
+	void flush() { fflush(stdout); }
+};
+
+class Stream : public Print
+{
+public:
+	int available() { return 0; }
+	int read() { return -1; }
+	int peek() { return -1; }
+};
+
+enum RAK_SERIAL_MODE
+{
+	RAK_AT_MODE,
+	RAK_API_MODE,
+	RAK_CUSTOM_MODE
+};
+
+class HardwareSerial : public Stream
+{
+public:
+	void begin(uint32_t, RAK_SERIAL_MODE = RAK_AT_MODE) {}
+	void begin(uint32_t, uint32_t, RAK_SERIAL_MODE = RAK_AT_MODE) {}
+	void end() {}
+};
+
+#define SERIAL_8N1 0x06
+#define SERIAL_8E1 0x1E
+#define SERIAL_8O1 0x3E
+#define SERIAL_8N2 0x0E
+
+extern HardwareSerial Serial, Serial1, Serial6;
+
+typedef int SERIAL_PORT;
+
+typedef struct
+{
+	uint8_t argc;
+	char *argv[16];
+} stParam;
+
+#define AT_OK 0
+#define AT_ERROR 1
+#define AT_PARAM_ERROR 2
+#define AT_BUSY_ERROR 3
+#define RAK_ATCMD_PERM_READ 1
+#define RAK_ATCMD_PERM_WRITE 2
+
+typedef enum
+{
+	RAK_TIMER_0,
+	RAK_TIMER_1,
+	RAK_TIMER_2,
+	RAK_TIMER_3,
+	RAK_TIMER_4
+} RAK_TIMER_ID;
+typedef enum
+{
+	RAK_TIMER_ONESHOT,
+	RAK_TIMER_PERIODIC
+} RAK_TIMER_MODE;
+typedef void (*RAK_TIMER_HANDLER)(void *);
+
+typedef struct
+{
+	uint8_t Port;
+	uint8_t RxDatarate;
+	int16_t Rssi;
+	int8_t Snr;
+	uint8_t *Buffer;
+	uint8_t BufferSize;
+} SERVICE_LORA_RECEIVE_T;
+
+typedef struct
+{
+	uint8_t *Buffer;
+	uint8_t BufferSize;
+	int16_t Rssi;
+	int8_t Snr;
+} rui_lora_p2p_recv_t;
+
+typedef int (*AT_HANDLER)(SERIAL_PORT, char *, stParam *);
+
+/** Setting of the API, the tests set it directly */
+template <typename T>
+struct rak_setting
+{
+	T value;
+	T get() { return value; }
+	bool set(T new_value)
+	{
+		value = new_value;
+		return true;
+	}
+};
+
+/** Subset of the RUI3 API, timers and AT commands do nothing */
+struct rak_api
+{
+	struct
+	{
+		struct
+		{
+			bool create(RAK_TIMER_ID, RAK_TIMER_HANDLER, RAK_TIMER_MODE) { return true; }
+			bool start(RAK_TIMER_ID, uint32_t, void *) { return true; }
+			bool stop(RAK_TIMER_ID) { return true; }
+		} timer;
+		struct
+		{
+			bool add(char *, char *, char *, AT_HANDLER, unsigned int) { return true; }
+		} atMode;
+	} system;
+	struct
+	{
+		rak_setting<bool> nwm, cfm, njs, adr;
+		rak_setting<uint8_t> rety, dr, band;
+	} lorawan;
+};
+
+extern rak_api api;
@@ -0,0 +1,52 @@
+/**
+ * @file CayenneLPP.h
+ * @author Bernd Giesecke (bernd@giesecke.tk)
+ * @brief Declarations of the CayenneLPP library for the host tests, tests that send payloads must link their own implementation
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#pragma once
+#include <Arduino.h>
+
+#define LPP_DIGITAL_INPUT 0
+#define LPP_DIGITAL_OUTPUT 1
+#define LPP_ANALOG_INPUT 2
+#define LPP_ANALOG_OUTPUT 3
+#define LPP_TEMPERATURE 103
+#define LPP_RELATIVE_HUMIDITY 104
+#define LPP_VOLTAGE 116
+#define LPP_CONCENTRATION 125
+#define LPP_DIGITAL_INPUT_SIZE 1
+#define LPP_ANALOG_OUTPUT_SIZE 2
+#define LPP_TEMPERATURE_SIZE 2
+#define LPP_RELATIVE_HUMIDITY_SIZE 1
+#define LPP_VOLTAGE_SIZE 2
+#define LPP_CONCENTRATION_SIZE 2
+#define LPP_ERROR_OK 0
+#define LPP_ERROR_OVERFLOW 1
+
+class CayenneLPP
+{
+public:
+	CayenneLPP(uint8_t size);
+	void reset();
+	uint8_t getSize();
+	uint8_t *getBuffer();
+	uint8_t copy(uint8_t *buffer);
+	uint8_t getError();
+	uint8_t addDigitalInput(uint8_t channel, uint32_t value);
+	uint8_t addAnalogOutput(uint8_t channel, float value);
+	uint8_t addTemperature(uint8_t channel, float celsius);
+	uint8_t addRelativeHumidity(uint8_t channel, float rh);
+	uint8_t addVoltage(uint8_t channel, float voltage);
+	uint8_t addConcentration(uint8_t channel, uint32_t value);
+
+protected:
+	uint8_t *_buffer;
+	uint8_t _maxsize;
+	uint8_t _cursor;
+	uint8_t _error;
+};
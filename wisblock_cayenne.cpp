@@ -277,4 +277,180 @@ uint8_t WisCayenne::addVoc_index(uint8_t channel, uint32_t voc_index)
 	_buffer[_cursor++] = voc_union.val8[0];
 
 	return _cursor;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Add Modbus bus statistics
+ *        Requires changed decoder in LNS
+ *
+ * @param channel statistics channel
+ * @param requests number of requests sent
+ * @param timeouts number of requests without answer
+ * @param crc_errors number of corrupted answers
+ * @param exceptions number of exception answers
+ * @param overflows number of too long answers
+ * @param response_time smoothed response time in ms
+ * @return uint8_t bytes added to the data packet
+ */
+uint8_t WisCayenne::addModbusStats(uint8_t channel, uint16_t requests, uint16_t timeouts, uint16_t crc_errors,
+								   uint8_t exceptions, uint8_t overflows, uint16_t response_time)
+{
+	// check buffer overflow
+	if ((_cursor + LPP_MB_STATS_SIZE + 2) > _maxsize)
+	{
+		_error = LPP_ERROR_OVERFLOW;
+		return 0;
+	}
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = LPP_MB_STATS;
+
+	_buffer[_cursor++] = requests >> 8;
+	_buffer[_cursor++] = requests;
+	_buffer[_cursor++] = timeouts >> 8;
+	_buffer[_cursor++] = timeouts;
+	_buffer[_cursor++] = crc_errors >> 8;
+	_buffer[_cursor++] = crc_errors;
+	_buffer[_cursor++] = exceptions;
+	_buffer[_cursor++] = overflows;
+	_buffer[_cursor++] = response_time >> 8;
+	_buffer[_cursor++] = response_time;
+
+	return _cursor;
+}
+
+/**
+ * @brief Add Modbus response time histogram
+ *        Requires changed decoder in LNS
+ *
+ * @param channel histogram channel
+ * @param shares LPP_MB_HIST_SIZE values with the share of each bucket in %
+ * @return uint8_t bytes added to the data packet
+ */
+uint8_t WisCayenne::addModbusHistogram(uint8_t channel, const uint8_t *shares)
+{
+	// check buffer overflow
+	if ((_cursor + LPP_MB_HIST_SIZE + 2) > _maxsize)
+	{
+		_error = LPP_ERROR_OVERFLOW;
+		return 0;
+	}
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = LPP_MB_HIST;
+
+	for (uint8_t idx = 0; idx < LPP_MB_HIST_SIZE; idx++)
+	{
+		_buffer[_cursor++] = shares[idx];
+	}
+
+	return _cursor;
+}
+
+/**
+ * @brief Add results of downlink Modbus writes
+ *        Requires changed decoder in LNS
+ *
+ * @param channel write result channel
+ * @param writes number of writes
+ * @param results bit n is set if write n was acknowledged
+ * @param rejected number of writes that were not accepted
+ * @return uint8_t bytes added to the data packet
+ */
+uint8_t WisCayenne::addModbusWrite(uint8_t channel, uint8_t writes, uint8_t results, uint8_t rejected)
+{
+	// check buffer overflow
+	if ((_cursor + LPP_MB_WRITE_SIZE + 2) > _maxsize)
+	{
+		_error = LPP_ERROR_OVERFLOW;
+		return 0;
+	}
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = LPP_MB_WRITE;
+
+	_buffer[_cursor++] = writes;
+	_buffer[_cursor++] = results;
+	_buffer[_cursor++] = rejected;
+
+	return _cursor;
+}
+
+/** Encoding of a standard Cayenne LPP type for addFixed() */
+struct lpp_fixed_s
+{
+	/** Cayenne LPP data type */
+	uint8_t type;
+	/** Number of data bytes */
+	uint8_t size;
+	/** Data value per unit of the type */
+	uint8_t multiplier;
+	/** Data value is signed */
+	bool is_signed;
+};
+
+/** Standard types supported by addFixed() */
+static const lpp_fixed_s lpp_fixed_types[] = {
+	{LPP_DIGITAL_INPUT, LPP_DIGITAL_INPUT_SIZE, 1, false},
+	{LPP_TEMPERATURE, LPP_TEMPERATURE_SIZE, 10, true},
+	{LPP_RELATIVE_HUMIDITY, LPP_RELATIVE_HUMIDITY_SIZE, 2, false},
+	{LPP_ANALOG_OUTPUT, LPP_ANALOG_OUTPUT_SIZE, 100, true},
+	{LPP_VOLTAGE, LPP_VOLTAGE_SIZE, 100, false},
+	{LPP_CONCENTRATION, LPP_CONCENTRATION_SIZE, 1, false},
+};
+
+/**
+ * @brief Add a value of a standard type from an integer with a fixed scale
+ *        Same bytes as the float add functions of CayenneLPP, but rounded to the nearest step
+ *        and limited to the range of the type, without float arithmetic
+ *
+ * @param channel LPP channel
+ * @param type Cayenne LPP data type
+ * @param raw value in 1 / divisor of the unit of the type, e.g. mV with divisor 1000 for LPP_VOLTAGE
+ * @param divisor scale of the raw value
+ * @return uint8_t bytes added to the data packet, 0 if the type is not supported or the buffer is full
+ */
+uint8_t WisCayenne::addFixed(uint8_t channel, uint8_t type, int32_t raw, uint16_t divisor)
+{
+	const lpp_fixed_s *format = NULL;
+	for (uint8_t idx = 0; idx < sizeof(lpp_fixed_types) / sizeof(lpp_fixed_types[0]); idx++)
+	{
+		if (lpp_fixed_types[idx].type == type)
+		{
+			format = &lpp_fixed_types[idx];
+			break;
+		}
+	}
+	if ((format == NULL) || (divisor == 0))
+	{
+		return 0;
+	}
+
+	// check buffer overflow
+	if ((_cursor + format->size + 2) > _maxsize)
+	{
+		_error = LPP_ERROR_OVERFLOW;
+		return 0;
+	}
+
+	// Round half away from zero
+	int64_t scaled = (int64_t)raw * format->multiplier;
+	int64_t value = (scaled >= 0) ? (scaled + divisor / 2) / divisor : -((-scaled + divisor / 2) / divisor);
+
+	int64_t max_value = (1LL << (format->size * 8 - (format->is_signed ? 1 : 0))) - 1;
+	int64_t min_value = format->is_signed ? -max_value - 1 : 0;
+	if (value > max_value)
+	{
+		value = max_value;
+	}
+	else if (value < min_value)
+	{
+		value = min_value;
+	}
+
+	_buffer[_cursor++] = channel;
+	_buffer[_cursor++] = type;
+	for (int8_t byte = format->size - 1; byte >= 0; byte--)
+	{
+		_buffer[_cursor++] = (uint8_t)((uint64_t)value >> (byte * 8));
+	}
+
+	return _cursor;
+}
@@ -18,6 +18,9 @@
 #define LPP_GPS4 136 // 3 byte lon/lat 0.0001 °, 3 bytes alt 0.01 meter (Cayenne LPP default)
 #define LPP_GPS6 137 // 4 byte lon/lat 0.000001 °, 3 bytes alt 0.01 meter (Customized Cayenne LPP)
 #define LPP_VOC 138	 // 2 byte VOC index
+#define LPP_MB_STATS 139 // 2 byte requests, 2 byte time-outs, 2 byte CRC errors, 1 byte exceptions, 1 byte overflows, 2 byte response time ms
+#define LPP_MB_HIST 140	 // 8 byte share of response times per histogram bucket in %
+#define LPP_MB_WRITE 141 // 1 byte number of writes, 1 byte results, bit n set if write n was acknowledged, 1 byte rejected writes
 
 // Only Data Size
 #define LPP_GPS4_SIZE 9
@@ -25,6 +28,9 @@
 #define LPP_GPSH_SIZE 14
 #define LPP_GPST_SIZE 10
 #define LPP_VOC_SIZE 2
+#define LPP_MB_STATS_SIZE 10
+#define LPP_MB_HIST_SIZE 8
+#define LPP_MB_WRITE_SIZE 3
 
 class WisCayenne : public CayenneLPP
 {
@@ -36,6 +42,11 @@ public:
 	uint8_t addGNSS_H(int32_t latitude, int32_t longitude, int16_t altitude, int16_t accuracy, int16_t battery);
 	uint8_t addGNSS_T(int32_t latitude, int32_t longitude, int16_t altitude, float accuracy, int8_t sats);
 	uint8_t addVoc_index(uint8_t channel, uint32_t voc_index);
+	uint8_t addModbusStats(uint8_t channel, uint16_t requests, uint16_t timeouts, uint16_t crc_errors,
+						   uint8_t exceptions, uint8_t overflows, uint16_t response_time);
+	uint8_t addModbusHistogram(uint8_t channel, const uint8_t *shares);
+	uint8_t addModbusWrite(uint8_t channel, uint8_t writes, uint8_t results, uint8_t rejected);
+	uint8_t addFixed(uint8_t channel, uint8_t type, int32_t raw, uint16_t divisor);
 
 private:
 };